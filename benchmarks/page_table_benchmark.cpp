@@ -0,0 +1,92 @@
+// clang++ benchmarks/page_table_benchmark.cpp -O3 -DNDEBUG -std=c++20 && ./a.out
+//
+// Measures the cache-hit path of DiskPageManager::load_page. For comparison
+// it also times the lookup DiskPageManager used to do: find + at on an
+// unordered_map<PageLoc, shared_ptr<Block>>.
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+
+#include "../src/common/DiskPageManager.h"
+
+using namespace cpot;
+
+namespace {
+
+struct Page {
+  uint64_t value;
+  char padding[504];
+};
+
+struct LegacyBlock {
+  LegacyBlock(uint64_t location) : data(new Page()), location(location) {}
+  ~LegacyBlock() {
+    delete data;
+  }
+  Page *data;
+  bool isReferenced;
+  uint64_t location;
+};
+
+// The hit path as it was before the flat page table.
+struct LegacyPageTable {
+  Page const *load_page(PageLoc loc) {
+    if (pages_.find(loc) == pages_.end()) {
+      pages_.insert(std::make_pair(loc, std::make_shared<LegacyBlock>(loc)));
+    }
+    std::shared_ptr<LegacyBlock> block = pages_.at(loc);
+    block->isReferenced = true;
+    return &(block->data[loc - block->location]);
+  }
+  std::unordered_map<PageLoc, std::shared_ptr<LegacyBlock>> pages_;
+};
+
+constexpr PageLoc kNumPages = 20'000;
+constexpr size_t kNumLookups = 10'000'000;
+
+template<class F>
+double nanoseconds_per_lookup(const std::vector<PageLoc>& locs, F load) {
+  uint64_t sum = 0;
+  auto t0 = std::chrono::high_resolution_clock::now();
+  for (PageLoc loc : locs) {
+    sum += load(loc)->value;
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  // Keeps the loop from being optimized away.
+  volatile uint64_t sink = sum;
+  (void)sink;
+  return std::chrono::duration<double, std::nano>(t1 - t0).count() / locs.size();
+}
+
+void benchmark_hit_path() {
+  std::remove("test-index-bench");
+  std::remove("test-index-bench.dpm_header");
+
+  std::shared_ptr<PageManager<Page>> manager = std::make_shared<DiskPageManager<Page>>("test-index-bench");
+  LegacyPageTable legacy;
+  for (PageLoc i = 0; i < kNumPages; ++i) {
+    manager->new_page()->value = i;
+    legacy.load_page(i);
+  }
+
+  std::mt19937 rng(0);
+  std::vector<PageLoc> locs(kNumLookups);
+  for (size_t i = 0; i < kNumLookups; ++i) {
+    locs[i] = rng() % kNumPages;
+  }
+
+  const double before = nanoseconds_per_lookup(locs, [&](PageLoc loc) { return legacy.load_page(loc); });
+  const double after = nanoseconds_per_lookup(locs, [&](PageLoc loc) { return manager->load_page(loc); });
+  std::cout << "unordered_map + shared_ptr: " << before << " ns/hit" << std::endl;
+  std::cout << "flat page table:            " << after << " ns/hit" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  benchmark_hit_path();
+  return 0;
+}
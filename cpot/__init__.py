@@ -25,6 +25,10 @@ class BaseIndex:
   def smallest_row():
     assert False
 
+  @staticmethod
+  def largest_row():
+    assert False
+
   def insert(self, token, obj):
     _cpot.insert(self.indexType, self.index, token, obj)
 
@@ -61,6 +65,29 @@ class BaseIndex:
     assert isinstance(limit, int)
     return _cpot.generalized_intersect(self.indexType, self.index, tokens, lower_bound, limit)
 
+  # Like intersect, but returns the largest rows that are at most upper_bound,
+  # largest first.
+  def intersect_descending(self, tokens: list, upper_bound=None, limit = 10):
+    if upper_bound is None:
+      upper_bound = self.largest_row()
+    for token in tokens:
+      assert isinstance(token, int)
+    self.assert_valid_row(upper_bound)
+    assert isinstance(limit, int)
+    return _cpot.intersect_descending(self.indexType, self.index, tokens, upper_bound, limit)
+
+  def generalized_intersect_descending(self, tokens: list, upper_bound=None, limit = 10):
+    if upper_bound is None:
+      upper_bound = self.largest_row()
+    for token in tokens:
+      assert len(token) == 2
+      assert isinstance(token[0], int)
+      assert isinstance(token[1], bool)
+    assert sum(1 - t[1] for t in tokens) > 0, 'Must have at least one non-negated token'
+    self.assert_valid_row(upper_bound)
+    assert isinstance(limit, int)
+    return _cpot.generalized_intersect_descending(self.indexType, self.index, tokens, upper_bound, limit)
+
   def token_iterator(self, token, lower_bound = None):
     if lower_bound is None:
       lower_bound = self.smallest_row()
@@ -100,6 +127,10 @@ class UInt32PairIndex(BaseIndex):
   def smallest_row():
     return (0, 0)
 
+  @staticmethod
+  def largest_row():
+    return (2**32 - 1, 2**32 - 1)
+
 class UInt64KeyValueIndex(BaseIndex):
   def __init__(self, path):
     super().__init__(indexType=IndexType.UInt64KeyValueIndex, path=path)
@@ -114,6 +145,10 @@ class UInt64KeyValueIndex(BaseIndex):
   def smallest_row():
     return (0, 0)
 
+  @staticmethod
+  def largest_row():
+    return (2**64 - 1, 2**64 - 1)
+
   def kv_union(self, tokens):
     return _cpot.kv_union(self.indexType, self.index, tokens)
 
@@ -128,3 +163,7 @@ class UInt64Index(BaseIndex):
   @staticmethod
   def smallest_row():
     return 0
+
+  @staticmethod
+  def largest_row():
+    return 2**64 - 1
@@ -10,6 +10,8 @@ using namespace cpot;
 struct UInt32PairRow {
   uint32_t docid;
   uint32_t value;
+  typedef uint32_t SearchKey;
+  static constexpr bool kSearchKeyIsUnique = false;
   static UInt32PairRow smallest() {
     return UInt32PairRow{0, 0};
   }
@@ -40,8 +42,9 @@ struct UInt32PairRow {
   UInt32PairRow next() const {
     return UInt32PairRow{docid + 1};
   }
+  // The largest row with a smaller docid, mirroring next().
   UInt32PairRow prev() const {
-    return UInt32PairRow{docid - 1};
+    return UInt32PairRow{docid - 1, uint32_t(-1)};
   }
 };
 
@@ -15,6 +15,8 @@ using namespace cpot;
 struct UInt64KeyValueRow {
   uint64_t key;
   uint64_t value;
+  typedef uint64_t SearchKey;
+  static constexpr bool kSearchKeyIsUnique = true;
   static UInt64KeyValueRow smallest() {
     return UInt64KeyValueRow{0, 0};
   }
@@ -6,6 +6,8 @@
 
 struct UInt64Row {
   uint64_t val;
+  typedef uint64_t SearchKey;
+  static constexpr bool kSearchKeyIsUnique = true;
   UInt64Row() {}
   UInt64Row(uint64_t val) : val(val) {}
   static UInt64Row smallest() {
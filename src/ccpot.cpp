@@ -96,6 +96,16 @@ std::vector<T> ffetch(std::shared_ptr< IteratorInterface<T> > it, size_t limit)
   return ffetch(it.get(), limit);
 }
 
+template<class Row>
+std::vector<Row> unreverse(const std::vector<Reversed<Row>>& rows) {
+  std::vector<Row> r;
+  r.reserve(rows.size());
+  for (const Reversed<Row>& row : rows) {
+    r.push_back(row.row);
+  }
+  return r;
+}
+
 // template<class Row>
 // bool objectToRow(PyObject *object, Row *row) {
 //   return false;
@@ -241,7 +251,14 @@ std::shared_ptr<IteratorInterface<Row>> object_to_iterator(PyObject *object) {
 template<class Row>
 struct Index {
   static PyObject *newIndex(std::string name) {
-    InvertedIndex<Row> *index = new InvertedIndex<Row>(name);
+    InvertedIndex<Row> *index;
+    try {
+      index = new InvertedIndex<Row>(name);
+    } catch (const std::runtime_error& e) {
+      // E.g. the index is in another format.
+      PyErr_SetString(PyExc_RuntimeError, e.what());
+      return NULL;
+    }
     return PyCapsule_New((void *)index, IndexNamer<Row>::name(), destroy_index_object<Row>);
   }
 
@@ -305,16 +322,18 @@ struct Index {
     return Py_None;
   }
 
-  static PyObject *intersect(PyObject *indexObj, PyObject *tokenList, PyObject *lowerBoundObj, uint64_t limit) {
+  // If descending is true, boundObj is an (inclusive) upper bound and we
+  // return the largest rows first.
+  static PyObject *intersect(PyObject *indexObj, PyObject *tokenList, PyObject *boundObj, uint64_t limit, bool descending) {
     InvertedIndex<Row> *index = (InvertedIndex<Row> *)PyCapsule_GetPointer(indexObj, IndexNamer<Row>::name());
     if (index == nullptr) {
       PyErr_SetString(PyExc_TypeError, "invalid index");
       return NULL;
     }
 
-    Row lowerBound;
-    if (!objectToRow(lowerBoundObj, &lowerBound)) {
-      PyErr_SetString(PyExc_TypeError, "invalid lower bound");
+    Row bound;
+    if (!objectToRow(boundObj, &bound)) {
+      PyErr_SetString(PyExc_TypeError, "invalid bound");
       return NULL;
     }
 
@@ -330,20 +349,20 @@ struct Index {
       tokens.push_back(token);
     }
 
-    std::vector< std::shared_ptr<IteratorInterface<Row>> > iters;
-    for (uint64_t token : tokens) {
-      iters.push_back(index->iterator(
-        token,
-        lowerBound
-      ));
+    if (descending) {
+      std::vector< std::shared_ptr<IteratorInterface<Reversed<Row>>> > iters = index->reverse_iterators(tokens, bound);
+      IntersectionIterator<Reversed<Row>> it(iters);
+      return vector2npy(unreverse(ffetch(&it, limit)));
     }
 
+    std::vector< std::shared_ptr<IteratorInterface<Row>> > iters = index->iterators(tokens, bound);
+
     IntersectionIterator<Row> it(iters);
 
     return vector2npy(ffetch(&it, limit));
   }
 
-  static PyObject *generalized_intersect(PyObject *indexObj, PyObject *tokenList, PyObject *lowerBoundObj, uint64_t limit) {
+  static PyObject *generalized_intersect(PyObject *indexObj, PyObject *tokenList, PyObject *boundObj, uint64_t limit, bool descending) {
 
     InvertedIndex<Row> *index = (InvertedIndex<Row> *)PyCapsule_GetPointer(indexObj, IndexNamer<Row>::name());
     if (index == nullptr) {
@@ -351,8 +370,8 @@ struct Index {
       return NULL;
     }
 
-    Row lowerBound;
-    if (!objectToRow(lowerBoundObj, &lowerBound)) {
+    Row bound;
+    if (!objectToRow(boundObj, &bound)) {
       return NULL;
     }
 
@@ -386,13 +405,10 @@ struct Index {
       tokens.push_back(std::make_pair(token, isNegated));
     }
 
-    std::vector<std::pair<std::shared_ptr<IteratorInterface<Row>>, bool>> iters;
+    std::vector<uint64_t> tokenIds;
     size_t numNonNegated = 0;
     for (std::pair<uint64_t, bool> token : tokens) {
-      iters.push_back(std::make_pair(index->iterator(
-        token.first,
-        lowerBound
-      ), token.second));
+      tokenIds.push_back(token.first);
       if (!token.second) {
         ++numNonNegated;
       }
@@ -403,9 +419,20 @@ struct Index {
       return NULL;
     }
 
-    GeneralIntersectionIterator<Row> it(iters);
+    if (descending) {
+      return vector2npy(unreverse(_generalized_fetch(index->reverse_iterators(tokenIds, bound), tokens, limit)));
+    }
+    return vector2npy(_generalized_fetch(index->iterators(tokenIds, bound), tokens, limit));
+  }
 
-    return vector2npy(ffetch(&it, limit));
+  template<class T>
+  static std::vector<T> _generalized_fetch(const std::vector<std::shared_ptr<IteratorInterface<T>>>& tokenIters, const std::vector<std::pair<uint64_t, bool>>& tokens, uint64_t limit) {
+    std::vector<std::pair<std::shared_ptr<IteratorInterface<T>>, bool>> iters;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      iters.push_back(std::make_pair(tokenIters[i], tokens[i].second));
+    }
+    GeneralIntersectionIterator<T> it(iters);
+    return ffetch(&it, limit);
   }
 
   static PyObject *token_iterator(PyObject *indexObj, uint64_t token, PyObject *lowerBoundObj) {
@@ -516,13 +543,7 @@ struct Index {
       tokens.push_back(token);
     }
 
-    std::vector< std::shared_ptr<IteratorInterface<Row>> > iters;
-    for (uint64_t token : tokens) {
-      iters.push_back(index->iterator(
-        token,
-        Row::smallest()
-      ));
-    }
+    std::vector< std::shared_ptr<IteratorInterface<Row>> > iters = index->iterators(tokens, Row::smallest());
 
     auto it = KVUnionIterator<Row, uint64_t, uint64_t>(iters);
     std::vector<std::pair<uint64_t, std::vector<uint64_t>>> rows = ffetch(&it, size_t(-1));
@@ -676,55 +697,71 @@ static PyObject *flush(PyObject *self, PyObject *args) {
   }
 }
 
-static PyObject *intersect(PyObject *self, PyObject *args) {
+static PyObject *_intersect(PyObject *args, bool descending) {
   PyObject* indexObj = NULL;
   PyObject *tokenList;
-  PyObject *lowerBound;
+  PyObject *bound;
   uint64_t rowTypeInt;
   uint64_t limit;
-  if(!PyArg_ParseTuple(args, "KOOOK", &rowTypeInt, &indexObj, &tokenList, &lowerBound, &limit)) {
+  if(!PyArg_ParseTuple(args, "KOOOK", &rowTypeInt, &indexObj, &tokenList, &bound, &limit)) {
     PyErr_SetString(PyExc_TypeError, "Invalid args");
     return NULL;
   }
 
   switch (RowType(rowTypeInt)) {
     case RowType::UInt64Index:
-      return Index<UInt64Row>::intersect(indexObj, tokenList, lowerBound, limit);
+      return Index<UInt64Row>::intersect(indexObj, tokenList, bound, limit, descending);
     case RowType::UInt32PairIndex:
-      return Index<UInt32PairRow>::intersect(indexObj, tokenList, lowerBound, limit);
+      return Index<UInt32PairRow>::intersect(indexObj, tokenList, bound, limit, descending);
     case RowType::UInt64KeyValueIndex:
-      return Index<UInt64KeyValueRow>::intersect(indexObj, tokenList, lowerBound, limit);
+      return Index<UInt64KeyValueRow>::intersect(indexObj, tokenList, bound, limit, descending);
     default:
       PyErr_SetString(PyExc_TypeError, "Invalid row type");
       return NULL;
   }
 }
 
-static PyObject *generalized_intersect(PyObject *self, PyObject *args) {
+static PyObject *intersect(PyObject *self, PyObject *args) {
+  return _intersect(args, false);
+}
+
+static PyObject *intersect_descending(PyObject *self, PyObject *args) {
+  return _intersect(args, true);
+}
+
+static PyObject *_generalized_intersect(PyObject *args, bool descending) {
   PyObject* indexObj = NULL;
   PyObject *tokenList;
-  PyObject *lowerBound;
+  PyObject *bound;
   uint64_t rowTypeInt;
   uint64_t limit;
 
-  if(!PyArg_ParseTuple(args, "KOOOK", &rowTypeInt, &indexObj, &tokenList, &lowerBound, &limit)) {
+  if(!PyArg_ParseTuple(args, "KOOOK", &rowTypeInt, &indexObj, &tokenList, &bound, &limit)) {
     PyErr_SetString(PyExc_TypeError, "Invalid args");
     return NULL;
   }
 
   switch (RowType(rowTypeInt)) {
     case RowType::UInt64Index:
-      return Index<UInt64Row>::generalized_intersect(indexObj, tokenList, lowerBound, limit);
+      return Index<UInt64Row>::generalized_intersect(indexObj, tokenList, bound, limit, descending);
     case RowType::UInt32PairIndex:
-      return Index<UInt32PairRow>::generalized_intersect(indexObj, tokenList, lowerBound, limit);
+      return Index<UInt32PairRow>::generalized_intersect(indexObj, tokenList, bound, limit, descending);
     case RowType::UInt64KeyValueIndex:
-      return Index<UInt64KeyValueRow>::generalized_intersect(indexObj, tokenList, lowerBound, limit);
+      return Index<UInt64KeyValueRow>::generalized_intersect(indexObj, tokenList, bound, limit, descending);
     default:
       PyErr_SetString(PyExc_TypeError, "Invalid row type");
       return NULL;
   }
 }
 
+static PyObject *generalized_intersect(PyObject *self, PyObject *args) {
+  return _generalized_intersect(args, false);
+}
+
+static PyObject *generalized_intersect_descending(PyObject *self, PyObject *args) {
+  return _generalized_intersect(args, true);
+}
+
 static PyObject *token_iterator(PyObject *self, PyObject *args) {
   uint64_t rowTypeInt;
   PyObject* indexObj = NULL;
@@ -861,6 +898,8 @@ static PyMethodDef CcpotMethods[] = {
  { "count", count, METH_VARARGS, "Returns how many times a token occurs." },
  { "intersect", intersect, METH_VARARGS, "Returns all objects associated with all of the given tokens." },
  { "generalized_intersect", generalized_intersect, METH_VARARGS, "Like intersect but takes (token, isNegated) tuples rather than simply tokens" },
+ { "intersect_descending", intersect_descending, METH_VARARGS, "Like intersect but returns the largest objects (at most the given upper bound) first." },
+ { "generalized_intersect_descending", generalized_intersect_descending, METH_VARARGS, "Like generalized_intersect but returns the largest objects (at most the given upper bound) first." },
  { "token_iterator", token_iterator, METH_VARARGS, "Returns an iterator that loops over all objects associated with a given token." },
  { "generalized_intersection_iterator", generalized_intersection_iterator, METH_VARARGS, "Given a list of (iter: Iterator, isNegated: bool) tuples, returns an iterator that is the intersection of them all." },
  { "union_iterator", union_iterator, METH_VARARGS, "Given a list of iterators, returns an iterator that is the union of them all." },
@@ -1,138 +1,1140 @@
 #ifndef DISK_PAGE_MANAGER_H
 #define DISK_PAGE_MANAGER_H
 
+#include "FreePageList.h"
 #include "PageManager.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
 namespace cpot {
 
+// How much a DiskPageManager read from or wrote to the index file (the
+// ".dpm_header" free list isn't counted).
+struct IOStats {
+  uint64_t pages = 0;
+  uint64_t bytes = 0;
+  uint64_t syscalls = 0;
+};
+
+/**
+ * Caches pages in memory and writes modified pages back to disk.
+ *
+ * Cached pages live in frames (MemoryBlocks) that are carved out of chunks of
+ * kFramesPerChunk and recycled, and table_ maps a PageLoc straight to its
+ * frame, so a cache hit is a couple of loads and a null check.
+ *
+ * Misses on consecutive pages (e.g. a scan over leaves that were allocated
+ * one after another) are read as a whole extent with one preadv, and the
+ * extent doubles, up to kMaxExtentPages, while the scan stays sequential.
+ *
+ * If maxMemory is non-zero the cache is a fixed-size buffer pool: reclaim()
+ * evicts pages with the CLOCK algorithm until we're back under budget,
+ * writing back dirty pages as they're evicted. Pinned pages are skipped, and
+ * a pinned page that's deleted keeps its frame (and its PageLoc stays off the
+ * free list) until it's unpinned.
+ *
+ * Any number of threads can use it at once:
+ *   - Cache hits take no locks. table_ is split into segments that never
+ *     move, so it can grow under them.
+ *   - A miss locks one of kShards shards (picked by PageLoc) just long enough
+ *     to claim the page. The thread that claims it reads it with pread,
+ *     outside the lock, and anyone else who wants that page waits on the
+ *     shard until it's in.
+ *   - Frames, the free list and the dirty list are behind poolMutex_.
+ *
+ * Eviction takes a page's shard latch and skips pinned pages. A thread that
+ * holds on to a page while another thread might call reclaim() has to pin
+ * it; pin() loads the page if it isn't cached. flush() still needs the
+ * manager to itself.
+ *
+ * With set_dirty_watermarks(), a background thread writes dirty pages back
+ * a batch at a time once there are more than lowWatermark bytes of them, so
+ * that commit() and eviction find most pages clean. A page can only be taken
+ * when nobody is in the middle of changing it. Nobody is when reclaim() is
+ * called, so reclaim() copies the oldest dirty pages into a batch, marks them
+ * clean and hands them over. Between reclaims, the writer takes batches
+ * itself when the dirty pages cross lowWatermark (so an idle pool drains
+ * too), but only of pages that haven't been handed out to be changed since
+ * the last reclaim() (see _take_dirty_pages). The frames stay pinned until
+ * the batch is written, so nobody reads an older copy back from the file.
+ * Past highWatermark (counting the batch being written), reclaim() waits for
+ * the writer, which slows writers down to the speed of the disk. If a
+ * background write fails, its pages are dirty again and the error is thrown
+ * by the next commit() or reclaim().
+ */
 template<class Page>
 struct DiskPageManager : public PageManager<Page> {
+  static constexpr size_t kFramesPerChunk = 256;
+  static constexpr PageLoc kMinExtentPages = 4;
+  static constexpr PageLoc kMaxExtentPages = 64;
+  static constexpr size_t kShards = 64;
+  static constexpr size_t kSegmentBits = 16;
+  static constexpr size_t kSegmentSize = size_t(1) << kSegmentBits;
+  static constexpr size_t kWriteBatchPages = 256;
+
+  typedef std::atomic<MemoryBlock<Page> *> Slot;
+
+  // Pages copied out for the background writer.
+  struct WriteBatch {
+    std::vector<MemoryBlock<Page> *> blocks;  // pinned until the batch is written
+    std::vector<std::pair<PageLoc, Page const *>> pages;
+    std::unique_ptr<Page[]> copies;
+  };
+
+  // The latch for a slice of table_, and the pages in that slice that some
+  // thread is reading in.
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::condition_variable loaded;
+    std::vector<PageLoc> loading;
+  };
+
   DiskPageManager() = delete;
-  DiskPageManager(const std::string& filename)
-  : filename_(filename) {
-    file_ = fopen(filename.c_str(), "rb+");
-    if (file_ == nullptr) {
-      file_ = fopen(filename.c_str(), "wb");
-      fclose(file_);
-      file_ = fopen(filename.c_str(), "rb+");
-    }
-    fseek(file_, 0, SEEK_END);
-    numPages_ = ftell(file_) / sizeof(Page);
-
-    std::string headerFilename = this->_header_filename();
-    FILE *headerFile = fopen(headerFilename.c_str(), "rb+");
-    if (headerFile == nullptr) {
-      headerFile = fopen(headerFilename.c_str(), "wb");
-      fclose(headerFile);
-      headerFile = fopen(headerFilename.c_str(), "rb+");
-    }
-
-    fseek(headerFile, 0, SEEK_END);
-    availablePages_.resize(ftell(headerFile) / sizeof(PageLoc));
-    fseek(headerFile, 0, SEEK_SET);
-    fread(&availablePages_[0], sizeof(PageLoc), availablePages_.size(), headerFile);
-    fclose(headerFile);
-  }
-  std::string _header_filename() const {
-    return filename_ + ".dpm_header";
+  // `format` is the layout of the pages, checked against the one the file
+  // was written with (see FreePageList::check_format).
+  DiskPageManager(const std::string& filename, uint64_t maxMemory = 0, uint64_t format = 0)
+  : filename_(filename), freePages_(filename + ".dpm_header"), _currentMemoryUsed(0), maxMemory_(maxMemory), clockHand_(0), holdDirtyPages_(false),
+    dirtyPages_(0), lastReadLoc_(kNoPage), extentPages_(1) {
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("cannot open " + filename);
+    }
+    struct stat st;
+    fstat(fd_, &st);
+    numPages_ = st.st_size / sizeof(Page);
+    try {
+      freePages_.check_format(format, numPages_);
+    } catch (...) {
+      close(fd_);
+      throw;
+    }
+    table_ = std::make_unique<std::atomic<Slot *>[]>(size_t(1) << (32 - kSegmentBits));
+    this->_grow_table(numPages_);
   }
   Page const *load_page(PageLoc loc) override {
-    return this->_load_page(loc);
+    return &(this->_load_block(loc)->data);
   }
-  Page *_load_page(PageLoc loc) {
+  MemoryBlock<Page> *_load_block(PageLoc loc) {
     #ifndef NDEBUG
     if (loc >= numPages_) {
       std::cout << "trying to fetch page " << loc << std::endl;
       std::raise(SIGSEGV);
     }
     #endif
-    if (pages_.find(loc) == pages_.end()) {
-      std::shared_ptr<MemoryBlock<Page>> block = std::make_shared<MemoryBlock<Page>>(loc);
-      fseek(file_, loc * sizeof(Page), SEEK_SET);
-      fread(block->data, sizeof(Page), 1, file_);
-      pages_.insert(std::make_pair(loc, block));
-      _currentMemoryUsed += sizeof(Page);
+    MemoryBlock<Page> *block = this->_slot(loc).load(std::memory_order_acquire);
+    if (block == nullptr) {
+      block = this->_load_missing(loc);
     }
-    std::shared_ptr<MemoryBlock<Page>> block = pages_.at(loc);
-    return &(block->data[loc - block->location]);
+    block->isReferenced.store(true, std::memory_order_relaxed);
+    return block;
   }
-  Page *load_and_modify_page(PageLoc loc) override {
-    #ifndef NDEBUG
-    if (loc >= numPages_) {
-      std::cout << "trying to fetch page " << loc << std::endl;
-      std::raise(SIGSEGV);
+  Slot& _slot(PageLoc loc) const {
+    return table_[loc >> kSegmentBits].load(std::memory_order_acquire)[loc & (kSegmentSize - 1)];
+  }
+  Shard& _shard(PageLoc loc) {
+    return shards_[loc % kShards];
+  }
+  // Makes room in table_ for pages [0, n). Callers hold poolMutex_ (or are
+  // the constructor).
+  void _grow_table(uint64_t n) {
+    while (segments_.size() * kSegmentSize < n) {
+      segments_.push_back(std::make_unique<Slot[]>(kSegmentSize));
+      table_[segments_.size() - 1].store(segments_.back().get(), std::memory_order_release);
     }
-    #endif
-    Page *page = this->_load_page(loc);
-    pages_.at(loc)->page_was_modified();
-    return page;
+  }
+  // Reads `loc` in, unless another thread already is, in which case we wait
+  // for it to finish.
+  MemoryBlock<Page> *_load_missing(PageLoc loc) {
+    Shard& shard = this->_shard(loc);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    while (true) {
+      MemoryBlock<Page> *block = this->_slot(loc).load(std::memory_order_acquire);
+      if (block != nullptr) {
+        return block;
+      }
+      if (std::find(shard.loading.begin(), shard.loading.end(), loc) == shard.loading.end()) {
+        break;
+      }
+      shard.loaded.wait(lock);
+    }
+    shard.loading.push_back(loc);
+    lock.unlock();
+    return this->_read_blocks(loc);
+  }
+  // Claims a missing page for the caller to read in (and _publish). Returns
+  // false if it's cached or someone else is reading it.
+  bool _claim(PageLoc loc) {
+    Shard& shard = this->_shard(loc);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (this->_slot(loc).load() != nullptr) {
+      return false;
+    }
+    if (std::find(shard.loading.begin(), shard.loading.end(), loc) != shard.loading.end()) {
+      return false;
+    }
+    shard.loading.push_back(loc);
+    return true;
+  }
+  // Puts a claimed page that has been read in into the table, and wakes
+  // anyone waiting for it.
+  void _publish(MemoryBlock<Page> *block) {
+    Shard& shard = this->_shard(block->location);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    this->_slot(block->location).store(block, std::memory_order_release);
+    shard.loading.erase(std::find(shard.loading.begin(), shard.loading.end(), PageLoc(block->location)));
+    shard.loaded.notify_all();
+  }
+  // Gives up on a claimed page whose read failed: frees its frame and wakes
+  // anyone waiting for it (who then try to read it themselves).
+  void _abandon(MemoryBlock<Page> *block) {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    Shard& shard = this->_shard(block->location);
+    std::lock_guard<std::mutex> shardLock(shard.mutex);
+    shard.loading.erase(std::find(shard.loading.begin(), shard.loading.end(), PageLoc(block->location)));
+    this->_free_block(block);
+    shard.loaded.notify_all();
+  }
+  // Reads `loc` (which the caller has claimed) from disk, along with the
+  // pages after it if it looks like we're scanning forward.
+  MemoryBlock<Page> *_read_blocks(PageLoc loc) {
+    const PageLoc lastReadLoc = lastReadLoc_.load(std::memory_order_relaxed);
+    PageLoc extentPages = 1;
+    if (lastReadLoc != kNoPage && loc == lastReadLoc + 1) {
+      extentPages = std::clamp<PageLoc>(extentPages_.load(std::memory_order_relaxed) * 2, kMinExtentPages, kMaxExtentPages);
+    }
+    extentPages_.store(extentPages, std::memory_order_relaxed);
+    // Don't let read-ahead crowd out more than a quarter of a bounded pool.
+    PageLoc maxPages = extentPages;
+    if (maxMemory_ != 0) {
+      maxPages = std::clamp<uint64_t>(maxMemory_ / sizeof(Page) / 4, 1, maxPages);
+    }
+    struct iovec iov[kMaxExtentPages];
+    MemoryBlock<Page> *blocks[kMaxExtentPages];
+    PageLoc n = 1;
+    {
+      std::lock_guard<std::mutex> lock(poolMutex_);
+      // Stop at the end of the file, at the first page that's already here
+      // (or on its way), and at free pages, which new_page() expects not to
+      // be cached.
+      while (n < maxPages && loc + n < numPages_ && !freePages_.contains(loc + n) && this->_claim(loc + n)) {
+        ++n;
+      }
+      for (PageLoc i = 0; i < n; ++i) {
+        blocks[i] = this->_new_block(loc + i);
+        // Pages we read ahead haven't been used yet, so CLOCK may take them first.
+        blocks[i]->isReferenced = (i == 0);
+        iov[i] = {&blocks[i]->data, sizeof(Page)};
+      }
+      totalReadStats_.pages += n;
+      totalReadStats_.bytes += n * sizeof(Page);
+      totalReadStats_.syscalls += 1;
+    }
+    try {
+      this->_vector_io(preadv, "read", iov, n, off_t(loc) * sizeof(Page));
+    } catch (...) {
+      for (PageLoc i = 0; i < n; ++i) {
+        this->_abandon(blocks[i]);
+      }
+      throw;
+    }
+    lastReadLoc_.store(loc + n - 1, std::memory_order_relaxed);
+    for (PageLoc i = 0; i < n; ++i) {
+      this->_publish(blocks[i]);
+    }
+    return blocks[0];
+  }
+  Page *load_and_modify_page(PageLoc loc) override {
+    MemoryBlock<Page> *block = this->_load_block(loc);
+    block->modifiedEpoch.store(reclaimEpoch_, std::memory_order_relaxed);
+    this->_mark_dirty(block);
+    return &(block->data);
   }
   void delete_page(PageLoc loc) override {
     if (loc >= numPages_) {
       std::cout << loc << std::endl;
       assert(false);
     }
-    pages_.erase(loc);
-    availablePages_.push_back(loc);
-    // TODO
-    // I think all we can do is store that this page is free and use it for the
-    // next allocation. Actually deleting the page seems impossible without storing
-    // parent pointers.
+    // Don't let the background writer's copy of the page land after the
+    // page is reused.
+    std::unique_lock<std::mutex> writerLock(writerMutex_);
+    writerDone_.wait(writerLock, [&]() {
+      return batch_ == nullptr || std::find(batch_->blocks.begin(), batch_->blocks.end(), this->_slot(loc).load()) == batch_->blocks.end();
+    });
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    MemoryBlock<Page> *block = this->_slot(loc).load();
+    if (block != nullptr) {
+      std::lock_guard<std::mutex> shardLock(this->_shard(loc).mutex);
+      if (block->pinCount > 0) {
+        // Someone still has a pointer to the page, so neither the frame nor
+        // the PageLoc can be reused yet. The last unpin() frees both.
+        block->isDeleted = true;
+        if (block->isModified) {
+          block->isModified = false;
+          dirtyPages_ -= 1;
+        }
+        return;
+      }
+      this->_free_block(block);
+    }
+    // The page is reused by the next allocation. Only compaction (see
+    // plan_compaction) can shrink the file, since moving a page means fixing
+    // whatever points at it.
+    freePages_.push(loc);
   }
   Page *new_page(PageLoc *location = nullptr) override {
-    if (availablePages_.size() > 0) {
-      const PageLoc loc = availablePages_.back();
-      availablePages_.pop_back();
-      std::shared_ptr<MemoryBlock<Page>> page = std::make_shared<MemoryBlock<Page>>(loc);
-      pages_.insert(std::make_pair(loc, page));
-      _currentMemoryUsed += sizeof(Page);
-      page->page_was_modified();
-      if (location != nullptr) {
-        *location = loc;
-      }
-      return &(page->data[loc - page->location]);
-    }
-    const PageLoc loc = numPages_++;
-    std::shared_ptr<MemoryBlock<Page>> page = std::make_shared<MemoryBlock<Page>>(loc);
-    pages_.insert(std::make_pair(loc, page));
-    _currentMemoryUsed += sizeof(Page);
-    page->page_was_modified();
+    std::unique_lock<std::mutex> lock(poolMutex_);
+    PageLoc loc;
+    if (!freePages_.pop(&loc)) {
+      loc = numPages_;
+      this->_grow_table(uint64_t(loc) + 1);
+      numPages_ += 1;
+    }
+    assert(this->_slot(loc).load() == nullptr);
+    MemoryBlock<Page> *block = this->_new_block(loc);
+    block->modifiedEpoch = reclaimEpoch_.load();
+    // Nobody else can be after a page that didn't exist, so no need to claim it.
+    this->_slot(loc).store(block, std::memory_order_release);
+    bool crossed = false;
+    if (block->page_was_modified()) {
+      dirtyBlocks_.push_back(block);
+      crossed = this->_count_dirty_page();
+    }
     if (location != nullptr) {
       *location = loc;
     }
-    return &(page->data[loc - page->location]);
+    lock.unlock();
+    if (crossed) {
+      this->_wake_writer();
+    }
+    return &(block->data);
   }
   void commit() override {
-    for (auto it = pages_.begin(); it != pages_.end(); ++it) {
-      it->second->write(file_);
+    // Let the background writer finish, and don't give it more until we're
+    // done, so that none of its (older) copies land after ours.
+    std::unique_lock<std::mutex> writerLock(writerMutex_);
+    writerDone_.wait(writerLock, [this]() { return batch_ == nullptr; });
+    this->_rethrow_writer_error();
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    std::vector<MemoryBlock<Page> *> dirty = this->_dirty_blocks();
+    lastCommitStats_ = this->_write_blocks(&dirty);
+    // Only once they're written: if the write fails, the blocks are still
+    // dirty and the next commit() has to find them.
+    dirtyBlocks_.clear();
+    lastFreeListBytes_ = freePages_.commit();
+    if (truncatePending_) {
+      if (ftruncate(fd_, off_t(numPages_) * sizeof(Page)) != 0) {
+        throw std::runtime_error("cannot truncate " + filename_);
+      }
+      truncatePending_ = false;
+    }
+  }
+  // The frames the next commit() will write. Callers hold poolMutex_.
+  std::vector<MemoryBlock<Page> *> _dirty_blocks() const {
+    // Frames that were evicted, deleted or already written since they were
+    // marked are no longer dirty, and a reused frame can be listed twice.
+    std::vector<MemoryBlock<Page> *> dirty;
+    dirty.reserve(dirtyBlocks_.size());
+    for (MemoryBlock<Page> *block : dirtyBlocks_) {
+      if (block->inUse && block->isModified) {
+        dirty.push_back(block);
+      }
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    return dirty;
+  }
+
+  // A checkpoint journal (filename + ".ckpt") is a JournalHeader, the free
+  // list's bitmap, numEntries (PageLoc as a uint64_t, Page) pairs, and a
+  // checksum of everything before it. One that's cut short or doesn't match
+  // its checksum was being written when we crashed, before the commit it
+  // describes began, so it's ignored.
+  struct JournalHeader {
+    uint64_t magic;
+    uint64_t numPages;
+    uint64_t numWords;
+    uint64_t numEntries;
+  };
+  static constexpr uint64_t kJournalMagic = 0x4c4e524a544f5043;  // "CPOTJRNL"
+
+  void write_journal() override {
+    std::unique_lock<std::mutex> writerLock(writerMutex_);
+    writerDone_.wait(writerLock, [this]() { return batch_ == nullptr; });
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    std::vector<MemoryBlock<Page> *> dirty = this->_dirty_blocks();
+    const std::string filename = filename_ + ".ckpt";
+    const bool existed = access(filename.c_str(), F_OK) == 0;
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open " + filename);
+    }
+    JournalWriter writer(fd, filename);
+    const JournalHeader header = {kJournalMagic, numPages_, freePages_.words().size(), dirty.size()};
+    writer.append(&header, sizeof(header));
+    writer.append(freePages_.words().data(), freePages_.words().size() * sizeof(uint64_t));
+    for (MemoryBlock<Page> *block : dirty) {
+      const uint64_t loc = block->location;
+      writer.append(&loc, sizeof(loc));
+      writer.append(&block->data, sizeof(Page));
+    }
+    writer.finish();
+    if (!existed) {
+      // Make sure the journal itself survives a crash, not just its contents.
+      _sync_directory(filename);
+    }
+  }
+
+  bool apply_journal() override {
+    const std::string filename = filename_ + ".ckpt";
+    std::vector<char> journal;
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    journal.resize(st.st_size);
+    const bool read = journal.empty() || pread(fd, journal.data(), journal.size(), 0) == ssize_t(journal.size());
+    close(fd);
+    if (!read) {
+      throw std::runtime_error("cannot read " + filename);
+    }
+
+    JournalHeader header;
+    if (journal.size() < sizeof(header) + sizeof(uint64_t)) {
+      return false;
+    }
+    std::memcpy(&header, journal.data(), sizeof(header));
+    const uint64_t entryBytes = sizeof(uint64_t) + sizeof(Page);
+    if (header.magic != kJournalMagic || header.numWords > journal.size() || header.numEntries > journal.size()) {
+      return false;
+    }
+    const uint64_t bodyBytes = sizeof(header) + header.numWords * sizeof(uint64_t) + header.numEntries * entryBytes;
+    uint64_t checksum;
+    if (journal.size() != bodyBytes + sizeof(checksum)) {
+      return false;
+    }
+    std::memcpy(&checksum, journal.data() + bodyBytes, sizeof(checksum));
+    if (checksum != JournalWriter::checksum(JournalWriter::kChecksumSeed, journal.data(), bodyBytes)) {
+      return false;
+    }
+
+    // Nothing can be cached yet, so we write straight to the file.
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    assert(chunks_.empty());
+    char *entry = journal.data() + sizeof(header) + header.numWords * sizeof(uint64_t);
+    for (uint64_t i = 0; i < header.numEntries; ++i, entry += entryBytes) {
+      uint64_t loc;
+      std::memcpy(&loc, entry, sizeof(loc));
+      struct iovec iov = {entry + sizeof(loc), sizeof(Page)};
+      this->_vector_io(pwritev, "write", &iov, 1, off_t(loc) * sizeof(Page));
+    }
+    numPages_ = header.numPages;
+    this->_grow_table(numPages_);
+    if (ftruncate(fd_, off_t(numPages_) * sizeof(Page)) != 0) {
+      throw std::runtime_error("cannot truncate " + filename_);
+    }
+    std::vector<uint64_t> words(header.numWords);
+    if (!words.empty()) {
+      std::memcpy(words.data(), journal.data() + sizeof(header), header.numWords * sizeof(uint64_t));
+    }
+    freePages_.assign(std::move(words));
+    freePages_.commit();
+    this->sync();
+    return true;
+  }
+
+  void clear_journal() override {
+    const std::string filename = filename_ + ".ckpt";
+    int fd = open(filename.c_str(), O_WRONLY);
+    if (fd < 0) {
+      return;
+    }
+    const bool ok = ftruncate(fd, 0) == 0 && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok) {
+      throw std::runtime_error("cannot truncate " + filename);
+    }
+  }
+
+  // Writes a journal through a buffer, checksumming it as it goes.
+  struct JournalWriter {
+    static constexpr uint64_t kChecksumSeed = 0xcbf29ce484222325ULL;
+    static constexpr size_t kBufferBytes = size_t(1) << 20;
+
+    JournalWriter(int fd, const std::string& filename) : fd_(fd), filename_(filename), checksum_(kChecksumSeed) {}
+    ~JournalWriter() {
+      close(fd_);
+    }
+    void append(void const *data, size_t n) {
+      checksum_ = checksum(checksum_, data, n);
+      char const *bytes = static_cast<char const *>(data);
+      buffer_.insert(buffer_.end(), bytes, bytes + n);
+      if (buffer_.size() >= kBufferBytes) {
+        this->_drain();
+      }
+    }
+    // Writes the checksum and syncs the file.
+    void finish() {
+      const uint64_t checksum = checksum_;
+      this->append(&checksum, sizeof(checksum));
+      this->_drain();
+      if (fdatasync(fd_) != 0) {
+        throw std::runtime_error("cannot sync " + filename_);
+      }
+    }
+    void _drain() {
+      char const *data = buffer_.data();
+      size_t left = buffer_.size();
+      while (left > 0) {
+        ssize_t n = write(fd_, data, left);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          throw std::runtime_error("cannot write " + filename_);
+        }
+        data += n;
+        left -= n;
+      }
+      buffer_.clear();
+    }
+    // FNV-1a
+    static uint64_t checksum(uint64_t h, void const *data, size_t n) {
+      unsigned char const *bytes = static_cast<unsigned char const *>(data);
+      for (size_t i = 0; i < n; ++i) {
+        h = (h ^ bytes[i]) * 0x100000001b3ULL;
+      }
+      return h;
+    }
+
+    int fd_;
+    std::string filename_;
+    uint64_t checksum_;
+    std::vector<char> buffer_;
+  };
+
+  static void _sync_directory(const std::string& filename) {
+    const size_t slash = filename.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      fsync(fd);
+      close(fd);
+    }
+  }
+
+  std::vector<std::pair<PageLoc, PageLoc>> plan_compaction() override {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    return freePages_.plan_compaction(numPages_);
+  }
+  void move_page(PageLoc from, PageLoc to) override {
+    MemoryBlock<Page> *source = this->_load_block(from);
+    {
+      std::lock_guard<std::mutex> lock(poolMutex_);
+      freePages_.take(to);
+      MemoryBlock<Page> *dest = this->_new_block(to);
+      std::memcpy(&dest->data, &source->data, sizeof(Page));
+      this->_slot(to).store(dest, std::memory_order_release);
+      if (dest->page_was_modified()) {
+        dirtyBlocks_.push_back(dest);
+        dirtyPages_ += 1;
+      }
+    }
+    this->delete_page(from);
+  }
+  void truncate() override {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    PageLoc numPages = numPages_;
+    while (numPages > 0 && freePages_.contains(numPages - 1)) {
+      numPages -= 1;
+    }
+    numPages_ = numPages;
+    // Free pages aren't cached, so their slots in table_ are already empty.
+    freePages_.drop_from(numPages);
+    // The pages past numPages_ are free, so nothing live is lost if we crash
+    // before the next commit; we just don't shrink the file until then.
+    truncatePending_ = true;
+  }
+  void sync() override {
+    if (fdatasync(fd_) != 0) {
+      throw std::runtime_error("cannot sync " + filename_);
+    }
+    freePages_.sync();
+  }
+  // Marks the frame's page as needing to be written by the next commit.
+  void _mark_dirty(MemoryBlock<Page> *block) {
+    if (block->page_was_modified()) {
+      bool crossed;
+      {
+        std::lock_guard<std::mutex> lock(poolMutex_);
+        dirtyBlocks_.push_back(block);
+        crossed = this->_count_dirty_page();
+      }
+      if (crossed) {
+        this->_wake_writer();
+      }
+    }
+  }
+  // Counts one more dirty page, and returns whether that took the dirty
+  // pages past the low watermark. Callers hold poolMutex_.
+  bool _count_dirty_page() {
+    const uint64_t dirtyBytes = (dirtyPages_.fetch_add(1) + 1 + inFlightPages_) * sizeof(Page);
+    return lowWatermark_ != 0 && dirtyBytes > lowWatermark_ && dirtyBytes - sizeof(Page) <= lowWatermark_;
+  }
+  // Lets the background writer take pages without waiting for a reclaim().
+  // Callers don't hold poolMutex_ (writerMutex_ comes first).
+  void _wake_writer() {
+    {
+      std::lock_guard<std::mutex> lock(writerMutex_);
+      wakeWriter_ = true;
+    }
+    writerWake_.notify_one();
+  }
+  // Rethrows what the background writer failed with, if it did. Callers
+  // hold writerMutex_.
+  void _rethrow_writer_error() {
+    if (writerError_ != nullptr) {
+      std::exception_ptr error = writerError_;
+      writerError_ = nullptr;
+      std::rethrow_exception(error);
     }
-    std::string headerFilename = this->_header_filename();
-    FILE *headerFile = fopen(headerFilename.c_str(), "wb");
-    fseek(headerFile, 0, SEEK_SET);
-    fwrite(&availablePages_[0], sizeof(PageLoc), availablePages_.size(), headerFile);
-    fclose(headerFile);
   }
   void flush() override {
+    {
+      // Pages deleted while pinned can't outlive the cache.
+      std::lock_guard<std::mutex> lock(poolMutex_);
+      for (const std::unique_ptr<MemoryBlock<Page>[]>& chunk : chunks_) {
+        for (size_t i = 0; i < kFramesPerChunk; ++i) {
+          if (chunk[i].inUse && chunk[i].isDeleted) {
+            const PageLoc loc = chunk[i].location;
+            std::lock_guard<std::mutex> shardLock(this->_shard(loc).mutex);
+            this->_free_block(&chunk[i]);
+            freePages_.push(loc);
+          }
+        }
+      }
+    }
     this->commit();
-    pages_.clear();
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    // Give the memory back, not just the frames.
+    for (const std::unique_ptr<Slot[]>& segment : segments_) {
+      for (size_t i = 0; i < kSegmentSize; ++i) {
+        segment[i].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    chunks_.clear();
+    freeBlocks_.clear();
+    clockHand_ = 0;
     _currentMemoryUsed = 0;
   }
+  // Pins are taken under the page's shard latch, which eviction holds while
+  // it checks them, so a page can't be evicted out from under a pin.
+  void pin(PageLoc loc) override {
+    while (true) {
+      MemoryBlock<Page> *block = this->_load_block(loc);
+      std::lock_guard<std::mutex> lock(this->_shard(loc).mutex);
+      if (this->_slot(loc).load() == block) {
+        block->pinCount += 1;
+        return;
+      }
+    }
+  }
+  void unpin(PageLoc loc) override {
+    // The page may be gone if someone called flush() or delete_page().
+    if (loc >= numPages_) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(this->_shard(loc).mutex);
+    MemoryBlock<Page> *block = this->_slot(loc).load();
+    if (block != nullptr && block->pinCount > 0) {
+      block->pinCount -= 1;
+      if (block->pinCount == 0 && block->isDeleted) {
+        lock.unlock();
+        this->_free_deleted(loc, block);
+      }
+    }
+  }
+  // Frees a page that was deleted while it was pinned, unless it's been
+  // pinned again since.
+  void _free_deleted(PageLoc loc, MemoryBlock<Page> *block) {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    std::lock_guard<std::mutex> shardLock(this->_shard(loc).mutex);
+    if (this->_slot(loc).load() != block || !block->isDeleted || block->pinCount > 0) {
+      return;
+    }
+    this->_free_block(block);
+    freePages_.push(loc);
+  }
+  void set_hold_dirty_pages(bool hold) override {
+    holdDirtyPages_ = hold;
+  }
+  void set_dirty_watermarks(uint64_t lowWatermark, uint64_t highWatermark) override {
+    this->_stop_writer();
+    lowWatermark_ = lowWatermark;
+    highWatermark_ = std::max(lowWatermark, highWatermark);
+    if (lowWatermark_ != 0) {
+      stopWriter_ = false;
+      writer_ = std::thread([this]() { this->_run_writer(); });
+    }
+  }
+  // The background writer: writes each batch reclaim() hands it, and takes
+  // batches of its own when _wake_writer() says the dirty pages crossed the
+  // low watermark.
+  void _run_writer() {
+    std::unique_lock<std::mutex> lock(writerMutex_);
+    // Whether we just wrote a batch, and should see if there's more to take.
+    bool wroteBatch = false;
+    while (true) {
+      writerWake_.wait(lock, [&]() { return stopWriter_ || batch_ != nullptr || wakeWriter_ || wroteBatch; });
+      if (batch_ == nullptr && !stopWriter_) {
+        wakeWriter_ = false;
+        this->_take_batch(reclaimEpoch_.load());
+      }
+      wroteBatch = false;
+      if (batch_ == nullptr) {
+        if (stopWriter_) {
+          return;
+        }
+        continue;
+      }
+      // Nobody touches the batch until we hand it back.
+      lock.unlock();
+      std::exception_ptr error;
+      try {
+        IOStats stats = this->_write_pages(&batch_->pages);
+        std::lock_guard<std::mutex> poolLock(poolMutex_);
+        totalWriteStats_.pages += stats.pages;
+        totalWriteStats_.bytes += stats.bytes;
+        totalWriteStats_.syscalls += stats.syscalls;
+        backgroundWriteStats_.pages += stats.pages;
+        backgroundWriteStats_.bytes += stats.bytes;
+        backgroundWriteStats_.syscalls += stats.syscalls;
+      } catch (...) {
+        // The pages have to be written some other way, so make them dirty
+        // again, and let the next commit() or reclaim() throw.
+        error = std::current_exception();
+        std::lock_guard<std::mutex> poolLock(poolMutex_);
+        for (MemoryBlock<Page> *block : batch_->blocks) {
+          if (block->page_was_modified()) {
+            dirtyBlocks_.push_back(block);
+            dirtyPages_ += 1;
+          }
+        }
+      }
+      for (MemoryBlock<Page> *block : batch_->blocks) {
+        std::lock_guard<std::mutex> shardLock(this->_shard(block->location).mutex);
+        block->pinCount -= 1;
+      }
+      lock.lock();
+      inFlightPages_ -= batch_->blocks.size();
+      batch_.reset();
+      if (error != nullptr) {
+        writerError_ = error;
+      } else {
+        wroteBatch = true;
+      }
+      writerDone_.notify_all();
+    }
+  }
+  // Waits for the writer to finish what it has and stops it.
+  void _stop_writer() {
+    if (!writer_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(writerMutex_);
+      stopWriter_ = true;
+    }
+    writerWake_.notify_all();
+    writer_.join();
+  }
+  // Called from reclaim(), when nobody is changing a page: hands dirty pages
+  // to the background writer if there are more than lowWatermark_ bytes of
+  // them, and waits for it if there are more than highWatermark_.
+  void _write_behind() {
+    if (lowWatermark_ == 0 || holdDirtyPages_) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(writerMutex_);
+    this->_rethrow_writer_error();
+    while (true) {
+      const uint64_t dirtyBytes = (dirtyPages_ + inFlightPages_) * sizeof(Page);
+      if (dirtyBytes <= lowWatermark_) {
+        return;
+      }
+      if (batch_ != nullptr) {
+        if (dirtyBytes <= highWatermark_) {
+          return;
+        }
+        writerDone_.wait(lock);
+        continue;
+      }
+      if (!this->_take_batch(reclaimEpoch_.load())) {
+        // Everything dirty is pinned.
+        return;
+      }
+      writerWake_.notify_one();
+    }
+  }
+  // Makes a batch of enough dirty pages to get back down to the low
+  // watermark, if there are any we can take, and puts it in batch_. Callers
+  // hold writerMutex_, and there's no batch_ yet.
+  bool _take_batch(uint64_t epoch) {
+    if (lowWatermark_ == 0 || holdDirtyPages_) {
+      return false;
+    }
+    const uint64_t dirtyBytes = (dirtyPages_ + inFlightPages_) * sizeof(Page);
+    if (dirtyBytes <= lowWatermark_) {
+      return false;
+    }
+    const size_t n = std::min<uint64_t>(kWriteBatchPages, (dirtyBytes - lowWatermark_ + sizeof(Page) - 1) / sizeof(Page));
+    std::unique_ptr<WriteBatch> batch = this->_take_dirty_pages(n, epoch);
+    if (batch == nullptr) {
+      return false;
+    }
+    inFlightPages_ += batch->blocks.size();
+    batch_ = std::move(batch);
+    return true;
+  }
+  // Copies up to n of the pages that have been dirty longest into a batch,
+  // marking them clean and pinning their frames. Callers hold writerMutex_.
+  //
+  // Only pages last handed out by load_and_modify_page() or new_page()
+  // before `epoch` are taken: everything handed out before a reclaim() is
+  // done with, since pointers to unpinned pages don't survive it. A page
+  // can still be handed out again while we copy it, so (like a reader of an
+  // OptimisticLatch) we mark it clean, copy it and then check its epoch
+  // again. If it moved, the copy may be torn and the new change may not have
+  // seen the page clean, so the page stays dirty and out of the batch.
+  std::unique_ptr<WriteBatch> _take_dirty_pages(size_t n, uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    auto batch = std::make_unique<WriteBatch>();
+    batch->copies = std::make_unique<Page[]>(n);
+    // Pinned pages might be changing, so leave them for later, along with
+    // pages that are still being changed.
+    std::vector<MemoryBlock<Page> *> skipped;
+    size_t i = 0;
+    for (; i < dirtyBlocks_.size() && batch->blocks.size() < n; ++i) {
+      MemoryBlock<Page> *block = dirtyBlocks_[i];
+      if (!block->inUse || !block->isModified) {
+        continue;
+      }
+      std::lock_guard<std::mutex> shardLock(this->_shard(block->location).mutex);
+      if (block->pinCount > 0 || block->modifiedEpoch >= epoch) {
+        skipped.push_back(block);
+        continue;
+      }
+      block->isModified = false;
+      Page *copy = &batch->copies[batch->blocks.size()];
+      std::memcpy(static_cast<void *>(copy), &block->data, sizeof(Page));
+      if (block->modifiedEpoch >= epoch) {
+        if (!block->page_was_modified()) {
+          // Whoever changed it saw it clean and is waiting to add it back
+          // (and count it again).
+          dirtyPages_ -= 1;
+          continue;
+        }
+        skipped.push_back(block);
+        continue;
+      }
+      block->pinCount += 1;
+      dirtyPages_ -= 1;
+      batch->blocks.push_back(block);
+      batch->pages.push_back(std::make_pair(PageLoc(block->location), copy));
+    }
+    dirtyBlocks_.erase(dirtyBlocks_.begin(), dirtyBlocks_.begin() + i);
+    dirtyBlocks_.insert(dirtyBlocks_.begin(), skipped.begin(), skipped.end());
+    if (batch->blocks.empty()) {
+      return nullptr;
+    }
+    return batch;
+  }
+  void prefetch(PageLoc loc) override {
+    if (loc >= numPages_ || this->_slot(loc).load(std::memory_order_relaxed) != nullptr) {
+      return;
+    }
+    // Ask the kernel to pull the page into its cache asynchronously; the
+    // pread in _load_block then doesn't have to wait on the disk.
+    const off_t offset = off_t(loc) * sizeof(Page);
+    #if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fd_, offset, sizeof(Page), POSIX_FADV_WILLNEED);
+    #elif defined(F_RDADVISE)
+    struct radvisory advice = {offset, int(sizeof(Page))};
+    fcntl(fd_, F_RDADVISE, &advice);
+    #endif
+  }
+  void load_pages(PageLoc const *locs, size_t n) override {
+    // Without a way to issue the reads together, tell the kernel about all
+    // of them first so it can work on them while we wait for the first.
+    for (size_t i = 0; i < n; ++i) {
+      this->prefetch(locs[i]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      this->_load_block(locs[i]);
+    }
+  }
+  void reclaim() override {
+    // Nobody is changing a page now, so everything handed out so far is
+    // done with.
+    reclaimEpoch_ += 1;
+    this->_write_behind();
+    if (maxMemory_ == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    // CLOCK: sweep over the frames, giving referenced pages a second chance
+    // and evicting the first unpinned, unreferenced page we find. Two full
+    // sweeps without getting under budget means everything left is pinned (or
+    // dirty while holdDirtyPages_ is set).
+    const size_t numFrames = chunks_.size() * kFramesPerChunk;
+    size_t steps = 0;
+    while (_currentMemoryUsed > maxMemory_ && steps < 2 * numFrames) {
+      if (clockHand_ >= numFrames) {
+        clockHand_ = 0;
+      }
+      MemoryBlock<Page> *block = &chunks_[clockHand_ / kFramesPerChunk][clockHand_ % kFramesPerChunk];
+      ++clockHand_;
+      ++steps;
+      if (!block->inUse || block->pinCount > 0) {
+        continue;
+      }
+      if (block->isReferenced) {
+        block->isReferenced = false;
+        continue;
+      }
+      if (block->isModified && holdDirtyPages_) {
+        continue;
+      }
+      this->_evict(block);
+    }
+  }
+  // Writes back (if it's dirty) and frees an unpinned frame, under its
+  // page's shard latch so that nobody pins it or reads the page back in from
+  // disk halfway through. Callers hold poolMutex_.
+  void _evict(MemoryBlock<Page> *block) {
+    const PageLoc loc = block->location;
+    std::lock_guard<std::mutex> lock(this->_shard(loc).mutex);
+    if (block->pinCount > 0 || this->_slot(loc).load() != block) {
+      // Pinned since we looked, or still being read in.
+      return;
+    }
+    if (block->isModified) {
+      std::vector<MemoryBlock<Page> *> dirty = {block};
+      this->_write_blocks(&dirty);
+    }
+    this->_free_block(block);
+  }
+  // Writes the (dirty) blocks and marks them clean. If the write fails they
+  // stay dirty. Callers hold poolMutex_.
+  IOStats _write_blocks(std::vector<MemoryBlock<Page> *> *blocks) {
+    std::vector<std::pair<PageLoc, Page const *>> pages;
+    pages.reserve(blocks->size());
+    for (MemoryBlock<Page> *block : *blocks) {
+      pages.push_back(std::make_pair(PageLoc(block->location), &block->data));
+    }
+    IOStats stats = this->_write_pages(&pages);
+    for (MemoryBlock<Page> *block : *blocks) {
+      block->isModified = false;
+    }
+    dirtyPages_ -= blocks->size();
+    totalWriteStats_.pages += stats.pages;
+    totalWriteStats_.bytes += stats.bytes;
+    totalWriteStats_.syscalls += stats.syscalls;
+    return stats;
+  }
+  // Writes the pages in file order, one pwritev per run of adjacent pages,
+  // so a commit is a handful of sequential writes rather than one seek+write
+  // per page.
+  IOStats _write_pages(std::vector<std::pair<PageLoc, Page const *>> *pages) {
+    std::sort(pages->begin(), pages->end());
+    IOStats stats;
+    std::vector<struct iovec> iov;
+    size_t i = 0;
+    while (i < pages->size()) {
+      const uint64_t start = (*pages)[i].first;
+      iov.clear();
+      while (i < pages->size() && (*pages)[i].first == start + iov.size() && iov.size() < IOV_MAX) {
+        iov.push_back({const_cast<Page *>((*pages)[i].second), sizeof(Page)});
+        ++i;
+      }
+      stats.pages += iov.size();
+      stats.bytes += iov.size() * sizeof(Page);
+      stats.syscalls += this->_vector_io(pwritev, "write", iov.data(), iov.size(), off_t(start) * sizeof(Page));
+    }
+    return stats;
+  }
+  // Calls preadv or pwritev until all of iov has been read or written, and
+  // returns how many calls that took. Throws (like FreePageList and
+  // WriteAheadLog do) if the file can't be read or written, including if a
+  // read runs into the end of the file. iov is used up in the process.
+  template<class F>
+  uint64_t _vector_io(F io, char const *verb, struct iovec *iov, int n, off_t offset) {
+    uint64_t calls = 0;
+    while (n > 0) {
+      ssize_t done = io(fd_, iov, n, offset);
+      calls += 1;
+      if (done < 0 && errno == EINTR) {
+        continue;
+      }
+      if (done <= 0) {
+        throw std::runtime_error(std::string("cannot ") + verb + " " + filename_ + (done < 0 ? "" : ": unexpected end of file"));
+      }
+      offset += done;
+      while (n > 0 && size_t(done) >= iov->iov_len) {
+        done -= iov->iov_len;
+        ++iov;
+        --n;
+      }
+      if (n > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+        iov->iov_len -= done;
+      }
+    }
+    return calls;
+  }
+  // What the last commit() wrote.
+  IOStats last_commit_stats() const {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    return lastCommitStats_;
+  }
+  // How many bytes of the free list the last commit() wrote.
+  uint64_t last_free_list_bytes() const {
+    return lastFreeListBytes_;
+  }
+  // Everything written since we opened the file, including evictions.
+  IOStats total_write_stats() const {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    return totalWriteStats_;
+  }
+  // What the background writer has written (also counted in
+  // total_write_stats()).
+  IOStats background_write_stats() const {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    return backgroundWriteStats_;
+  }
+  // How many bytes of pages are dirty (not counting any the background
+  // writer is writing).
+  uint64_t dirty_bytes() const {
+    return dirtyPages_ * sizeof(Page);
+  }
+  // Everything read since we opened the file.
+  IOStats total_read_stats() const {
+    std::lock_guard<std::mutex> lock(poolMutex_);
+    return totalReadStats_;
+  }
+  // Returns a frame for `loc`. The caller fills in the page and then puts the
+  // frame in table_. Callers hold poolMutex_.
+  MemoryBlock<Page> *_new_block(PageLoc loc) {
+    if (freeBlocks_.empty()) {
+      chunks_.push_back(std::make_unique<MemoryBlock<Page>[]>(kFramesPerChunk));
+      MemoryBlock<Page> *chunk = chunks_.back().get();
+      for (size_t i = kFramesPerChunk - 1; i < kFramesPerChunk; --i) {
+        freeBlocks_.push_back(&chunk[i]);
+      }
+    }
+    MemoryBlock<Page> *block = freeBlocks_.back();
+    freeBlocks_.pop_back();
+    block->inUse = true;
+    block->isDeleted = false;
+    block->isModified = false;
+    block->isReferenced = true;
+    block->pinCount = 0;
+    block->location = loc;
+    _currentMemoryUsed += sizeof(Page);
+    return block;
+  }
+  // Callers hold poolMutex_ and the page's shard latch.
+  void _free_block(MemoryBlock<Page> *block) {
+    this->_slot(block->location).store(nullptr);
+    if (block->isModified) {
+      block->isModified = false;
+      dirtyPages_ -= 1;
+    }
+    block->inUse = false;
+    block->isDeleted = false;
+    freeBlocks_.push_back(block);
+    _currentMemoryUsed -= sizeof(Page);
+  }
   uint64_t currentMemoryUsed() const override {
     return _currentMemoryUsed;
   }
   bool empty() const override {
     return this->numPages_ == 0;
   }
+  // Writes whatever is still dirty, but a destructor can't report a failed
+  // write: callers who need to know their pages reached the disk must
+  // commit() or flush() first.
   ~DiskPageManager() override {
-    this->flush();
-    fclose(file_);
+    try {
+      this->_stop_writer();
+      this->flush();
+    } catch (...) {
+    }
+    close(fd_);
   }
-  std::vector<PageLoc> availablePages_;
   std::string filename_;
-  FILE *file_;
-  PageLoc numPages_;
-  uint64_t _currentMemoryUsed;  // in bytes
-  std::unordered_map<PageLoc, std::shared_ptr<MemoryBlock<Page>>> pages_;
+  FreePageList freePages_;
+  int fd_;
+  std::atomic<PageLoc> numPages_;
+  std::atomic<uint64_t> _currentMemoryUsed;  // in bytes
+  uint64_t maxMemory_;  // in bytes; 0 means unbounded
+  // The frame of each page (nullptr if it isn't cached), as
+  // table_[loc >> kSegmentBits][loc % kSegmentSize]. The top level is big
+  // enough for every PageLoc, so the segments never move.
+  std::unique_ptr<std::atomic<Slot *>[]> table_;
+  std::vector<std::unique_ptr<Slot[]>> segments_;  // owns table_'s segments
+  Shard shards_[kShards];
+  // Guards the frames (chunks_, freeBlocks_), the free page list, the dirty
+  // list and the stats.
+  mutable std::mutex poolMutex_;
+  std::vector<std::unique_ptr<MemoryBlock<Page>[]>> chunks_;
+  std::vector<MemoryBlock<Page> *> freeBlocks_;
+  std::vector<MemoryBlock<Page> *> dirtyBlocks_;  // frames modified since the last commit (see commit)
+  size_t clockHand_;  // index into the frames of chunks_
+  std::atomic<bool> holdDirtyPages_;  // if true, reclaim() only evicts clean pages
+  bool truncatePending_ = false;  // set by truncate(); the next commit shrinks the file
+  IOStats lastCommitStats_;
+  uint64_t lastFreeListBytes_ = 0;  // what the last commit wrote to ".dpm_header"
+  IOStats totalWriteStats_;
+  IOStats totalReadStats_;
+  IOStats backgroundWriteStats_;
+
+  // The background writer (see set_dirty_watermarks). writerMutex_ comes
+  // before poolMutex_.
+  std::atomic<uint64_t> dirtyPages_;  // frames with isModified set
+  uint64_t lowWatermark_ = 0;  // in bytes; 0 means there's no writer
+  uint64_t highWatermark_ = 0;
+  std::thread writer_;
+  std::mutex writerMutex_;
+  std::condition_variable writerWake_;  // there's a batch, wakeWriter_, or we're stopping
+  std::condition_variable writerDone_;  // a batch was written
+  std::unique_ptr<WriteBatch> batch_;  // being written; null if there isn't one
+  std::atomic<uint64_t> inFlightPages_ = 0;  // pages in batch_
+  bool stopWriter_ = false;
+  bool wakeWriter_ = false;  // the dirty pages crossed lowWatermark_
+  std::exception_ptr writerError_;  // what the last failed batch threw
+  std::atomic<uint64_t> reclaimEpoch_ = 1;  // how many times reclaim() has run, plus 1
+
+  // For spotting sequential scans.
+  static constexpr PageLoc kNoPage = PageLoc(-1);
+  std::atomic<PageLoc> lastReadLoc_;  // last page of the most recent read
+  std::atomic<PageLoc> extentPages_;  // how many pages the next sequential miss reads
 };
 
 }  // namespace cpot
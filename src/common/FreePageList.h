@@ -0,0 +1,288 @@
+#ifndef FREE_PAGE_LIST_H
+#define FREE_PAGE_LIST_H
+
+#include "PageManager.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cpot {
+
+/**
+ * The pages a PageManager has freed and can hand out again, persisted in the
+ * ".dpm_header" file as a bitmap (bit i set means page i is free) after an
+ * 8-byte magic number and the 8-byte format of the pages (see check_format).
+ *
+ * commit() only rewrites the kBlockBytes-sized pieces of the bitmap that
+ * changed, so freeing a page costs a few KB at the next commit no matter how
+ * many pages are free.
+ *
+ * Older indexes stored the free list as a raw array of PageLocs, or as a
+ * bitmap after kOldMagic with no format; we read both as format 0, and
+ * rewrite them on the first commit.
+ */
+struct FreePageList {
+  static constexpr uint64_t kMagic = 0x45474150544f5043;  // "CPOTPAGE"
+  static constexpr uint64_t kOldMagic = 0x45455246544f5043;  // "CPOTFREE"
+  static constexpr size_t kHeaderBytes = 2 * sizeof(uint64_t);
+  static constexpr size_t kBlockBytes = 4096;
+  static constexpr size_t kWordsPerBlock = kBlockBytes / sizeof(uint64_t);
+
+  FreePageList(const std::string& filename) : filename_(filename), isNew_(false), rewriteAll_(false), format_(0), numFree_(0) {
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("cannot open " + filename);
+    }
+    struct stat st;
+    fstat(fd_, &st);
+    if (st.st_size == 0) {
+      isNew_ = true;
+      rewriteAll_ = true;
+      return;
+    }
+
+    uint64_t magic = 0;
+    if (st.st_size >= off_t(sizeof(magic))) {
+      pread(fd_, &magic, sizeof(magic), 0);
+    }
+    if (magic == kMagic && st.st_size >= off_t(kHeaderBytes)) {
+      pread(fd_, &format_, sizeof(format_), sizeof(magic));
+      words_.resize((st.st_size - kHeaderBytes) / sizeof(uint64_t));
+      pread(fd_, words_.data(), words_.size() * sizeof(uint64_t), kHeaderBytes);
+    } else if (magic == kOldMagic) {
+      words_.resize((st.st_size - sizeof(magic)) / sizeof(uint64_t));
+      pread(fd_, words_.data(), words_.size() * sizeof(uint64_t), sizeof(magic));
+      rewriteAll_ = true;
+    } else {
+      std::vector<PageLoc> locs(st.st_size / sizeof(PageLoc));
+      pread(fd_, locs.data(), locs.size() * sizeof(PageLoc), 0);
+      for (PageLoc loc : locs) {
+        this->_set(loc, true);
+      }
+      rewriteAll_ = true;
+    }
+    this->_clear_dirty_blocks();
+    this->_fill_stack();
+  }
+  FreePageList(const FreePageList&) = delete;
+  FreePageList& operator=(const FreePageList&) = delete;
+  ~FreePageList() {
+    close(fd_);
+  }
+
+  // Checks that the `numPages` pages the header belongs to are in `format`,
+  // which the caller bumps whenever the layout of its pages changes. A new
+  // file with no pages yet takes on `format`; pages with no header predate
+  // formats, and are format 0.
+  void check_format(uint64_t format, PageLoc numPages) {
+    if (isNew_ && numPages == 0) {
+      format_ = format;
+      this->commit();
+    }
+    isNew_ = false;
+    if (format_ != format) {
+      throw std::runtime_error(
+        filename_ + " says its pages are in format " + std::to_string(format_) + ", not "
+        + std::to_string(format) + " (was the index written by another version?)"
+      );
+    }
+  }
+
+  uint64_t format() const {
+    return format_;
+  }
+
+  void push(PageLoc loc) {
+    if (this->contains(loc)) {
+      return;
+    }
+    this->_set(loc, true);
+    stack_.push_back(loc);
+    numFree_ += 1;
+  }
+
+  // Takes a free page, if there is one.
+  bool pop(PageLoc *loc) {
+    // take() and drop_from() leave stale entries behind; skip them.
+    while (!stack_.empty() && !this->contains(stack_.back())) {
+      stack_.pop_back();
+    }
+    if (stack_.empty()) {
+      return false;
+    }
+    *loc = stack_.back();
+    stack_.pop_back();
+    this->_set(*loc, false);
+    numFree_ -= 1;
+    return true;
+  }
+
+  // Takes a particular free page.
+  void take(PageLoc loc) {
+    assert(this->contains(loc));
+    this->_set(loc, false);
+    numFree_ -= 1;
+  }
+
+  // Forgets about free pages at or past `numPages` (the file is being cut
+  // short there).
+  void drop_from(PageLoc numPages) {
+    for (PageLoc loc = numPages; loc < words_.size() * 64; ++loc) {
+      if (this->contains(loc)) {
+        this->_set(loc, false);
+        numFree_ -= 1;
+      }
+    }
+    words_.resize((numPages + 63) / 64);
+    // Easier than working out which blocks to cut off the file.
+    rewriteAll_ = true;
+  }
+
+  // Pairs each live page at or past the point where the first `numPages`
+  // pages would end if they were packed (i.e. numPages minus the number of
+  // free pages) with a free page before that point. Moving every pair leaves
+  // all the free pages at the end of the file.
+  std::vector<std::pair<PageLoc, PageLoc>> plan_compaction(PageLoc numPages) const {
+    const PageLoc cutoff = numPages - numFree_;
+    std::vector<std::pair<PageLoc, PageLoc>> moves;
+    PageLoc hole = 0;
+    for (PageLoc loc = cutoff; loc < numPages; ++loc) {
+      if (this->contains(loc)) {
+        continue;
+      }
+      while (!this->contains(hole)) {
+        ++hole;
+      }
+      assert(hole < cutoff);
+      moves.push_back(std::make_pair(loc, hole++));
+    }
+    return moves;
+  }
+
+  bool contains(PageLoc loc) const {
+    return loc / 64 < words_.size() && ((words_[loc / 64] >> (loc % 64)) & 1);
+  }
+
+  size_t size() const {
+    return numFree_;
+  }
+
+  // Writes the parts of the bitmap that changed since the last commit.
+  // Returns how many bytes were written.
+  uint64_t commit() {
+    uint64_t bytes = 0;
+    if (rewriteAll_) {
+      ftruncate(fd_, 0);
+      const uint64_t header[2] = {kMagic, format_};
+      bytes += this->_pwrite(header, kHeaderBytes, 0);
+      bytes += this->_pwrite(words_.data(), words_.size() * sizeof(uint64_t), kHeaderBytes);
+      rewriteAll_ = false;
+      this->_clear_dirty_blocks();
+      return bytes;
+    }
+    std::sort(dirtyBlocks_.begin(), dirtyBlocks_.end());
+    size_t i = 0;
+    while (i < dirtyBlocks_.size()) {
+      // Coalesce adjacent blocks into one write.
+      size_t j = i + 1;
+      while (j < dirtyBlocks_.size() && dirtyBlocks_[j] == dirtyBlocks_[j - 1] + 1) {
+        ++j;
+      }
+      const size_t firstWord = dirtyBlocks_[i] * kWordsPerBlock;
+      const size_t endWord = std::min(words_.size(), (dirtyBlocks_[j - 1] + 1) * kWordsPerBlock);
+      bytes += this->_pwrite(words_.data() + firstWord, (endWord - firstWord) * sizeof(uint64_t), kHeaderBytes + firstWord * sizeof(uint64_t));
+      i = j;
+    }
+    this->_clear_dirty_blocks();
+    return bytes;
+  }
+
+  void sync() {
+    if (fdatasync(fd_) != 0) {
+      throw std::runtime_error("cannot sync " + filename_);
+    }
+  }
+
+  // The bitmap, for saving in a checkpoint journal.
+  const std::vector<uint64_t>& words() const {
+    return words_;
+  }
+
+  // Replaces the free list with a bitmap from words(). The next commit
+  // rewrites the file.
+  void assign(std::vector<uint64_t> words) {
+    words_ = std::move(words);
+    rewriteAll_ = true;
+    this->_clear_dirty_blocks();
+    this->_fill_stack();
+  }
+
+  // Hand out low pages first.
+  void _fill_stack() {
+    stack_.clear();
+    numFree_ = 0;
+    for (size_t i = words_.size(); i-- > 0;) {
+      for (int bit = 63; bit >= 0; --bit) {
+        if ((words_[i] >> bit) & 1) {
+          stack_.push_back(PageLoc(i * 64 + bit));
+          numFree_ += 1;
+        }
+      }
+    }
+  }
+
+  void _set(PageLoc loc, bool isFree) {
+    const size_t word = loc / 64;
+    if (word >= words_.size()) {
+      // Words past the end of the file read as zero, so these only need to
+      // be written once they have a bit set.
+      words_.resize(std::max(word + 1, words_.size() * 2), 0);
+    }
+    const uint64_t mask = uint64_t(1) << (loc % 64);
+    words_[word] = isFree ? (words_[word] | mask) : (words_[word] & ~mask);
+    const size_t block = word / kWordsPerBlock;
+    if (isBlockDirty_.size() <= block) {
+      isBlockDirty_.resize(words_.size() / kWordsPerBlock + 1, false);
+    }
+    if (!isBlockDirty_[block]) {
+      isBlockDirty_[block] = true;
+      dirtyBlocks_.push_back(block);
+    }
+  }
+
+  void _clear_dirty_blocks() {
+    for (size_t block : dirtyBlocks_) {
+      isBlockDirty_[block] = false;
+    }
+    dirtyBlocks_.clear();
+  }
+
+  uint64_t _pwrite(void const *data, size_t n, off_t offset) {
+    if (pwrite(fd_, data, n, offset) != ssize_t(n)) {
+      throw std::runtime_error("cannot write " + filename_);
+    }
+    return n;
+  }
+
+  std::string filename_;
+  int fd_;
+  bool isNew_;  // the file was empty when we opened it
+  bool rewriteAll_;  // the file is empty or in an old format
+  uint64_t format_;
+  std::vector<uint64_t> words_;  // the bitmap
+  std::vector<PageLoc> stack_;  // the free pages, in the order we'll reuse them
+  size_t numFree_;
+  std::vector<size_t> dirtyBlocks_;  // indices of kBlockBytes blocks of words_
+  std::vector<bool> isBlockDirty_;
+};
+
+}  // namespace cpot
+
+#endif  // FREE_PAGE_LIST_H
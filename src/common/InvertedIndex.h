@@ -3,34 +3,98 @@
 
 #include "SkipTree.h"
 #include "DiskPageManager.h"
+#include "MmapPageManager.h"
+#include "PageManagerView.h"
+#include "SnapshotPageManager.h"
+#include "UringPageManager.h"
+#include "WriteAheadLog.h"
+
+#include <array>
+#include <iterator>
 
 namespace cpot {
 
 // typedef uint32_t RowLoc;
 typedef uint64_t Token;
 
+// Which PageManager an InvertedIndex uses for its files.
+enum class Storage {
+  kDisk,  // DiskPageManager: pages are read into a cache as they're needed.
+  kMmap,  // MmapPageManager: files are mapped; good for read-heavy servers.
+  kUring,  // UringPageManager: like kDisk, but batched reads use io_uring.
+};
+
+// How an InvertedIndex makes changes durable.
+enum class Durability {
+  // commit() writes every modified page back to its file.
+  kCommit,
+  // insert() and remove() are appended to a log (filename + ".wal"), and
+  // commit() only has to write and sync the log. Pages are written at
+  // checkpoints, and the log is replayed when the index is opened.
+  kWal,
+};
+
+// maxMemory is DiskPageManager's cache budget (0 means unbounded). Mapped
+// files are cached by the kernel, so MmapPageManager ignores it. `format` is
+// the layout the file's pages must be in (see FreePageList::check_format).
+template<class Page>
+std::shared_ptr<PageManager<Page>> make_page_manager(const std::string& filename, Storage storage, uint64_t maxMemory = 0, uint64_t format = 0) {
+  if (storage == Storage::kMmap) {
+    return std::make_shared<MmapPageManager<Page>>(filename, format);
+  }
+  if (storage == Storage::kUring) {
+    return std::make_shared<UringPageManager<Page>>(filename, maxMemory, format);
+  }
+  return std::make_shared<DiskPageManager<Page>>(filename, maxMemory, format);
+}
+
 template<class Row>
 struct ConstIterator : public IteratorInterface<Row> {
   ConstIterator(Row value) {
     this->currentValue = value;
   }
-  Row skip_to(Row row) override {
+  Row skip_to(Row) override {
     return this->currentValue;
   }
   Row next() override {
     return this->currentValue;
   }
+  // We only use these for tokens with no rows, so there's nothing behind us
+  // either.
+  Row skip_to_at_most(Row) override {
+    return this->currentValue = Row::smallest();
+  }
+  Row prev() override {
+    return this->currentValue = Row::smallest();
+  }
 };
 
-template<class Row>
+// A token's rows live in one of three places, depending on how many times
+// it has been inserted (its count):
+//
+//   - up to kInlineRows: in its row of the header tree (TokenRow::rows), so
+//     reading or writing them is one walk down the header;
+//   - up to kRareThreshold: in the rare tree, shared by all such tokens;
+//   - more: in a tree of its own.
+//
+// kInlineRows changes the layout of the header, so it's part of the index's
+// format (see kFormat): an index has to be opened with the kInlineRows it was
+// written with, and opening it with any other throws.
+template<class Row, size_t kInlineRows = std::max<size_t>(1, 24 / sizeof(Row))>
 struct InvertedIndex {
   // Tokens that are more common than this are stored in their own tree.
   static constexpr uint64_t kRareThreshold = 50;
+  static_assert(kInlineRows < kRareThreshold);
 
   struct TokenRow {
     Token token;
     uint64_t count;
     PageLoc root;
+    // The token's rows, in order, while it's inline (see _is_inline). The
+    // slots after the last one hold Row::largest().
+    [[no_unique_address]] std::array<Row, kInlineRows> rows;
+    typedef Token SearchKey;
+    static constexpr bool kSearchKeyIsUnique = true;
     bool operator<(const TokenRow& that) const {
       return this->token < that.token;
     }
@@ -41,10 +105,39 @@ struct InvertedIndex {
       return this->token == that.token;
     }
     static TokenRow smallest() {
-      return TokenRow{0, 0, 0};
+      return TokenRow{0, 0, 0, {}};
     }
     static TokenRow largest() {
-      return TokenRow{uint64_t(-1), 0, 0};
+      return TokenRow{uint64_t(-1), 0, 0, {}};
+    }
+    // The row of a token that has none yet.
+    static TokenRow make(Token token) {
+      TokenRow r{token, 0, kNullPage, {}};
+      r.rows.fill(Row::largest());
+      return r;
+    }
+    // How many of the slots in `rows` are used.
+    size_t num_inline() const {
+      return std::find(rows.begin(), rows.end(), Row::largest()) - rows.begin();
+    }
+    // Merges sorted rows into `rows`, which must have room for them. With
+    // kInlineRows == 0 no token is ever inline, and `merged` would have no
+    // storage to write through.
+    void insert_inline(Row const *newRows, size_t n) {
+      if constexpr (kInlineRows > 0) {
+        std::array<Row, 2 * kInlineRows> merged;
+        Row *end = std::set_union(rows.begin(), rows.begin() + this->num_inline(), newRows, newRows + n, merged.begin());
+        assert(size_t(end - merged.begin()) <= kInlineRows);
+        std::fill(std::copy(merged.begin(), end, rows.begin()), rows.end(), Row::largest());
+      }
+    }
+    bool remove_inline(const Row& row) {
+      auto it = std::find(rows.begin(), rows.end(), row);
+      if (it == rows.end() || row == Row::largest()) {
+        return false;
+      }
+      *std::copy(it + 1, rows.end(), it) = Row::largest();
+      return true;
     }
     friend std::ostream& operator<<(std::ostream& s, TokenRow row) {
       return s << "[TokenRow token:" << row.token << " root:" << row.root << " count:" << row.count << "]";
@@ -53,6 +146,8 @@ struct InvertedIndex {
   struct RareRow {
     Token token;
     Row row;
+    typedef Token SearchKey;
+    static constexpr bool kSearchKeyIsUnique = false;
     bool operator<(const RareRow& that) const {
       if (this->token == that.token) {
         return this->row < that.row;
@@ -93,31 +188,130 @@ struct InvertedIndex {
       this->currentValue = it_->currentValue.row;
       return this->currentValue;
     }
+    Row skip_n(uint64_t n) override {
+      it_->skip_n(n);
+      this->currentValue = it_->currentValue.row;
+      return this->currentValue;
+    }
+    Row skip_to_at_most(Row row) override {
+      it_->skip_to_at_most(RareRow{token_, row});
+      this->currentValue = it_->currentValue.row;
+      return this->currentValue;
+    }
+    Row prev() override {
+      it_->prev();
+      this->currentValue = it_->currentValue.row;
+      return this->currentValue;
+    }
     uint64_t token_;
     std::shared_ptr<IteratorInterface<RareRow>> it_;
   };
-  InvertedIndex(std::string filename)
-  : headerPageManager(std::make_shared<DiskPageManager<typename SkipTree<TokenRow>::Node>>(filename + ".header")),
-    pageManager(std::make_shared<DiskPageManager<typename SkipTree<Row>::Node>>(filename)),
-    rarePageManager(std::make_shared<DiskPageManager<typename SkipTree<RareRow>::Node>>(filename + ".rare")) {
-    if (headerPageManager->empty()) {
+  // A logged insert() or remove(). The log checksums records byte by byte,
+  // so the padding is spelled out and records are value-initialized.
+  struct LogRecord {
+    uint8_t isRemove;
+    uint8_t padding[7];
+    Token token;
+    Row row;
+  };
+
+  // With Durability::kWal, commit() checkpoints once the log is this big.
+  static constexpr uint64_t kCheckpointBytes = uint64_t(64) << 20;
+  // ... and the memory budget is checked each time the log grows by this
+  // much (see _log).
+  static constexpr uint64_t kBudgetCheckBytes = 4096;
+
+  typedef typename SkipTree<TokenRow>::Node HeaderNode;
+  typedef typename SkipTree<Row>::Node PostingNode;
+  typedef typename SkipTree<RareRow>::Node RareNode;
+
+  // All three kinds of tree live in one file, in pages big enough for any
+  // of their nodes. The header's root is page 0 and the rare tree's is page 1.
+  typedef RawPage<std::max({sizeof(HeaderNode), sizeof(PostingNode), sizeof(RareNode)})> Page;
+  static constexpr PageLoc kHeaderRoot = 0;
+  static constexpr PageLoc kRareRoot = 1;
+
+  // The format of the index's file, which it refuses to open in any other:
+  // the node layout, and how many rows a header row holds.
+  static constexpr uint64_t kFormat = SkipTree<TokenRow>::kFormat | (uint64_t(kInlineRows) << 32);
+
+  // maxMemory is the cache budget for the whole index.
+  //
+  // Indexes written before everything moved into one file (they have a
+  // separate filename + ".header" and ".rare") can't be opened; nor can any
+  // written in another format (see kFormat).
+  InvertedIndex(std::string filename, Storage storage = Storage::kDisk, uint64_t maxMemory = 0, Durability durability = Durability::kCommit)
+  : maxMemory_(maxMemory) {
+    if (access((filename + ".header").c_str(), F_OK) == 0) {
+      throw std::runtime_error(filename + " is in the old three-file layout, which can't be opened any more");
+    }
+    store_ = _with_snapshots(make_page_manager<Page>(filename, storage, maxMemory, kFormat));
+    if (store_->apply_journal()) {
+      // We crashed during a checkpoint, after its journal was written. The
+      // journal has everything the log did (see checkpoint()).
+      WriteAheadLog<LogRecord>(filename + ".wal").reset();
+      store_->clear_journal();
+    }
+    headerPageManager = std::make_shared<PageManagerView<HeaderNode, Page>>(store_);
+    pageManager = std::make_shared<PageManagerView<PostingNode, Page>>(store_);
+    rarePageManager = std::make_shared<PageManagerView<RareNode, Page>>(store_);
+    if (store_->empty()) {
       this->header = std::make_unique<SkipTree<TokenRow>>(headerPageManager, -1);
-      assert(this->header->rootLoc_ == 0);
       rareTree = std::make_shared<SkipTree<RareRow>>(rarePageManager, -1);
-      assert(rareTree->rootLoc_ == 0);
+      assert(this->header->rootLoc_ == kHeaderRoot);
+      assert(rareTree->rootLoc_ == kRareRoot);
     } else {
-      this->header = std::make_unique<SkipTree<TokenRow>>(headerPageManager, 0);
-      rareTree = std::make_shared<SkipTree<RareRow>>(rarePageManager, 0);
+      this->header = std::make_unique<SkipTree<TokenRow>>(headerPageManager, kHeaderRoot);
+      rareTree = std::make_shared<SkipTree<RareRow>>(rarePageManager, kRareRoot);
+    }
+
+    if (durability == Durability::kWal) {
+      // Replaying the log assumes the files hold exactly the last checkpoint,
+      // which a shared mapping can't promise.
+      if (storage == Storage::kMmap) {
+        throw std::runtime_error("Durability::kWal doesn't work with Storage::kMmap");
+      }
+      this->_for_each_page_manager([](auto *manager) {
+        manager->set_hold_dirty_pages(true);
+      });
+      wal_ = std::make_unique<WriteAheadLog<LogRecord>>(filename + ".wal");
+      if (!wal_->empty()) {
+        wal_->replay([this](const LogRecord& record) {
+          if (record.isRemove) {
+            this->_remove(record.token, record.row);
+          } else {
+            this->_insert(record.token, record.row);
+          }
+        });
+        this->checkpoint();
+      }
+    }
+  }
+
+  // Doesn't throw. If the final checkpoint fails, the log or the journal
+  // still holds everything and the next open recovers it; without a log,
+  // call commit() first to find out whether the index was saved.
+  ~InvertedIndex() {
+    if (wal_ != nullptr) {
+      try {
+        this->checkpoint();
+      } catch (...) {
+      }
     }
   }
 
   // For debugging.
+  //
+  // The parameters aren't named after the members because the members hold
+  // them wrapped for snapshots, and everything below must use the wrappers.
   InvertedIndex(
-    std::shared_ptr<PageManager<typename SkipTree<Row>::Node>> pageManager,
-    std::shared_ptr<PageManager<typename SkipTree<TokenRow>::Node>> headerPageManager,
-    std::shared_ptr<PageManager<typename SkipTree<RareRow>::Node>> rarePageManager
+    std::shared_ptr<PageManager<typename SkipTree<Row>::Node>> postingPages,
+    std::shared_ptr<PageManager<typename SkipTree<TokenRow>::Node>> headerPages,
+    std::shared_ptr<PageManager<typename SkipTree<RareRow>::Node>> rarePages
   )
-  : pageManager(pageManager), headerPageManager(headerPageManager), rarePageManager(rarePageManager) {
+  : headerPageManager(_with_snapshots(headerPages)),
+    pageManager(_with_snapshots(postingPages)),
+    rarePageManager(_with_snapshots(rarePages)) {
     if (headerPageManager->empty()) {
       this->header = std::make_unique<SkipTree<TokenRow>>(headerPageManager, -1);
       assert(this->header->rootLoc_ == 0);
@@ -129,54 +323,305 @@ struct InvertedIndex {
     }
   }
 
+  // For snapshot().
+  InvertedIndex() {}
+
+  // Every page manager that owns pages is wrapped in a SnapshotPageManager,
+  // so that snapshot() can open snapshots of it.
+  template<class P>
+  static std::shared_ptr<PageManager<P>> _with_snapshots(std::shared_ptr<PageManager<P>> manager) {
+    return std::make_shared<SnapshotPageManager<P>>(manager);
+  }
+  template<class P>
+  static std::shared_ptr<PageManager<P>> _snapshot_of(const std::shared_ptr<PageManager<P>>& manager) {
+    auto snapshots = std::dynamic_pointer_cast<SnapshotPageManager<P>>(manager);
+    if (snapshots == nullptr) {
+      throw std::runtime_error("cannot take a snapshot of a snapshot");
+    }
+    return std::make_shared<typename SnapshotPageManager<P>::Snapshot>(snapshots);
+  }
+
+  /**
+   * A read-only copy of the index as it is now. It stays the same however
+   * the index changes afterwards, so a long scan or export can read it while
+   * inserts and removes go on between its steps (which would otherwise
+   * invalidate its iterators), and neither has to wait for the other.
+   *
+   * It's cheap to take: pages are only copied when they're about to change,
+   * and the copies are freed when the last snapshot that can see them goes
+   * away (see SnapshotPageManager). Anything that would change a snapshot
+   * throws, and the index can't be vacuumed while one is open. Snapshots
+   * don't make the index safe to use from several threads at once.
+   */
+  std::shared_ptr<InvertedIndex> snapshot() {
+    std::shared_ptr<InvertedIndex> r(new InvertedIndex());
+    if (store_ != nullptr) {
+      r->store_ = _snapshot_of(store_);
+      r->headerPageManager = std::make_shared<PageManagerView<HeaderNode, Page>>(r->store_);
+      r->pageManager = std::make_shared<PageManagerView<PostingNode, Page>>(r->store_);
+      r->rarePageManager = std::make_shared<PageManagerView<RareNode, Page>>(r->store_);
+    } else {
+      r->headerPageManager = _snapshot_of(headerPageManager);
+      r->pageManager = _snapshot_of(pageManager);
+      r->rarePageManager = _snapshot_of(rarePageManager);
+    }
+    r->header = std::make_unique<SkipTree<TokenRow>>(r->headerPageManager, this->header->rootLoc_);
+    r->rareTree = std::make_shared<SkipTree<RareRow>>(r->rarePageManager, rareTree->rootLoc_);
+    return r;
+  }
+
   uint64_t currentMemoryUsed() const {
-    return headerPageManager->currentMemoryUsed() + pageManager->currentMemoryUsed();
+    if (store_ != nullptr) {
+      return store_->currentMemoryUsed();
+    }
+    return headerPageManager->currentMemoryUsed() + pageManager->currentMemoryUsed() + rarePageManager->currentMemoryUsed();
+  }
+
+  // Calls f on each page manager that owns pages: just the shared store,
+  // unless the index has separate files.
+  template<class F>
+  void _for_each_page_manager(F f) {
+    if (store_ != nullptr) {
+      f(store_.get());
+      return;
+    }
+    f(headerPageManager.get());
+    f(pageManager.get());
+    f(rarePageManager.get());
   }
 
   void insert(Token token, Row row) {
-    TokenRow *tokenRow = this->header->find_and_write(TokenRow{token, 0, 0});
-    if (tokenRow == nullptr) {
+    this->_insert(token, row);
+    this->_log(false, token, row);
+  }
+
+  bool remove(Token token, Row row) {
+    bool r = this->_remove(token, row);
+    this->_log(true, token, row);
+    return r;
+  }
+
+  void _log(bool isRemove, Token token, Row row) {
+    if (wal_ == nullptr) {
+      return;
+    }
+    LogRecord record = LogRecord();
+    record.isRemove = isRemove;
+    record.token = token;
+    record.row = row;
+    wal_->append(record);
+    if (wal_->size() >= nextBudgetCheck_) {
+      nextBudgetCheck_ = wal_->size() + kBudgetCheckBytes;
+      this->_checkpoint_if_over_budget();
+    }
+  }
+
+  void _checkpoint_if_over_budget() {
+    // With a log, pages can't be evicted until they're checkpointed, so
+    // that's the only way to get back under budget. But a checkpoint in the
+    // middle of a bulk load would save a half-built index, so that waits for
+    // BulkLoader::finish().
+    if (wal_ != nullptr && !bulkLoading_ && maxMemory_ != 0 && this->currentMemoryUsed() > maxMemory_) {
+      this->checkpoint();
+    }
+  }
+
+  /**
+   * Fills an empty index from (token, row) pairs sorted by token and then by
+   * row, building every tree bottom-up with SkipTree::BulkLoader instead of
+   * inserting rows one at a time.
+   *
+   *   InvertedIndex<Row>::BulkLoader loader(&index);
+   *   for (auto [token, row] : sortedPairs) {
+   *     loader.add(token, row);
+   *   }
+   *   loader.finish();
+   *
+   * The rows aren't logged, so with Durability::kWal finish() checkpoints,
+   * and nothing is checkpointed before then: the index's memory budget
+   * doesn't hold until the load is finished.
+   */
+  struct BulkLoader {
+    BulkLoader(InvertedIndex *index, double fillFactor = 1.0)
+    : index_(index), fillFactor_(fillFactor),
+      header_(index->headerPageManager, fillFactor),
+      rare_(index->rarePageManager, fillFactor),
+      token_(0), count_(0) {
+      if (!index->header->empty() || !index->rareTree->empty()) {
+        throw std::runtime_error("only an empty index can be bulk loaded");
+      }
+      index->bulkLoading_ = true;
+    }
+
+    void add(Token token, Row row) {
+      assert(count_ == 0 || token_ <= token);
+      if (count_ > 0 && token != token_) {
+        this->_finish_token();
+      }
+      token_ = token;
+      count_ += 1;
+      if (common_ != nullptr) {
+        common_->add(row);
+      } else {
+        // We don't know where this token's rows go until we've seen more
+        // than kRareThreshold of them.
+        pending_.push_back(row);
+        if (pending_.size() > kRareThreshold) {
+          common_ = std::make_unique<typename SkipTree<Row>::BulkLoader>(index_->pageManager, fillFactor_);
+          for (const Row& r : pending_) {
+            common_->add(r);
+          }
+          pending_.clear();
+        }
+      }
+    }
+
+    void finish() {
+      if (count_ > 0) {
+        this->_finish_token();
+      }
+      header_.finish(index_->header->rootLoc_);
+      rare_.finish(index_->rareTree->rootLoc_);
+      index_->bulkLoading_ = false;
+      if (index_->wal_ != nullptr) {
+        index_->checkpoint();
+      }
+    }
+
+    void _finish_token() {
+      TokenRow tokenRow = TokenRow::make(token_);
+      tokenRow.count = count_;
+      if (common_ != nullptr) {
+        tokenRow.root = common_->finish();
+        common_ = nullptr;
+      } else if (_is_inline(tokenRow)) {
+        std::copy(pending_.begin(), pending_.end(), tokenRow.rows.begin());
+      } else {
+        for (const Row& r : pending_) {
+          rare_.add(RareRow{token_, r});
+        }
+      }
+      pending_.clear();
+      header_.add(tokenRow);
+      count_ = 0;
+    }
+
+    InvertedIndex *index_;
+    double fillFactor_;
+    typename SkipTree<TokenRow>::BulkLoader header_;
+    typename SkipTree<RareRow>::BulkLoader rare_;
+    std::unique_ptr<typename SkipTree<Row>::BulkLoader> common_;  // null while the token is rare
+    std::vector<Row> pending_;
+    Token token_;
+    uint64_t count_;
+  };
+
+  // Whether all of a token's rows are in its TokenRow. A token's count only
+  // ever goes up, so once it has moved out it never moves back.
+  static bool _is_inline(const TokenRow& tokenRow) {
+    return tokenRow.root == kNullPage && tokenRow.count <= kInlineRows;
+  }
+
+  void _insert(Token token, Row row) {
+    this->_insert_batch(token, &row, 1);
+  }
+
+  // Inserts rows (sorted, without duplicates) for one token, walking each
+  // tree once for the whole batch (see SkipTree::insert_batch).
+  void insert_batch(Token token, Row const *rows, size_t n) {
+    this->_insert_batch(token, rows, n);
+    for (size_t i = 0; i < n; ++i) {
+      this->_log(false, token, rows[i]);
+    }
+  }
+
+  void _insert_batch(Token token, Row const *rows, size_t n) {
+    if (n == 0) {
+      return;
+    }
+    // Copy the TokenRow out: the trees below share a buffer pool with the
+    // header, so a pointer into the header's page may not survive them.
+    TokenRow tokenRow;
+    std::vector<Row> spilled;
+    TokenRow *header = this->header->find_and_write(TokenRow{token, 0, 0, {}});
+    if (header == nullptr) {
       // Never-before-seen token.
-      TokenRow row{token, uint64_t(1), kNullPage};
-      this->header->insert(row);
-      tokenRow = this->header->find_and_write(row);
-      assert(tokenRow != nullptr);
-      assert(tokenRow->root == kNullPage);
+      tokenRow = TokenRow::make(token);
+      tokenRow.count = n;
+      if (_is_inline(tokenRow)) {
+        tokenRow.insert_inline(rows, n);
+      }
+      this->header->insert(tokenRow);
     } else {
-      tokenRow->count += 1;
+      const bool wasInline = _is_inline(*header);
+      header->count += n;
+      if (_is_inline(*header)) {
+        header->insert_inline(rows, n);
+      } else if (wasInline) {
+        // The token has outgrown its TokenRow.
+        spilled.assign(header->rows.begin(), header->rows.begin() + header->num_inline());
+        header->rows.fill(Row::largest());
+      }
+      tokenRow = *header;
+    }
+    assert(tokenRow.count > 0);
+    if (_is_inline(tokenRow)) {
+      return;
     }
-    assert(tokenRow != nullptr);
-    assert(tokenRow->count > 0);
 
-    if (tokenRow->root == kNullPage) {
-      RareRow rareRow{token, row};
-      rareTree->insert(rareRow);
+    if (tokenRow.root == kNullPage) {
+      std::vector<Row> merged;
+      if (!spilled.empty()) {
+        std::set_union(spilled.begin(), spilled.end(), rows, rows + n, std::back_inserter(merged));
+        rows = merged.data();
+        n = merged.size();
+      }
+      if (n == 1) {
+        rareTree->insert(RareRow{token, rows[0]});
+      } else {
+        std::vector<RareRow> rareRows;
+        rareRows.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+          rareRows.push_back(RareRow{token, rows[i]});
+        }
+        rareTree->insert_batch(rareRows.data(), n);
+      }
+      if (tokenRow.count > kRareThreshold) {
+        this->_migrate_to_common(token);
+      }
+    } else if (n == 1) {
+      this->collection(token, tokenRow.root)->insert(rows[0]);
     } else {
-      auto collection = this->collection(token, tokenRow->root);
-      collection->insert(row);
+      this->collection(token, tokenRow.root)->insert_batch(rows, n);
     }
+  }
 
-    if (tokenRow->count > kRareThreshold && tokenRow->root == kNullPage) {
-      // Migrate from rare to common.
-      assert(collections.find(token) == collections.end());
-      auto newTree = std::make_shared<SkipTree<Row>>(this->pageManager, PageLoc(-1));
-      tokenRow->root = newTree->rootLoc_;
-      collections.insert(std::make_pair(token, newTree));
-      std::vector<RareRow> A = rareTree->range(
-        RareRow{token, Row::smallest()},
-        RareRow{token, Row::largest()}
-      );
-      for (auto a : A) {
-        newTree->insert(a.row);
-      }
+  // Moves a token from the rare tree into a tree of its own.
+  void _migrate_to_common(Token token) {
+    assert(collections.find(token) == collections.end());
+    auto newTree = std::make_shared<SkipTree<Row>>(this->pageManager, PageLoc(-1));
+    collections.insert(std::make_pair(token, newTree));
+    std::vector<RareRow> A = rareTree->range(
+      RareRow{token, Row::smallest()},
+      RareRow{token, Row::largest()}
+    );
+    std::vector<Row> rows;
+    rows.reserve(A.size());
+    for (auto a : A) {
+      rows.push_back(a.row);
     }
+    newTree->insert_batch(rows.data(), rows.size());
+    this->header->find_and_write(TokenRow{token, 0, 0, {}})->root = newTree->rootLoc_;
   }
 
-  bool remove(Token token, Row row) {
-    TokenRow *tokenRow = this->header->find_and_write(TokenRow{token, 0, 0});
+  bool _remove(Token token, Row row) {
+    TokenRow *tokenRow = this->header->find_and_write(TokenRow{token, 0, 0, {}});
     if (tokenRow == nullptr) {
       return false;
     }
+    if (_is_inline(*tokenRow)) {
+      return tokenRow->remove_inline(row);
+    }
     if (tokenRow->root == kNullPage) {
       return rareTree->remove(RareRow{token, row});
     }
@@ -185,7 +630,10 @@ struct InvertedIndex {
   }
 
   std::vector<Row> all(Token token) {
-    TokenRow const *tokenRow = this->header->find(TokenRow{token, 0, 0});
+    TokenRow const *tokenRow = this->header->find(TokenRow{token, 0, 0, {}});
+    if (_is_inline(*tokenRow)) {
+      return std::vector<Row>(tokenRow->rows.begin(), tokenRow->rows.begin() + tokenRow->num_inline());
+    }
     if (tokenRow->root == kNullPage) {
       std::vector<RareRow> A = rareTree->range(
         RareRow{token, Row::smallest()},
@@ -203,7 +651,14 @@ struct InvertedIndex {
 
   // Returns rows on the interval [low, high)
   std::vector<Row> range(Token token, Row low, Row high, uint64_t reserve = uint64_t(-1)) {
-    TokenRow const *tokenRow = this->header->find(TokenRow{token, 0, 0});
+    TokenRow const *tokenRow = this->header->find(TokenRow{token, 0, 0, {}});
+    if (_is_inline(*tokenRow)) {
+      auto end = tokenRow->rows.begin() + tokenRow->num_inline();
+      return std::vector<Row>(
+        std::lower_bound(tokenRow->rows.begin(), end, low),
+        std::lower_bound(tokenRow->rows.begin(), end, high)
+      );
+    }
     if (tokenRow->root == kNullPage) {
       std::vector<RareRow> A = rareTree->range(
         RareRow{token, low},
@@ -225,35 +680,234 @@ struct InvertedIndex {
   }
 
   std::shared_ptr<IteratorInterface<Row>> iterator(uint64_t token, Row lowerBound) {
-    TokenRow const *tokenRow = this->header->find(TokenRow{token, 0, 0});
+    TokenRow const *tokenRow = this->header->find(TokenRow{token, 0, 0, {}});
     if (tokenRow == nullptr) {
       return std::make_shared<ConstIterator<Row>>(Row::largest());
     }
-    if (tokenRow->root == kNullPage) {
+    return this->_iterator(*tokenRow, lowerBound);
+  }
+
+  std::shared_ptr<IteratorInterface<Row>> _iterator(const TokenRow& tokenRow, Row lowerBound) {
+    if (tokenRow.count == 0) {
+      return std::make_shared<ConstIterator<Row>>(Row::largest());
+    }
+    if (_is_inline(tokenRow)) {
+      auto it = std::make_shared<VectorIterator<Row>>(std::vector<Row>(tokenRow.rows.begin(), tokenRow.rows.begin() + tokenRow.num_inline()));
+      it->skip_to(lowerBound);
+      return it;
+    }
+    if (tokenRow.root == kNullPage) {
       std::shared_ptr<IteratorInterface<RareRow>> it = SkipTree<RareRow>::iterator(
         rareTree,
-        RareRow{token, lowerBound},
-        RareRow{token, Row::largest()}
+        RareRow{tokenRow.token, lowerBound},
+        RareRow{tokenRow.token, Row::largest()}
       );
-      return std::make_shared<RareToCommonIterator>(token, it);
+      return std::make_shared<RareToCommonIterator>(tokenRow.token, it);
     } else {
-      return SkipTree<Row>::iterator(this->collection(token, tokenRow->root), lowerBound, Row::largest());
+      return SkipTree<Row>::iterator(this->collection(tokenRow.token, tokenRow.root), lowerBound, Row::largest());
     }
   }
 
-  // Do *not* flush while you are still using iterators.
+  // The header rows of several tokens, found with one walk down the header
+  // (see SkipTree::find_many). Tokens that aren't in the index get a row with
+  // a count of 0. These are copies, so unlike header->find()'s pointers they
+  // survive reading other trees.
+  std::vector<TokenRow> _find_tokens(const std::vector<Token>& tokens) {
+    std::vector<TokenRow> queries;
+    for (Token token : tokens) {
+      queries.push_back(TokenRow{token, 0, 0, {}});
+    }
+    std::sort(queries.begin(), queries.end());
+    std::vector<TokenRow const *> found = this->header->find_many(queries.data(), queries.size());
+    std::vector<TokenRow> r;
+    r.reserve(tokens.size());
+    for (Token token : tokens) {
+      const size_t i = std::lower_bound(queries.begin(), queries.end(), TokenRow{token, 0, 0, {}}) - queries.begin();
+      r.push_back(found[i] != nullptr ? *found[i] : TokenRow{token, 0, kNullPage, {}});
+    }
+    return r;
+  }
+
+  // Iterators for several tokens, all starting at lowerBound. This is the
+  // same as calling iterator() for each token, except that the pages the
+  // iterators start on are read in batches (see SkipTree::load_paths), which
+  // matters when they aren't cached.
+  std::vector<std::shared_ptr<IteratorInterface<Row>>> iterators(const std::vector<Token>& tokens, Row lowerBound) {
+    std::vector<TokenRow> tokenRows = this->_find_tokens(tokens);
+
+    std::vector<SkipTree<Row> *> commonTrees;
+    std::vector<Row> commonQueries;
+    std::vector<SkipTree<RareRow> *> rareTrees;
+    std::vector<RareRow> rareQueries;
+    for (const TokenRow& tokenRow : tokenRows) {
+      if (tokenRow.count == 0 || _is_inline(tokenRow)) {
+        // Nothing to read, or we already have the rows.
+        continue;
+      }
+      if (tokenRow.root == kNullPage) {
+        rareTrees.push_back(rareTree.get());
+        rareQueries.push_back(RareRow{tokenRow.token, lowerBound});
+      } else {
+        commonTrees.push_back(this->collection(tokenRow.token, tokenRow.root).get());
+        commonQueries.push_back(lowerBound);
+      }
+    }
+    SkipTree<Row>::load_paths(commonTrees, commonQueries);
+    SkipTree<RareRow>::load_paths(rareTrees, rareQueries);
+
+    std::vector<std::shared_ptr<IteratorInterface<Row>>> r;
+    for (const TokenRow& tokenRow : tokenRows) {
+      r.push_back(this->_iterator(tokenRow, lowerBound));
+    }
+    return r;
+  }
+
+  // Iterators for several tokens that walk backwards from upperBound
+  // (inclusive), for descending queries: intersecting them gives the newest
+  // rows first.
+  std::vector<std::shared_ptr<IteratorInterface<Reversed<Row>>>> reverse_iterators(const std::vector<Token>& tokens, Row upperBound) {
+    std::vector<std::shared_ptr<IteratorInterface<Reversed<Row>>>> r;
+    for (const auto& it : this->iterators(tokens, Row::smallest())) {
+      r.push_back(std::make_shared<ReverseIterator<Row>>(it, upperBound));
+    }
+    return r;
+  }
+
+  // Do *not* flush while you are still using iterators (unless they're
+  // iterators of a snapshot).
   void flush() {
-    this->header->flush();
-    this->pageManager->flush();
+    if (wal_ != nullptr) {
+      this->checkpoint();
+    }
+    this->_for_each_page_manager([](auto *manager) {
+      manager->flush();
+    });
   }
 
+  // With Durability::kWal this only syncs the log, so everything inserted or
+  // removed since the last commit becomes durable with one write and one
+  // fdatasync.
   void commit() {
-    this->header->commit();
-    this->pageManager->commit();
+    if (wal_ != nullptr) {
+      wal_->sync();
+      if (wal_->size() >= kCheckpointBytes) {
+        this->checkpoint();
+      }
+      return;
+    }
+    this->_for_each_page_manager([](auto *manager) {
+      manager->commit();
+    });
+  }
+
+  // Writes modified pages in the background once they take more than
+  // lowWatermark bytes (per file), and makes inserts wait for the disk past
+  // highWatermark, so commit() and flush() have less to write. 0 turns it
+  // off. Storage::kMmap ignores it, since the kernel writes mapped pages
+  // back on its own. A log needs pages held until a checkpoint, so this
+  // doesn't work with Durability::kWal.
+  void set_dirty_watermarks(uint64_t lowWatermark, uint64_t highWatermark) {
+    if (wal_ != nullptr) {
+      throw std::runtime_error("dirty watermarks need Durability::kCommit");
+    }
+    this->_for_each_page_manager([&](auto *manager) {
+      manager->set_dirty_watermarks(lowWatermark, highWatermark);
+    });
+  }
+
+  // Writes every modified page, waits for the files to reach the disk, and
+  // empties the log.
+  //
+  // With a log, the pages are first saved to a journal (filename + ".ckpt"),
+  // and the log is only emptied once the journal is on disk, so the journal
+  // holds everything the log did. If we crash while the pages are being
+  // written in place, opening the index writes them again from the journal
+  // (which is idempotent) instead of replaying the log, so the files are
+  // never left torn and no record is ever applied twice. Without a log, a
+  // crash during a commit can still tear the files.
+  void checkpoint() {
+    if (wal_ != nullptr) {
+      wal_->sync();
+      store_->write_journal();
+      wal_->reset();
+      nextBudgetCheck_ = 0;
+    }
+    this->_for_each_page_manager([](auto *manager) {
+      manager->commit();
+      manager->sync();
+    });
+    if (wal_ != nullptr) {
+      store_->clear_journal();
+    }
+  }
+
+  // Moves pages from the ends of the index's files into the holes left by
+  // deleted pages, and shrinks the files to fit. This reads every tree, so
+  // it's slow; call it after lots of removals. No iterators may be open.
+  void vacuum() {
+    this->checkpoint();
+
+    // Token trees share the postings file, and their roots live in the header.
+    std::vector<TokenRow> tokenRows = this->header->all();
+    std::vector<SkipTree<Row> *> trees;
+    std::vector<Token> tokens;
+    for (const TokenRow& tokenRow : tokenRows) {
+      if (tokenRow.root != kNullPage) {
+        trees.push_back(this->collection(tokenRow.token, tokenRow.root).get());
+        tokens.push_back(tokenRow.token);
+      }
+    }
+    auto remapPostings = [&trees](const std::unordered_map<PageLoc, PageLoc>& moves) {
+      for (SkipTree<Row> *tree : trees) {
+        tree->_remap_pages(moves);
+      }
+    };
+    auto remapHeader = [this](const std::unordered_map<PageLoc, PageLoc>& moves) {
+      this->header->_remap_pages(moves);
+    };
+    auto remapRare = [this](const std::unordered_map<PageLoc, PageLoc>& moves) {
+      this->rareTree->_remap_pages(moves);
+    };
+    if (store_ != nullptr) {
+      _compact(store_.get(), [&](const std::unordered_map<PageLoc, PageLoc>& moves) {
+        remapPostings(moves);
+        remapHeader(moves);
+        remapRare(moves);
+      });
+    } else {
+      _compact(pageManager.get(), remapPostings);
+      _compact(headerPageManager.get(), remapHeader);
+      _compact(rarePageManager.get(), remapRare);
+    }
+    for (size_t i = 0; i < trees.size(); ++i) {
+      this->header->find_and_write(TokenRow{tokens[i], 0, 0, {}})->root = trees[i]->rootLoc_;
+    }
+
+    // Compaction only moves pages from past the packed size of a file, so
+    // the first pages (where the header and rare roots live) stay put.
+    assert(this->header->rootLoc_ == kHeaderRoot);
+    assert(this->rareTree->rootLoc_ == (store_ != nullptr ? kRareRoot : 0));
+
+    this->checkpoint();
+  }
+
+  // Moves the pages plan_compaction() asks for, after `remap` has fixed up
+  // every tree that lives in the file.
+  template<class Manager, class F>
+  static void _compact(Manager *pageManager, F remap) {
+    std::vector<std::pair<PageLoc, PageLoc>> plan = pageManager->plan_compaction();
+    if (!plan.empty()) {
+      std::unordered_map<PageLoc, PageLoc> moves(plan.begin(), plan.end());
+      remap(moves);
+      for (const auto& move : plan) {
+        pageManager->move_page(move.first, move.second);
+      }
+    }
+    pageManager->truncate();
   }
 
   uint64_t count(Token token) {
-    TokenRow row{token, 0, 0};
+    TokenRow row{token, 0, 0, {}};
     TokenRow const *result = this->header->find(row);
     if (result == nullptr) {
       return 0;
@@ -269,6 +923,7 @@ struct InvertedIndex {
     return collections.at(token);
   }
 
+  std::shared_ptr<PageManager<Page>> store_;  // null if the index has separate files
   std::shared_ptr<PageManager<typename SkipTree<TokenRow>::Node>> headerPageManager;
   std::shared_ptr<PageManager<typename SkipTree<Row>::Node>> pageManager;
   std::shared_ptr<PageManager<typename SkipTree<RareRow>::Node>> rarePageManager;
@@ -277,6 +932,11 @@ struct InvertedIndex {
   std::shared_ptr<SkipTree<RareRow>> rareTree;
 
   std::unordered_map<Token, std::shared_ptr<SkipTree<Row>>> collections;
+
+  uint64_t maxMemory_ = 0;
+  std::unique_ptr<WriteAheadLog<LogRecord>> wal_;  // null unless Durability::kWal
+  uint64_t nextBudgetCheck_ = 0;  // log size at which _log next checks the budget
+  bool bulkLoading_ = false;  // a BulkLoader hasn't finished yet
 };
 
 }  // namespace cpot
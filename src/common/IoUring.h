@@ -0,0 +1,238 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+// A minimal io_uring ring for batching reads, talking to the kernel directly
+// so we don't depend on liburing. CPOT_HAS_IO_URING is 0 where io_uring
+// doesn't exist, in which case IoUring::ok() is always false.
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define CPOT_HAS_IO_URING 1
+#else
+#define CPOT_HAS_IO_URING 0
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#if CPOT_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cpot {
+
+#if CPOT_HAS_IO_URING
+
+struct IoUring {
+  IoUring(unsigned entries) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd_ < 0) {
+      // Old kernel, or io_uring is disabled (as it is in many containers).
+      return;
+    }
+    sqRingBytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingBytes_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqesBytes_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    singleMmap_ = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap_) {
+      sqRingBytes_ = cqRingBytes_ = std::max(sqRingBytes_, cqRingBytes_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+      sqRing_ = nullptr;
+      this->_close();
+      return;
+    }
+    if (singleMmap_) {
+      cqRing_ = sqRing_;
+    } else {
+      cqRing_ = mmap(nullptr, cqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+      if (cqRing_ == MAP_FAILED) {
+        cqRing_ = nullptr;
+        this->_close();
+        return;
+      }
+    }
+    void *sqes = mmap(nullptr, sqesBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      this->_close();
+      return;
+    }
+    sqes_ = (struct io_uring_sqe *)sqes;
+
+    char *sq = (char *)sqRing_;
+    sqHead_ = (unsigned *)(sq + params.sq_off.head);
+    sqTail_ = (unsigned *)(sq + params.sq_off.tail);
+    sqMask_ = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sqEntries_ = *(unsigned *)(sq + params.sq_off.ring_entries);
+    sqArray_ = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)cqRing_;
+    cqHead_ = (unsigned *)(cq + params.cq_off.head);
+    cqTail_ = (unsigned *)(cq + params.cq_off.tail);
+    cqMask_ = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  }
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+  ~IoUring() {
+    this->_close();
+  }
+
+  bool ok() const {
+    return sqes_ != nullptr;
+  }
+
+  // Queues a read of `len` bytes at `offset`. Returns false if the submission
+  // queue is full, in which case call submit_and_wait() and reap() first.
+  bool prep_read(int fd, void *buf, unsigned len, uint64_t offset, uint64_t userData) {
+    const unsigned tail = *sqTail_;
+    if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+      return false;
+    }
+    const unsigned idx = tail & sqMask_;
+    struct io_uring_sqe *sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    sqArray_[idx] = idx;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmitted_;
+    return true;
+  }
+
+  // Submits everything queued and blocks until at least `minComplete`
+  // completions are ready. Returns false if the kernel rejected the call.
+  bool submit_and_wait(unsigned minComplete) {
+    int r;
+    do {
+      r = syscall(__NR_io_uring_enter, fd_, unsubmitted_, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) {
+      return false;
+    }
+    unsubmitted_ -= std::min<unsigned>(unsubmitted_, r);
+    return true;
+  }
+
+  // Blocks until at least `minComplete` completions are ready, without
+  // submitting anything. Returns false if the kernel rejected the call.
+  bool wait(unsigned minComplete) {
+    int r;
+    do {
+      r = syscall(__NR_io_uring_enter, fd_, 0, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } while (r < 0 && errno == EINTR);
+    return r >= 0;
+  }
+
+  // Takes back the queued reads the kernel hasn't picked up yet, and returns
+  // how many there were. We never ask the kernel to poll the queue, so it
+  // only takes entries inside io_uring_enter.
+  unsigned unqueue() {
+    const unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    const unsigned n = *sqTail_ - head;
+    __atomic_store_n(sqTail_, head, __ATOMIC_RELEASE);
+    unsubmitted_ = 0;
+    return n;
+  }
+
+  // Pops one completion, if there is one. `result` is what read() would
+  // have returned, or -errno.
+  bool reap(uint64_t *userData, int32_t *result) {
+    const unsigned head = *cqHead_;
+    if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+      return false;
+    }
+    struct io_uring_cqe *cqe = &cqes_[head & cqMask_];
+    *userData = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  unsigned capacity() const {
+    return sqEntries_;
+  }
+
+  void _close() {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqesBytes_);
+      sqes_ = nullptr;
+    }
+    if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+      munmap(cqRing_, cqRingBytes_);
+    }
+    if (sqRing_ != nullptr) {
+      munmap(sqRing_, sqRingBytes_);
+    }
+    sqRing_ = cqRing_ = nullptr;
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  int fd_ = -1;
+  bool singleMmap_ = false;
+  void *sqRing_ = nullptr;
+  void *cqRing_ = nullptr;
+  size_t sqRingBytes_ = 0;
+  size_t cqRingBytes_ = 0;
+  size_t sqesBytes_ = 0;
+  struct io_uring_sqe *sqes_ = nullptr;
+  struct io_uring_cqe *cqes_ = nullptr;
+  unsigned *sqHead_ = nullptr;
+  unsigned *sqTail_ = nullptr;
+  unsigned *sqArray_ = nullptr;
+  unsigned sqMask_ = 0;
+  unsigned sqEntries_ = 0;
+  unsigned *cqHead_ = nullptr;
+  unsigned *cqTail_ = nullptr;
+  unsigned cqMask_ = 0;
+  unsigned unsubmitted_ = 0;
+};
+
+#else  // CPOT_HAS_IO_URING
+
+struct IoUring {
+  IoUring(unsigned) {}
+  bool ok() const {
+    return false;
+  }
+  bool prep_read(int, void *, unsigned, uint64_t, uint64_t) {
+    return false;
+  }
+  bool submit_and_wait(unsigned) {
+    return false;
+  }
+  bool wait(unsigned) {
+    return false;
+  }
+  unsigned unqueue() {
+    return 0;
+  }
+  bool reap(uint64_t *, int32_t *) {
+    return false;
+  }
+  unsigned capacity() const {
+    return 0;
+  }
+  void _close() {}
+};
+
+#endif  // CPOT_HAS_IO_URING
+
+}  // namespace cpot
+
+#endif  // IO_URING_H
@@ -1,7 +1,10 @@
 #ifndef ITERATOR_H
 #define ITERATOR_H
 
+#include <algorithm>
+#include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <vector>
 
 namespace cpot {
@@ -14,6 +17,27 @@ struct IteratorInterface {
   virtual T skip_to(T val) = 0;
 
   virtual T next() = 0;
+
+  // Moves n values forward. Iterators that can skip ahead without visiting
+  // every value in between override this.
+  virtual T skip_n(uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      this->next();
+    }
+    return this->currentValue;
+  }
+
+  // Iterators that can walk backwards override these. Going backwards,
+  // currentValue is T::smallest() once there's nothing left.
+
+  // Returns the largest value that is less than or equal to val
+  virtual T skip_to_at_most([[maybe_unused]] T val) {
+    throw std::runtime_error("this iterator can't go backwards");
+  }
+
+  virtual T prev() {
+    throw std::runtime_error("this iterator can't go backwards");
+  }
 };
 
 template<class T>
@@ -53,6 +77,20 @@ struct VectorIterator : public IteratorInterface<T> {
     }
     return this->currentValue = *(it + 1);
   }
+  T skip_to_at_most(T row) override {
+    auto it = std::upper_bound(this->data.begin(), this->data.end(), row);
+    if (it == data.begin()) {
+      return this->currentValue = T::smallest();
+    }
+    return this->currentValue = *(it - 1);
+  }
+  T prev() override {
+    auto it = std::lower_bound(this->data.begin(), this->data.end(), this->currentValue);
+    if (it == data.begin()) {
+      return this->currentValue = T::smallest();
+    }
+    return this->currentValue = *(it - 1);
+  }
  private:
   const std::vector<T> data;
 };
@@ -144,6 +182,72 @@ struct UnionIterator : public IteratorInterface<Row> {
   const std::vector<std::shared_ptr<IteratorInterface<Row>>> iters;
 };
 
+/**
+ * A row whose order is the reverse of Row's, so that descending iteration can
+ * reuse everything written for ascending iteration (e.g.
+ * IntersectionIterator<Reversed<Row>> intersects newest-first).
+ *
+ * Note Reversed<Row>::largest() is Row::smallest(), so, just as ascending
+ * iterators can never return Row::largest(), descending ones can never
+ * return Row::smallest().
+ */
+template<class Row>
+struct Reversed {
+  Row row;
+  static Reversed smallest() {
+    return Reversed{Row::largest()};
+  }
+  static Reversed largest() {
+    return Reversed{Row::smallest()};
+  }
+  bool operator<(const Reversed& that) const {
+    return that.row < this->row;
+  }
+  bool operator<=(const Reversed& that) const {
+    return that.row <= this->row;
+  }
+  bool operator==(const Reversed& that) const {
+    return this->row == that.row;
+  }
+  Reversed next() const {
+    return Reversed{row.prev()};
+  }
+  Reversed prev() const {
+    return Reversed{row.next()};
+  }
+};
+
+template<class Row>
+std::ostream& operator<<(std::ostream& s, const Reversed<Row>& r) {
+  return s << r.row;
+}
+
+// Walks an iterator backwards from upperBound (inclusive), as an ascending
+// iterator of Reversed rows.
+template<class Row>
+struct ReverseIterator : public IteratorInterface<Reversed<Row>> {
+  ReverseIterator(std::shared_ptr<IteratorInterface<Row>> it, Row upperBound) : it_(it), upperBound_(upperBound) {
+    this->currentValue = Reversed<Row>{it_->skip_to_at_most(upperBound)};
+  }
+  Reversed<Row> skip_to(Reversed<Row> val) override {
+    if (upperBound_ < val.row) {
+      val.row = upperBound_;
+    }
+    return this->currentValue = Reversed<Row>{it_->skip_to_at_most(val.row)};
+  }
+  Reversed<Row> next() override {
+    return this->currentValue = Reversed<Row>{it_->prev()};
+  }
+  Reversed<Row> skip_to_at_most(Reversed<Row> val) override {
+    return this->currentValue = Reversed<Row>{it_->skip_to(val.row)};
+  }
+  Reversed<Row> prev() override {
+    return this->currentValue = Reversed<Row>{it_->next()};
+  }
+  std::shared_ptr<IteratorInterface<Row>> it_;
+  Row upperBound_;
+};
+
 template<class Row>
 void print_iterator(std::shared_ptr<IteratorInterface<Row>> it) {
   if (it->currentValue == Row::smallest()) {
@@ -1,43 +1,39 @@
 #ifndef MEMORY_BLOCK_H
 #define MEMORY_BLOCK_H
 
+#include <atomic>
 #include <cstdint>
 #include <fstream>
 
 namespace cpot {
 
+// A frame in DiskPageManager's buffer pool: one cached page plus the
+// bookkeeping the pool needs. Frames are allocated in chunks and reused, so
+// `location` changes as pages come and go. The flags are atomic because
+// several threads can hit the same frame at once.
 template<class Page>
 struct MemoryBlock {
-  MemoryBlock() = delete;
-  MemoryBlock(uint64_t location) : location(location) {
-    data = new Page();
-    isModified = false;
-  }
+  MemoryBlock() : isModified(false), isReferenced(false), pinCount(0), modifiedEpoch(0), inUse(false), isDeleted(false), location(0) {}
   MemoryBlock(const MemoryBlock&) = delete;
   MemoryBlock& operator=(const MemoryBlock&) = delete;
-  ~MemoryBlock() {
-    delete[] data;
-  }
-
-  void page_was_modified() {
-    isModified = true;
-  }
 
-  void write(FILE *file) {
-    if (!isModified) {
-      return;
-    }
-    // TODO: make more efficient by making isModified an array.
-    fseek(file, location * sizeof(Page), SEEK_SET);
-    fwrite(this->data, sizeof(Page), 1, file);
-    isModified = false;
+  // Returns true if the page was clean until now.
+  bool page_was_modified() {
+    return !isModified.exchange(true);
   }
 
-  Page *data;
-  bool isModified;
-  const uint64_t location;
+  Page data;
+  std::atomic<bool> isModified;
+  std::atomic<bool> isReferenced;  // CLOCK reference bit; see DiskPageManager::reclaim
+  std::atomic<uint32_t> pinCount;
+  // The pool's epoch when the page was last handed out to be changed (see
+  // DiskPageManager::_take_dirty_pages).
+  std::atomic<uint64_t> modifiedEpoch;
+  bool inUse;
+  bool isDeleted;  // deleted while pinned; the last unpin frees it
+  uint32_t location;
 };
 
 }  // namespace cpot {
 
-#endif  // MEMORY_BLOCK_H
\ No newline at end of file
+#endif  // MEMORY_BLOCK_H
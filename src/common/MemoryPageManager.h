@@ -3,53 +3,67 @@
 
 #include "PageManager.h"
 
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 
 namespace cpot {
 
+// Pages live on the heap until they're deleted. Any number of threads can
+// use it at once: pages never move, so only the page table needs a lock.
 template<class Page>
 struct MemoryPageManager : public PageManager<Page> {
   MemoryPageManager() : n_(0) {}
   Page const *load_page(PageLoc loc) override {
-    if (pages_.count(loc) == 0) {
-      throw std::runtime_error("cannot load_page");
-    }
-    return pages_.at(loc);
+    return this->_find(loc, "cannot load_page");
   }
   Page *load_and_modify_page(PageLoc loc) override {
-    if (pages_.count(loc) == 0) {
-      throw std::runtime_error("cannot load_and_modify_page");
-    }
-    return pages_.at(loc);
+    return this->_find(loc, "cannot load_and_modify_page");
   }
   void delete_page(PageLoc loc) override {
-    if (pages_.count(loc) == 0) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = pages_.find(loc);
+    if (it == pages_.end()) {
       throw std::runtime_error("cannot delete_page");
     }
-    delete pages_.at(loc);
-    pages_.erase(loc);
+    delete it->second;
+    pages_.erase(it);
   }
   Page *new_page(PageLoc *location = nullptr) override {
-    *location = n_++;
     Page *page = new Page();
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    *location = n_++;
     pages_.insert(std::make_pair(*location, page));
     return page;
   }
   void commit() override {}
   void flush() override {}
   uint64_t currentMemoryUsed() const override {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     return pages_.size() * sizeof(Page);
   }
   bool empty() const override {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
     return pages_.size() == 0;
   }
   ~MemoryPageManager() override {
 
   }
+
+  Page *_find(PageLoc loc, char const *error) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = pages_.find(loc);
+    if (it == pages_.end()) {
+      throw std::runtime_error(error);
+    }
+    return it->second;
+  }
+
   uint64_t n_;
   std::unordered_map<PageLoc, Page *> pages_;
+  mutable std::shared_mutex mutex_;
 };
 
 }  // namespace cpot
 
-#endif  // MEMORY_PAGE_MANAGER_H
\ No newline at end of file
+#endif  // MEMORY_PAGE_MANAGER_H
@@ -0,0 +1,233 @@
+#ifndef MMAP_PAGE_MANAGER_H
+#define MMAP_PAGE_MANAGER_H
+
+#include "FreePageList.h"
+#include "PageManager.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cpot {
+
+/**
+ * A PageManager that maps the whole file into memory instead of reading pages
+ * into heap blocks. load_page returns a pointer straight into the mapping, so
+ * a cold page costs a page fault rather than an fseek+fread, and every page
+ * lives only once in RAM (in the kernel's page cache).
+ *
+ * We reserve `maxBytes` of address space up front and grow the file under the
+ * mapping, so pointers returned by load_page stay valid when new_page extends
+ * the file. The on-disk format (including the ".dpm_header" free list) is the
+ * same as DiskPageManager's, so either can open a file written by the other.
+ */
+template<class Page>
+struct MmapPageManager : public PageManager<Page> {
+  // How many pages we extend the file by when new_page runs out of room.
+  static constexpr uint64_t kGrowthPages = 1024;
+
+  MmapPageManager() = delete;
+  // See DiskPageManager for `format`.
+  MmapPageManager(const std::string& filename, uint64_t format = 0, uint64_t maxBytes = uint64_t(1) << 38)
+  : filename_(filename), freePages_(filename + ".dpm_header"), maxBytes_(maxBytes) {
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("cannot open " + filename);
+    }
+    struct stat st;
+    fstat(fd_, &st);
+    numPages_ = st.st_size / sizeof(Page);
+    fileBytes_ = st.st_size;
+    try {
+      freePages_.check_format(format, numPages_);
+      if (fileBytes_ > maxBytes_) {
+        throw std::runtime_error("file is larger than the mmap reservation");
+      }
+    } catch (...) {
+      close(fd_);
+      throw;
+    }
+
+    // MAP_NORESERVE since most of this is address space we may never touch.
+    void *addr = mmap(nullptr, maxBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd_, 0);
+    if (addr == MAP_FAILED) {
+      throw std::runtime_error("cannot mmap " + filename);
+    }
+    pages_ = (Page *)addr;
+  }
+  Page const *load_page(PageLoc loc) override {
+    #ifndef NDEBUG
+    if (loc >= numPages_) {
+      std::cout << "trying to fetch page " << loc << std::endl;
+      std::raise(SIGSEGV);
+    }
+    #endif
+    return pages_ + loc;
+  }
+  Page *load_and_modify_page(PageLoc loc) override {
+    #ifndef NDEBUG
+    if (loc >= numPages_) {
+      std::cout << "trying to fetch page " << loc << std::endl;
+      std::raise(SIGSEGV);
+    }
+    #endif
+    this->_mark_dirty(loc);
+    return pages_ + loc;
+  }
+  void delete_page(PageLoc loc) override {
+    assert(loc < numPages_);
+    freePages_.push(loc);
+  }
+  Page *new_page(PageLoc *location = nullptr) override {
+    PageLoc loc;
+    if (!freePages_.pop(&loc)) {
+      loc = numPages_++;
+      if (uint64_t(numPages_) * sizeof(Page) > fileBytes_) {
+        this->_grow(uint64_t(numPages_ + kGrowthPages) * sizeof(Page));
+      }
+    }
+    this->_mark_dirty(loc);
+    if (location != nullptr) {
+      *location = loc;
+    }
+    return pages_ + loc;
+  }
+  void prefetch(PageLoc loc) override {
+    if (loc >= numPages_) {
+      return;
+    }
+    const uint64_t osPageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = (uint64_t(loc) * sizeof(Page)) / osPageSize * osPageSize;
+    uint64_t end = uint64_t(loc + 1) * sizeof(Page);
+    madvise((char *)pages_ + start, end - start, MADV_WILLNEED);
+  }
+  void commit() override {
+    // Since the mapping is shared, modified pages are already in the page
+    // cache; we only have to msync the (page-aligned) ranges we touched.
+    std::sort(dirtyPages_.begin(), dirtyPages_.end());
+    const uint64_t osPageSize = sysconf(_SC_PAGESIZE);
+    char *base = (char *)pages_;
+    uint64_t runStart = 0;
+    uint64_t runEnd = 0;
+    for (PageLoc loc : dirtyPages_) {
+      uint64_t start = (uint64_t(loc) * sizeof(Page)) / osPageSize * osPageSize;
+      uint64_t end = uint64_t(loc + 1) * sizeof(Page);
+      if (runEnd > runStart && start <= runEnd) {
+        runEnd = std::max(runEnd, end);
+        continue;
+      }
+      if (runEnd > runStart) {
+        this->_sync(base + runStart, runEnd - runStart);
+      }
+      runStart = start;
+      runEnd = end;
+    }
+    if (runEnd > runStart) {
+      this->_sync(base + runStart, runEnd - runStart);
+    }
+    for (PageLoc loc : dirtyPages_) {
+      isDirty_[loc] = false;
+    }
+    dirtyPages_.clear();
+
+    // Drop the slack from _grow so the file length says how many pages there
+    // are (which is how DiskPageManager counts them).
+    this->_grow(uint64_t(numPages_) * sizeof(Page));
+
+    freePages_.commit();
+  }
+  std::vector<std::pair<PageLoc, PageLoc>> plan_compaction() override {
+    return freePages_.plan_compaction(numPages_);
+  }
+  void move_page(PageLoc from, PageLoc to) override {
+    freePages_.take(to);
+    std::memcpy(pages_ + to, pages_ + from, sizeof(Page));
+    this->_mark_dirty(to);
+    this->delete_page(from);
+  }
+  void truncate() override {
+    while (numPages_ > 0 && freePages_.contains(numPages_ - 1)) {
+      numPages_ -= 1;
+    }
+    freePages_.drop_from(numPages_);
+    // commit() cuts the file down to numPages_.
+  }
+  void sync() override {
+    // commit() already msyncs the pages; make the free list durable too.
+    freePages_.sync();
+  }
+  void flush() override {
+    this->commit();
+    // Unmap our view of the pages; the kernel is free to drop them from the
+    // page cache now that they're clean.
+    madvise(pages_, maxBytes_, MADV_DONTNEED);
+  }
+  uint64_t currentMemoryUsed() const override {
+    // Clean pages belong to the kernel's page cache; the only memory we're
+    // responsible for is what hasn't been committed yet.
+    return dirtyPages_.size() * sizeof(Page);
+  }
+  bool empty() const override {
+    return this->numPages_ == 0;
+  }
+  // As with DiskPageManager, a failed commit here is lost: call commit()
+  // first to find out.
+  ~MmapPageManager() override {
+    try {
+      this->commit();
+    } catch (...) {
+    }
+    munmap(pages_, maxBytes_);
+    close(fd_);
+  }
+
+  void _mark_dirty(PageLoc loc) {
+    if (isDirty_.size() <= loc) {
+      isDirty_.resize(std::max<size_t>(loc + 1, isDirty_.size() * 2), false);
+    }
+    if (!isDirty_[loc]) {
+      isDirty_[loc] = true;
+      dirtyPages_.push_back(loc);
+    }
+  }
+
+  void _sync(char *start, uint64_t length) {
+    if (msync(start, length, MS_SYNC) != 0) {
+      throw std::runtime_error("cannot sync " + filename_);
+    }
+  }
+  void _grow(uint64_t bytes) {
+    if (bytes > maxBytes_) {
+      throw std::runtime_error("MmapPageManager ran out of reserved address space");
+    }
+    if (bytes == fileBytes_) {
+      return;
+    }
+    if (ftruncate(fd_, bytes) != 0) {
+      throw std::runtime_error("cannot resize " + filename_);
+    }
+    fileBytes_ = bytes;
+  }
+
+  std::string filename_;
+  FreePageList freePages_;
+  int fd_;
+  Page *pages_;
+  PageLoc numPages_;
+  uint64_t fileBytes_;
+  uint64_t maxBytes_;
+  std::vector<PageLoc> dirtyPages_;
+  std::vector<bool> isDirty_;
+};
+
+}  // namespace cpot
+
+#endif  // MMAP_PAGE_MANAGER_H
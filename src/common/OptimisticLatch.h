@@ -0,0 +1,104 @@
+#ifndef OPTIMISTIC_LATCH_H
+#define OPTIMISTIC_LATCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace cpot {
+
+/**
+ * A version latch for optimistic lock coupling.
+ *
+ * Writers lock() it before changing what it guards, which makes the version
+ * odd, and unlock() it afterwards, which makes it even (and new) again.
+ * Readers never write to it: read_lock() waits (spinning) until no writer
+ * holds it and notes the version, and they validate() it after reading,
+ * starting over if it moved. So readers never block writers or each other,
+ * but they do wait for a writer to unlock, and they may read something that
+ * is being changed under them and must not act on what they read until it
+ * validates.
+ */
+struct OptimisticLatch {
+  // Waits out any writer and returns the version to validate against.
+  uint64_t read_lock() const {
+    uint64_t v = version_.load(std::memory_order_acquire);
+    while (v & 1) {
+      std::this_thread::yield();
+      v = version_.load(std::memory_order_acquire);
+    }
+    return v;
+  }
+
+  // Whether nothing has been written since read_lock() returned v.
+  bool validate(uint64_t v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == v;
+  }
+
+  void lock() {
+    uint64_t v = version_.load(std::memory_order_relaxed);
+    while ((v & 1) || !version_.compare_exchange_weak(v, v + 1, std::memory_order_acquire)) {
+      if (v & 1) {
+        std::this_thread::yield();
+        v = version_.load(std::memory_order_relaxed);
+      }
+    }
+    // Readers that see any of our writes must see the new version too.
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void unlock() {
+    version_.fetch_add(1, std::memory_order_release);
+  }
+
+  std::atomic<uint64_t> version_{0};
+};
+
+/**
+ * Epochs tell a writer when memory that optimistic readers might still be
+ * looking at can be freed.
+ *
+ * Readers enter() before they start and exit() when they're done. The
+ * writer retires memory (after unlinking it, so new readers can't find it)
+ * into the current epoch, and calls try_advance() now and then: once it
+ * advances from e to e + 1, nobody can be reading what was retired in e - 1.
+ */
+struct Epochs {
+  uint64_t enter() {
+    while (true) {
+      const uint64_t e = epoch_.load();
+      readers_[e & 1].fetch_add(1);
+      if (epoch_.load() == e) {
+        return e;
+      }
+      readers_[e & 1].fetch_sub(1);
+    }
+  }
+
+  void exit(uint64_t e) {
+    readers_[e & 1].fetch_sub(1);
+  }
+
+  // Only the writer calls this (and only it advances the epoch).
+  bool try_advance() {
+    const uint64_t e = epoch_.load();
+    if (readers_[(e + 1) & 1].load() != 0) {
+      // Someone who entered in e - 1 is still reading.
+      return false;
+    }
+    epoch_.store(e + 1);
+    return true;
+  }
+
+  uint64_t current() const {
+    return epoch_.load();
+  }
+
+  std::atomic<uint64_t> epoch_{0};
+  std::atomic<int64_t> readers_[2] = {0, 0};
+};
+
+}  // namespace cpot
+
+#endif  // OPTIMISTIC_LATCH_H
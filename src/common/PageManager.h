@@ -1,8 +1,10 @@
 #ifndef PAGE_MANAGER_H
 #define PAGE_MANAGER_H
 
+#include <cassert>
 #include <cstdint>
 #include <errno.h>
+#include <stdexcept>
 #include <unordered_map>
 #include <vector>
 #include <iostream>
@@ -24,6 +26,69 @@ struct PageManager {
   virtual void flush() = 0;
   virtual uint64_t currentMemoryUsed() const = 0;
   virtual bool empty() const = 0;
+
+  // Pinned pages are never evicted, so pointers to them stay valid across
+  // calls to reclaim(). Pins nest; each pin needs a matching unpin.
+  virtual void pin([[maybe_unused]] PageLoc location) {}
+  virtual void unpin([[maybe_unused]] PageLoc location) {}
+
+  // Gives the manager a chance to evict pages to get back under its memory
+  // budget. Any pointer to an unpinned page may be invalidated, so callers
+  // only call this when they're not holding any.
+  virtual void reclaim() {}
+
+  // While set, modified pages only reach the disk through commit() or
+  // flush() (never through eviction), so the file only ever holds states
+  // that were committed. A write-ahead log relies on this.
+  virtual void set_hold_dirty_pages([[maybe_unused]] bool hold) {}
+
+  // Once modified pages take more than lowWatermark bytes, a background
+  // thread writes the oldest of them, and past highWatermark reclaim() waits
+  // for that thread to catch up. 0 turns it off. Only DiskPageManager (and
+  // so UringPageManager) has a writer; for the others this does nothing.
+  virtual void set_dirty_watermarks([[maybe_unused]] uint64_t lowWatermark, [[maybe_unused]] uint64_t highWatermark) {}
+
+  // Waits until everything commit() wrote is on stable storage.
+  virtual void sync() {}
+
+  // Checkpoint journals, which make a commit all-or-nothing (see
+  // InvertedIndex::checkpoint). write_journal() saves every modified page,
+  // and whatever else the next commit() will write, to a file of its own and
+  // syncs it. If we crash before that commit() has reached the disk,
+  // apply_journal() (called before anything is loaded, when the file is
+  // opened again) finishes it and returns true. clear_journal() empties the
+  // journal once the commit is durable.
+  virtual void write_journal() {
+    throw std::runtime_error("this page manager can't write a journal");
+  }
+  virtual bool apply_journal() {
+    return false;
+  }
+  virtual void clear_journal() {}
+
+  // Compaction: plan_compaction() returns (from, to) pairs that would move
+  // every live page into the front of the file. The caller fixes up whatever
+  // points at those pages, calls move_page() for each pair, and then
+  // truncate() drops the free pages at the end. Managers that can't shrink
+  // return no moves.
+  virtual std::vector<std::pair<PageLoc, PageLoc>> plan_compaction() {
+    return {};
+  }
+  virtual void move_page([[maybe_unused]] PageLoc from, [[maybe_unused]] PageLoc to) {}
+  virtual void truncate() {}
+
+  // Hints that `location` will be loaded soon, so the manager can start
+  // reading it in the background. It doesn't load or pin anything.
+  virtual void prefetch([[maybe_unused]] PageLoc location) {}
+
+  // Brings all of `locations` into memory (they can then be loaded without
+  // waiting on the disk), letting the manager read them in parallel. Like
+  // load_page, this doesn't pin them.
+  virtual void load_pages(PageLoc const *locations, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      this->load_page(locations[i]);
+    }
+  }
   virtual ~PageManager() = default;
 };
 
@@ -0,0 +1,102 @@
+#ifndef PAGE_MANAGER_VIEW_H
+#define PAGE_MANAGER_VIEW_H
+
+#include "PageManager.h"
+
+#include <memory>
+
+namespace cpot {
+
+// An untyped page: just kBytes bytes, aligned well enough for any node.
+template<size_t kBytes>
+struct RawPage {
+  alignas(8) unsigned char bytes[kBytes];
+};
+
+/**
+ * Exposes a PageManager of RawPages as a PageManager<Page>, so trees whose
+ * nodes have different types can share one file and one buffer pool. Every
+ * call goes straight to the underlying manager; a view doesn't own any pages
+ * of its own, so (for example) committing through one view commits the pages
+ * of every view over the same manager.
+ */
+template<class Page, class Raw>
+struct PageManagerView : public PageManager<Page> {
+  static_assert(sizeof(Page) <= sizeof(Raw), "pages must fit in the underlying pages");
+  static_assert(alignof(Page) <= alignof(Raw), "pages must be aligned at least as well as the underlying pages");
+
+  PageManagerView(std::shared_ptr<PageManager<Raw>> base) : base_(base) {}
+
+  Page const *load_page(PageLoc loc) override {
+    return reinterpret_cast<Page const *>(base_->load_page(loc));
+  }
+  Page *load_and_modify_page(PageLoc loc) override {
+    return reinterpret_cast<Page *>(base_->load_and_modify_page(loc));
+  }
+  void delete_page(PageLoc loc) override {
+    base_->delete_page(loc);
+  }
+  Page *new_page(PageLoc *location = nullptr) override {
+    return reinterpret_cast<Page *>(base_->new_page(location));
+  }
+  void commit() override {
+    base_->commit();
+  }
+  void flush() override {
+    base_->flush();
+  }
+  uint64_t currentMemoryUsed() const override {
+    return base_->currentMemoryUsed();
+  }
+  bool empty() const override {
+    return base_->empty();
+  }
+  void pin(PageLoc loc) override {
+    base_->pin(loc);
+  }
+  void unpin(PageLoc loc) override {
+    base_->unpin(loc);
+  }
+  void reclaim() override {
+    base_->reclaim();
+  }
+  void prefetch(PageLoc loc) override {
+    base_->prefetch(loc);
+  }
+  void load_pages(PageLoc const *locs, size_t n) override {
+    base_->load_pages(locs, n);
+  }
+  void set_hold_dirty_pages(bool hold) override {
+    base_->set_hold_dirty_pages(hold);
+  }
+  void set_dirty_watermarks(uint64_t lowWatermark, uint64_t highWatermark) override {
+    base_->set_dirty_watermarks(lowWatermark, highWatermark);
+  }
+  void sync() override {
+    base_->sync();
+  }
+  void write_journal() override {
+    base_->write_journal();
+  }
+  bool apply_journal() override {
+    return base_->apply_journal();
+  }
+  void clear_journal() override {
+    base_->clear_journal();
+  }
+  std::vector<std::pair<PageLoc, PageLoc>> plan_compaction() override {
+    return base_->plan_compaction();
+  }
+  void move_page(PageLoc from, PageLoc to) override {
+    base_->move_page(from, to);
+  }
+  void truncate() override {
+    base_->truncate();
+  }
+
+  std::shared_ptr<PageManager<Raw>> base_;
+};
+
+}  // namespace cpot
+
+#endif  // PAGE_MANAGER_VIEW_H
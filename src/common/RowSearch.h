@@ -0,0 +1,167 @@
+#ifndef ROW_SEARCH_H
+#define ROW_SEARCH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace cpot {
+
+/**
+ * std::lower_bound for the rows of a node, returning an index.
+ *
+ * Any row with operator< works. A row type can opt in to a faster search by
+ * declaring
+ *
+ *   typedef uint64_t SearchKey;  // or uint32_t
+ *   static constexpr bool kSearchKeyIsUnique = true;
+ *
+ * For that, the row must be standard-layout, its first member must be an
+ * unsigned integer of type SearchKey, its size must be a multiple of the
+ * key's, and operator< must order rows by that key first.
+ * kSearchKeyIsUnique says whether they're ordered by the key alone; if not,
+ * rows with equal keys are compared with operator<. (The static_asserts in
+ * row_lower_bound check what they can of this.)
+ *
+ * For those rows we binary search (without branching on the comparison)
+ * until kSearchWindow rows remain, then count how many keys in the window are
+ * less than the query a vector at a time: 4 or 8 keys per compare+movemask
+ * with AVX2, 2 or 4 with SSE4.2. Which kernel is used is decided at compile
+ * time (e.g. build with -mavx2 or -march=native); without either we count
+ * with plain (branchless) comparisons.
+ */
+template<class Row>
+size_t row_lower_bound(Row const *rows, size_t n, const Row& query);
+
+constexpr size_t kSearchWindow = 16;
+
+template<class Key>
+inline Key _key_at(unsigned char const *p, size_t stride, size_t i) {
+  Key key;
+  std::memcpy(&key, p + i * stride, sizeof(Key));
+  return key;
+}
+
+// How many of the n keys starting at p (kStride bytes apart) are less than q.
+template<class Key, size_t kStride>
+inline size_t _count_less(unsigned char const *p, size_t n, Key q) {
+  static_assert(sizeof(Key) == 4 || sizeof(Key) == 8);
+  size_t count = 0;
+  size_t i = 0;
+#if defined(__AVX2__)
+  // There are no unsigned compares, so flip the sign bits and compare signed.
+  if constexpr (sizeof(Key) == 8) {
+    const __m256i flip = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    const __m256i vq = _mm256_xor_si256(_mm256_set1_epi64x(int64_t(q)), flip);
+    const __m256i offsets = _mm256_setr_epi64x(0, kStride, 2 * kStride, 3 * kStride);
+    for (; i + 4 <= n; i += 4) {
+      __m256i keys;
+      if constexpr (kStride == sizeof(Key)) {
+        keys = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i * kStride));
+      } else {
+        keys = _mm256_i64gather_epi64(reinterpret_cast<long long const *>(p + i * kStride), offsets, 1);
+      }
+      const __m256i less = _mm256_cmpgt_epi64(vq, _mm256_xor_si256(keys, flip));
+      count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+  } else {
+    const __m256i flip = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+    const __m256i vq = _mm256_xor_si256(_mm256_set1_epi32(int32_t(q)), flip);
+    const __m256i offsets = _mm256_setr_epi32(
+      0, kStride, 2 * kStride, 3 * kStride, 4 * kStride, 5 * kStride, 6 * kStride, 7 * kStride
+    );
+    for (; i + 8 <= n; i += 8) {
+      __m256i keys;
+      if constexpr (kStride == sizeof(Key)) {
+        keys = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i * kStride));
+      } else {
+        keys = _mm256_i32gather_epi32(reinterpret_cast<int const *>(p + i * kStride), offsets, 1);
+      }
+      const __m256i less = _mm256_cmpgt_epi32(vq, _mm256_xor_si256(keys, flip));
+      count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+    }
+  }
+#elif defined(__SSE4_2__)
+  if constexpr (sizeof(Key) == 8) {
+    const __m128i flip = _mm_set1_epi64x(std::numeric_limits<int64_t>::min());
+    const __m128i vq = _mm_xor_si128(_mm_set1_epi64x(int64_t(q)), flip);
+    for (; i + 2 <= n; i += 2) {
+      __m128i keys = _mm_set_epi64x(
+        int64_t(_key_at<Key>(p, kStride, i + 1)),
+        int64_t(_key_at<Key>(p, kStride, i))
+      );
+      const __m128i less = _mm_cmpgt_epi64(vq, _mm_xor_si128(keys, flip));
+      count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(less)));
+    }
+  } else {
+    const __m128i flip = _mm_set1_epi32(std::numeric_limits<int32_t>::min());
+    const __m128i vq = _mm_xor_si128(_mm_set1_epi32(int32_t(q)), flip);
+    for (; i + 4 <= n; i += 4) {
+      __m128i keys = _mm_set_epi32(
+        int32_t(_key_at<Key>(p, kStride, i + 3)),
+        int32_t(_key_at<Key>(p, kStride, i + 2)),
+        int32_t(_key_at<Key>(p, kStride, i + 1)),
+        int32_t(_key_at<Key>(p, kStride, i))
+      );
+      const __m128i less = _mm_cmpgt_epi32(vq, _mm_xor_si128(keys, flip));
+      count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    count += _key_at<Key>(p, kStride, i) < q;
+  }
+  return count;
+}
+
+// The index of the first of the n keys that is >= q.
+template<class Key, size_t kStride>
+inline size_t _key_lower_bound(unsigned char const *p, size_t n, Key q) {
+  size_t lo = 0;
+  while (n > kSearchWindow) {
+    const size_t half = n / 2;
+    const bool less = _key_at<Key>(p, kStride, lo + half) < q;
+    lo = less ? lo + half + 1 : lo;
+    n = less ? n - half - 1 : half;
+  }
+  return lo + _count_less<Key, kStride>(p + lo * kStride, n, q);
+}
+
+template<class Row>
+size_t row_lower_bound(Row const *rows, size_t n, const Row& query) {
+  if constexpr (requires { typename Row::SearchKey; }) {
+    typedef typename Row::SearchKey Key;
+    static_assert(std::is_unsigned_v<Key> && (sizeof(Key) == 4 || sizeof(Key) == 8));
+    static_assert(std::is_standard_layout_v<Row>, "the search key must be the row's first member");
+    static_assert(sizeof(Row) % alignof(Key) == 0);
+
+    unsigned char const *p = reinterpret_cast<unsigned char const *>(rows);
+    const Key q = _key_at<Key>(reinterpret_cast<unsigned char const *>(&query), 0, 0);
+    const size_t idx = _key_lower_bound<Key, sizeof(Row)>(p, n, q);
+    if constexpr (Row::kSearchKeyIsUnique) {
+      return idx;
+    } else {
+      // Rows [idx, end) have the query's key; compare those in full.
+      size_t end = n;
+      if (q != std::numeric_limits<Key>::max()) {
+        end = idx + _key_lower_bound<Key, sizeof(Row)>(p + idx * sizeof(Row), n - idx, q + 1);
+      }
+      return std::lower_bound(rows + idx, rows + end, query) - rows;
+    }
+  } else {
+    return std::lower_bound(rows, rows + n, query) - rows;
+  }
+}
+
+}  // namespace cpot
+
+#endif  // ROW_SEARCH_H
@@ -3,13 +3,18 @@
 
 #include "PageManager.h"
 #include "Iterator.h"
+#include "OptimisticLatch.h"
+#include "RowSearch.h"
 
 #include <cstring>
 #include <cstdint>
 
 #include <algorithm>
 #include <sstream>
+#include <stdexcept>
 #include <cmath>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -34,38 +39,101 @@ typedef uint16_t RowLoc;
 
 constexpr PageLoc kNullPage = PageLoc(-1);
 
-template<class Row>
+/**
+ * A B+ tree whose nodes are exactly kPageSize bytes.
+ *
+ * Leaves and internal nodes share a page, but not a layout: a leaf is nothing
+ * but rows, while an internal node stores a row and a child per entry, so the
+ * fanout of each is whatever fits in a page after the node's header.
+ *
+ * If kCountRows is true, internal nodes also store how many rows are under
+ * each child. That costs some fanout, but lets size(), count_range(), nth()
+ * and Iterator::skip_n() skip whole subtrees instead of walking their leaves.
+ *
+ * If kConcurrent is true, any number of threads can read the tree with
+ * find(query, &row) and iterator() while one thread at a time changes it
+ * (insert(), insert_batch() and remove() take turns). This uses optimistic
+ * lock coupling: every node has a version latch (see OptimisticLatch), and
+ * writers latch the nodes they change until the change is done. Readers
+ * don't take latches; they check that the versions of the nodes they read
+ * didn't move, starting over if they did, and spin while a node they reach
+ * is latched. So readers never wait for each other, but they do wait out a
+ * writer that is changing the nodes (or latch stripes) in their way. The
+ * page manager must be safe to call from several threads at once. Other
+ * reads (find(), range(), all(), size(), ...) still need the tree to hold
+ * still.
+ *
+ * This is opt-in and only reachable through the template parameter:
+ * InvertedIndex and the Python binding use trees without kConcurrent.
+ */
+template<class Row, size_t kPageSize = 4096, bool kCountRows = false, bool kConcurrent = false>
 struct SkipTree {
-  // TODO: what should these be?
-  // static constexpr int kLeafSize = 8;
-  // static constexpr int kNodeSize = 8;
-  // static constexpr int kMinLeafSize = 4;
-  // static constexpr int kMinNodeSize = 4;
-  static constexpr int kLeafSize = 32;
-  static constexpr int kNodeSize = 32;
-  static constexpr int kMinLeafSize = 16;
-  static constexpr int kMinNodeSize = 16;
+  static constexpr size_t _round_up(size_t n, size_t multiple) {
+    return (n + multiple - 1) / multiple * multiple;
+  }
+
+  typedef uint64_t RowCount;
+
+  // The version of the node layout below, for page managers to check files
+  // against (see FreePageList::check_format). Bump it when the layout
+  // changes. Format 0 is the layout from before nodes filled a page.
+  static constexpr uint64_t kFormat = 1;
+
+  // Node's depth, length, self, next and prev, padded so the values that
+  // follow are aligned.
+  static constexpr size_t kHeaderBytes = _round_up(
+    2 * sizeof(uint16_t) + 3 * sizeof(PageLoc),
+    std::max({alignof(Row), alignof(PageLoc), kCountRows ? alignof(RowCount) : 1})
+  );
+  static constexpr size_t kValueBytes = kPageSize - kHeaderBytes;
+
+  static constexpr int kLeafSize = kValueBytes / sizeof(Row);
+  // Counted nodes may need padding after their children.
+  static constexpr int kNodeSize = kCountRows
+    ? (kValueBytes - alignof(RowCount)) / (sizeof(RowCount) + sizeof(Row) + sizeof(PageLoc))
+    : kValueBytes / (sizeof(Row) + sizeof(PageLoc));
+  static constexpr int kMinLeafSize = kLeafSize / 2;
+  static constexpr int kMinNodeSize = kNodeSize / 2;
+
+  // How much of a node an append split leaves behind (see _split).
+  static constexpr int kAppendSplitPercent = 90;
+
+  // _handle_too_small_child needs at least 2 children to rebalance, and
+  // lengths are stored in 16 bits.
+  static_assert(kMinLeafSize > 2, "page is too small for this row");
+  static_assert(kMinNodeSize > 2, "page is too small for this row");
+  static_assert(kLeafSize <= UINT16_MAX, "page is too big");
 
   struct Leaf {
     Row rows[kLeafSize];
   };
 
-  struct InternalNode {
+  struct UncountedInternalNode {
     Row rows[kNodeSize];  // the smallest value of each child
     PageLoc children[kNodeSize];
   };
 
+  struct CountedInternalNode {
+    RowCount counts[kNodeSize];  // how many rows are under each child
+    Row rows[kNodeSize];
+    PageLoc children[kNodeSize];
+  };
+
+  typedef std::conditional_t<kCountRows, CountedInternalNode, UncountedInternalNode> InternalNode;
+
   union NodeValue {
     constexpr NodeValue() {}
     Leaf leaf;
     InternalNode internal;
+    unsigned char bytes[kValueBytes];  // pads nodes out to a full page
   };
 
   struct Node {
     uint16_t depth;  // 0 is a leaf
     uint16_t length;
     PageLoc self;
-    PageLoc next;
+    PageLoc next;  // the neighbors at the same depth
+    PageLoc prev;
     NodeValue value;
     Node() {}
     inline void assert_alive() const {
@@ -111,19 +179,155 @@ struct SkipTree {
     inline bool is_full() const {
       return length >= (this->is_leaf() ? kLeafSize : kNodeSize);
     }
+    // The rightmost node at each depth only has to be nonempty, so that
+    // appends can split it unevenly (see _split).
     inline bool is_too_small() const {
+      if (next == kNullPage) {
+        return length == 0;
+      }
       return length < (this->is_leaf() ? kMinLeafSize : kMinNodeSize);
     }
   };
+  static_assert(sizeof(Node) == kPageSize, "nodes should fill a page exactly");
+
+  // How many rows are under a node (only for trees with kCountRows).
+  static RowCount _count(Node const *node) {
+    static_assert(kCountRows, "only counted trees know their counts");
+    if (node->is_leaf()) {
+      return node->length;
+    }
+    RowCount total = 0;
+    for (size_t i = 0; i < node->length; ++i) {
+      total += node->value.internal.counts[i];
+    }
+    return total;
+  }
+
+  // Records how many rows are under `parent`'s idx-th child. Does nothing if
+  // the tree doesn't count rows.
+  static void _set_count(Node *parent, size_t idx, Node const *child) {
+    if constexpr (kCountRows) {
+      assert(parent->value.internal.children[idx] == child->self);
+      parent->value.internal.counts[idx] = _count(child);
+    }
+  }
+  static void _add_count(Node *parent, size_t idx, int64_t delta) {
+    if constexpr (kCountRows) {
+      parent->value.internal.counts[idx] += delta;
+    }
+  }
 
   SkipTree(std::shared_ptr<PageManager<Node>> pageManager, PageLoc rootLoc)
   : rootLoc_(rootLoc), pageManager_(pageManager) {
+    if constexpr (kConcurrent) {
+      latches_ = std::make_unique<Latches>();
+    }
     if (rootLoc_ == kNullPage) {
       rootLoc_ = this->_create_node(kNullPage, 0)->self;
     }
   }
 
-  ~SkipTree() {}
+  ~SkipTree() {
+    if constexpr (kConcurrent) {
+      // Nobody can be reading any more.
+      for (const std::vector<PageLoc>& retired : latches_->retired) {
+        for (PageLoc loc : retired) {
+          pageManager_->delete_page(loc);
+        }
+      }
+    }
+  }
+
+  // Concurrent trees only. Nodes share latches (by PageLoc), which costs
+  // readers a spurious restart now and then but keeps the table small.
+  static constexpr size_t kLatchStripes = 4096;
+  struct Latches {
+    OptimisticLatch nodes[kLatchStripes];
+    Epochs epochs;
+    std::mutex writer;
+    // The stripes the current change has locked.
+    std::vector<bool> held = std::vector<bool>(kLatchStripes, false);
+    std::vector<size_t> heldList;
+    // Deleted pages, by the parity of the epoch they were deleted in.
+    std::vector<PageLoc> retired[2];
+  };
+
+  OptimisticLatch& _latch(PageLoc loc) const {
+    return latches_->nodes[loc % kLatchStripes];
+  }
+
+  // Every change to the tree goes through one of these. In a concurrent tree
+  // it makes the change wait for any other, and on the way out unlatches the
+  // nodes the change latched and frees what readers can no longer see.
+  struct WriteGuard {
+    WriteGuard(SkipTree *tree) : tree_(tree) {
+      if constexpr (kConcurrent) {
+        tree_->latches_->writer.lock();
+      }
+    }
+    ~WriteGuard() {
+      if constexpr (kConcurrent) {
+        Latches *latches = tree_->latches_.get();
+        for (size_t stripe : latches->heldList) {
+          latches->nodes[stripe].unlock();
+          latches->held[stripe] = false;
+        }
+        latches->heldList.clear();
+        if (latches->epochs.try_advance()) {
+          // What was retired two epochs ago.
+          std::vector<PageLoc>& retired = latches->retired[latches->epochs.current() & 1];
+          for (PageLoc loc : retired) {
+            tree_->pageManager_->delete_page(loc);
+          }
+          retired.clear();
+        }
+        latches->writer.unlock();
+      }
+    }
+    SkipTree *tree_;
+  };
+
+  // Readers of a concurrent tree hold one of these so that the pages they
+  // might be looking at aren't freed under them.
+  struct ReadGuard {
+    ReadGuard(SkipTree const *tree) : tree_(tree) {
+      if constexpr (kConcurrent) {
+        epoch_ = tree_->latches_->epochs.enter();
+      }
+    }
+    ~ReadGuard() {
+      if constexpr (kConcurrent) {
+        tree_->latches_->epochs.exit(epoch_);
+      }
+    }
+    SkipTree const *tree_;
+    uint64_t epoch_;
+  };
+
+  // load_and_modify_page() for changes to the tree, latching the node first
+  // in a concurrent tree. The latch is held until the change is done.
+  Node *_modify(PageLoc loc) {
+    if constexpr (kConcurrent) {
+      const size_t stripe = loc % kLatchStripes;
+      if (!latches_->held[stripe]) {
+        latches_->nodes[stripe].lock();
+        latches_->held[stripe] = true;
+        latches_->heldList.push_back(stripe);
+      }
+    }
+    return pageManager_->load_and_modify_page(loc);
+  }
+
+  // Concurrent trees can't free a node while a reader might still be in it,
+  // so they hold on to it until the epochs say nobody can be.
+  void _delete_node(PageLoc loc) {
+    if constexpr (kConcurrent) {
+      this->_modify(loc);
+      latches_->retired[latches_->epochs.current() & 1].push_back(loc);
+    } else {
+      pageManager_->delete_page(loc);
+    }
+  }
 
   void print(std::ostream& stream) {
     Node const *root = pageManager_->load_page(rootLoc_);
@@ -194,6 +398,110 @@ struct SkipTree {
     Row const *row = &(result.first->value.leaf.rows[result.second]);
     return (query == *row) ? row : nullptr;
   }
+
+  // Copies the row equal to query into *result, returning whether there was
+  // one. Unlike find(), this is safe on a concurrent tree while it changes.
+  bool find(Row query, Row *result) {
+    if constexpr (kConcurrent) {
+      ReadGuard guard(this);
+      Node leaf;
+      uint64_t version;
+      const size_t idx = this->_optimistic_lower_bound(query, false, &leaf, &version, false);
+      if (idx >= leaf.length || !(leaf.value.leaf.rows[idx] == query)) {
+        return false;
+      }
+      *result = leaf.value.leaf.rows[idx];
+      return true;
+    } else {
+      Row const *row = this->find(query);
+      if (row != nullptr) {
+        *result = *row;
+      }
+      return row != nullptr;
+    }
+  }
+  /**
+   * find() for n sorted queries at once: r[i] is what find(queries[i]) would
+   * return. Rather than walking down from the root once per query, the
+   * queries are walked down together a level at a time, so each node is
+   * searched once for all the queries under it, and each level's pages are
+   * handed to load_pages() together.
+   *
+   * Like find()'s, the pointers are only good until the tree (or another tree
+   * sharing its page manager) is used again.
+   */
+  std::vector<Row const *> find_many(Row const *queries, size_t n) {
+    std::vector<Row const *> r(n, nullptr);
+    if (n == 0) {
+      return r;
+    }
+    assert(std::is_sorted(queries, queries + n));
+    pageManager_->reclaim();
+
+    // Queries [begin, end) are under the node at loc.
+    struct Span {
+      PageLoc loc;
+      size_t begin;
+      size_t end;
+    };
+    std::vector<Span> level = {Span{rootLoc_, 0, n}};
+    std::vector<PageLoc> locs;
+    while (!level.empty()) {
+      locs.clear();
+      for (const Span& span : level) {
+        locs.push_back(span.loc);
+      }
+      pageManager_->load_pages(locs.data(), locs.size());
+      std::vector<Span> nextLevel;
+      for (const Span& span : level) {
+        Node const *node = pageManager_->load_page(span.loc);
+        if (node->is_leaf()) {
+          Row const *rows = node->value.leaf.rows;
+          Node const *next = nullptr;
+          size_t idx = 0;
+          for (size_t i = span.begin; i < span.end; ++i) {
+            idx += row_lower_bound(rows + idx, node->length - idx, queries[i]);
+            if (idx < node->length) {
+              if (rows[idx] == queries[i]) {
+                r[i] = &rows[idx];
+              }
+            } else if (node->next != kNullPage) {
+              // Past the end of the leaf; look in the next one, as
+              // _lower_bound does.
+              if (next == nullptr) {
+                next = pageManager_->load_page(node->next);
+              }
+              r[i] = _find_in_leaf(next, queries[i]);
+            }
+          }
+          continue;
+        }
+        // Hand each child the queries _lower_bound would send it.
+        Row const *vals = node->value.internal.rows;
+        for (size_t i = span.begin; i < span.end;) {
+          const size_t child = _child_index(node, row_lower_bound(vals, node->length, queries[i]), queries[i]);
+          size_t j = span.end;
+          if (child + 1 < node->length) {
+            j = i + row_lower_bound(queries + i, span.end - i, vals[child + 1]);
+          }
+          assert(j > i);
+          nextLevel.push_back(Span{node->value.internal.children[child], i, j});
+          i = j;
+        }
+      }
+      level.swap(nextLevel);
+    }
+    return r;
+  }
+
+  // find(), but only looking in one leaf.
+  static Row const *_find_in_leaf(Node const *leaf, const Row& query) {
+    assert(leaf->is_leaf());
+    Row const *rows = leaf->value.leaf.rows;
+    const size_t idx = row_lower_bound(rows, leaf->length, query);
+    return (idx < leaf->length && rows[idx] == query) ? &rows[idx] : nullptr;
+  }
+
   // ** USE WITH CAUTION **
   // This lets you mutate a row in-place. This is powerful, but dangerous.
   // Your new value should be considered equal to the old value, otherwise
@@ -213,6 +521,7 @@ struct SkipTree {
 
   std::pair<Node const *, uint16_t> _lower_bound(const Row& query) {
     assert(rootLoc_ != kNullPage);
+    pageManager_->reclaim();
     Node const *kRoot = pageManager_->load_page(rootLoc_);
     return this->_lower_bound(kRoot, query);
   }
@@ -222,7 +531,7 @@ struct SkipTree {
   std::pair<Node const *, uint16_t> _lower_bound(Node const *node, const Row& query) {
     Row const *vals = (node->is_leaf() ? node->value.leaf.rows : node->value.internal.rows);
     Row const *end = vals + node->length;
-    Row const *it = std::lower_bound(vals, end, query);
+    Row const *it = vals + row_lower_bound(vals, end - vals, query);
     if (node->is_leaf()) {
       if (it < end) {
         return std::make_pair(node, it - vals);
@@ -232,7 +541,7 @@ struct SkipTree {
         node = pageManager_->load_page(node->next);
         vals = (node->is_leaf() ? node->value.leaf.rows : node->value.internal.rows);
         end = vals + node->length;
-        it = std::lower_bound(vals, end, query);
+        it = vals + row_lower_bound(vals, end - vals, query);
         if (it < end) {
           return std::make_pair(node, it - vals);
         }
@@ -240,22 +549,159 @@ struct SkipTree {
       return std::pair<Node const *, uint16_t>(nullptr, 0);
     }
 
-    Node const *child;
-    if (it < end) {
-      if (it == vals || node->value.internal.rows[it - vals] == query) {
-        child = pageManager_->load_page(node->value.internal.children[it - vals]);
-      } else {
-        child = pageManager_->load_page(node->value.internal.children[it - vals - 1]);
-      }
-    } else {
-      child = pageManager_->load_page(node->value.internal.children[node->length - 1]);
-    }
+    Node const *child = pageManager_->load_page(node->value.internal.children[_child_index(node, it - vals, query)]);
 
     std::pair<Node const *, uint16_t> r = this->_lower_bound(child, query);
 
     return r;
   }
 
+  // _lower_bound for concurrent trees. Copies the leaf holding the first row
+  // >= val (> val if strict) into *leaf, with the version it was copied at,
+  // and returns that row's index in it (or leaf->length if there isn't one).
+  // If haveLeaf, *leaf is a copy from earlier to start from instead of the
+  // root.
+  size_t _optimistic_lower_bound(const Row& val, bool strict, Node *leaf, uint64_t *version, bool haveLeaf) {
+    if (!haveLeaf) {
+      this->_optimistic_descend(val, leaf, version);
+    }
+    while (true) {
+      size_t idx = row_lower_bound(leaf->value.leaf.rows, leaf->length, val);
+      if (strict && idx < leaf->length && leaf->value.leaf.rows[idx] == val) {
+        ++idx;
+      }
+      if (idx < leaf->length || leaf->next == kNullPage) {
+        return idx;
+      }
+      // Every row here is too small. If our leaf hasn't changed since we
+      // copied it, its next pointer is still good; otherwise search again.
+      if (!this->_optimistic_next_leaf(leaf, version)) {
+        this->_optimistic_descend(val, leaf, version);
+      }
+    }
+  }
+
+  // Walks down to the leaf that val belongs in, using optimistic lock
+  // coupling: we read a child's version before validating its parent's, so
+  // that if the parent still validates, the child was where we found it and
+  // any later change to it (or its deletion) moves its version. Starts over
+  // from the root whenever a version moved. The writer may reclaim() while
+  // we read, so we pin the page we're reading (and only let go of a parent
+  // once its child is pinned).
+  void _optimistic_descend(const Row& val, Node *leaf, uint64_t *version) {
+    while (true) {
+      PageLoc loc = rootLoc_;
+      uint64_t v = _latch(loc).read_lock();
+      pageManager_->pin(loc);
+      Node const *node = pageManager_->load_page(loc);
+      bool valid = true;
+      while (!node->is_leaf()) {
+        // Nothing read here can be trusted until v validates, so keep every
+        // read in bounds.
+        const size_t length = std::min<size_t>(node->length, kNodeSize);
+        if (length == 0) {
+          valid = false;
+          break;
+        }
+        Row const *vals = node->value.internal.rows;
+        const size_t idx = row_lower_bound(vals, length, val);
+        size_t child = idx;
+        if (idx >= length) {
+          child = length - 1;
+        } else if (idx > 0 && !(vals[idx] == val)) {
+          child = idx - 1;
+        }
+        const PageLoc childLoc = node->value.internal.children[child];
+        const uint64_t childVersion = _latch(childLoc).read_lock();
+        if (!_latch(loc).validate(v)) {
+          valid = false;
+          break;
+        }
+        pageManager_->pin(childLoc);
+        pageManager_->unpin(loc);
+        loc = childLoc;
+        v = childVersion;
+        node = pageManager_->load_page(loc);
+      }
+      if (valid) {
+        std::memcpy(static_cast<void *>(leaf), node, sizeof(Node));
+      }
+      pageManager_->unpin(loc);
+      if (valid && _latch(loc).validate(v)) {
+        *version = v;
+        return;
+      }
+    }
+  }
+
+  // Replaces our copy of a leaf with a copy of the next one, if our leaf
+  // hasn't changed since we copied it. Returns false (leaving *leaf garbage)
+  // if it has.
+  bool _optimistic_next_leaf(Node *leaf, uint64_t *version) {
+    const PageLoc self = leaf->self;
+    const PageLoc loc = leaf->next;
+    const uint64_t v = _latch(loc).read_lock();
+    if (!_latch(self).validate(*version)) {
+      return false;
+    }
+    pageManager_->pin(loc);
+    std::memcpy(static_cast<void *>(leaf), pageManager_->load_page(loc), sizeof(Node));
+    pageManager_->unpin(loc);
+    *version = v;
+    return _latch(loc).validate(v);
+  }
+
+  // Which child of an internal node _lower_bound descends into, given the
+  // index of the first row >= query.
+  static size_t _child_index(Node const *node, size_t idx, const Row& query) {
+    if (idx >= node->length) {
+      return node->length - 1;
+    }
+    if (idx == 0 || node->value.internal.rows[idx] == query) {
+      return idx;
+    }
+    return idx - 1;
+  }
+
+  // Walks down several trees (which must share a page manager) towards
+  // their queries a level at a time, handing each level's pages to
+  // load_pages() together. Afterwards the pages _lower_bound(queries[i])
+  // needs are in memory, so k cold lookups cost about one round of reads
+  // per level instead of k.
+  static void load_paths(const std::vector<SkipTree *>& trees, const std::vector<Row>& queries) {
+    assert(trees.size() == queries.size());
+    if (trees.empty()) {
+      return;
+    }
+    auto pageManager = trees[0]->pageManager_;
+    pageManager->reclaim();
+    std::vector<PageLoc> level;
+    std::vector<size_t> which;
+    for (size_t i = 0; i < trees.size(); ++i) {
+      assert(trees[i]->pageManager_ == pageManager);
+      level.push_back(trees[i]->rootLoc_);
+      which.push_back(i);
+    }
+    while (!level.empty()) {
+      pageManager->load_pages(level.data(), level.size());
+      std::vector<PageLoc> nextLevel;
+      std::vector<size_t> nextWhich;
+      for (size_t i = 0; i < level.size(); ++i) {
+        Node const *node = pageManager->load_page(level[i]);
+        if (node->is_leaf()) {
+          continue;
+        }
+        const Row& query = queries[which[i]];
+        Row const *vals = node->value.internal.rows;
+        size_t idx = row_lower_bound(vals, node->length, query);
+        nextLevel.push_back(node->value.internal.children[_child_index(node, idx, query)]);
+        nextWhich.push_back(which[i]);
+      }
+      level.swap(nextLevel);
+      which.swap(nextWhich);
+    }
+  }
+
   // Returns rows on the interval [low, high)
   std::vector<Row> range(Row low, Row high, uint64_t reserve = uint64_t(-1)) {
     std::vector<Row> r;
@@ -266,6 +712,8 @@ struct SkipTree {
     if (reserve != uint64_t(-1)) {
       r.reserve(reserve);
     }
+    pageManager_->pin(it.first->self);
+    this->_prefetch_next(it.first);
     while (it.first->value.leaf.rows[0] < high) {
       for (uint16_t i = it.second; i < it.first->length; ++i) {
         if (high <= it.first->value.leaf.rows[i]) {
@@ -276,9 +724,10 @@ struct SkipTree {
       if (it.first->next == kNullPage) {
         break;
       }
-      it.first = pageManager_->load_page(it.first->next);
+      it.first = this->_next_node(it.first);
       it.second = 0;
     }
+    pageManager_->unpin(it.first->self);
     return r;
   }
 
@@ -290,6 +739,8 @@ struct SkipTree {
     if (it.first == nullptr) {
       return result;
     }
+    pageManager_->pin(it.first->self);
+    this->_prefetch_next(it.first);
     while (result < end) {
       for (uint16_t i = it.second; i < it.first->length; ++i) {
         *(result++) = it.first->value.leaf.rows[i];
@@ -300,9 +751,10 @@ struct SkipTree {
       if (it.first->next == kNullPage) {
         break;
       }
-      it.first = pageManager_->load_page(it.first->next);
+      it.first = this->_next_node(it.first);
       it.second = 0;
     }
+    pageManager_->unpin(it.first->self);
     return result;
   }
 
@@ -312,10 +764,13 @@ struct SkipTree {
       r.reserve(reserve);
     }
 
+    pageManager_->reclaim();
     Node const *node = pageManager_->load_page(rootLoc_);
     while (!node->is_leaf()) {
       node = pageManager_->load_page(node->value.internal.children[0]);
     }
+    pageManager_->pin(node->self);
+    this->_prefetch_next(node);
     while (true) {
       assert(node->is_leaf());
       for (size_t i = 0; i < node->length; ++i) {
@@ -324,17 +779,109 @@ struct SkipTree {
       if (node->next == kNullPage) {
         break;
       }
-      node = pageManager_->load_page(node->next);
+      node = this->_next_node(node);
     }
+    pageManager_->unpin(node->self);
     return r;
   }
 
-  bool insert(Row row) {
-    // leaves/nodes need at least 2 children when they're too small
-    // so that _handle_too_small_child can rebalance two children.
-    assert(kMinLeafSize > 2);
-    assert(kMinNodeSize > 2);
+  // The rest of these are only for trees with kCountRows. Each loads one path
+  // from the root (two for count_range), however many rows they skip over.
+
+  // How many rows the tree holds.
+  RowCount size() {
+    pageManager_->reclaim();
+    return _count(pageManager_->load_page(rootLoc_));
+  }
+
+  // How many rows are in [low, high).
+  RowCount count_range(Row low, Row high) {
+    if (!(low < high)) {
+      return 0;
+    }
+    pageManager_->reclaim();
+    return this->_rank(high) - this->_rank(low);
+  }
 
+  // The k-th smallest row (counting from 0), or nullptr if there are at most
+  // k rows. Like find(), the pointer is only good until the tree changes.
+  Row const *nth(RowCount k) {
+    pageManager_->reclaim();
+    Node const *node = pageManager_->load_page(rootLoc_);
+    while (!node->is_leaf()) {
+      node = pageManager_->load_page(node->value.internal.children[_nth_child(node, &k)]);
+    }
+    return k < node->length ? &(node->value.leaf.rows[k]) : nullptr;
+  }
+
+  // How many rows are less than query.
+  RowCount _rank(const Row& query) {
+    RowCount rank = 0;
+    Node const *node = pageManager_->load_page(rootLoc_);
+    while (!node->is_leaf()) {
+      const size_t idx = row_lower_bound(node->value.internal.rows, node->length, query);
+      const size_t child = _child_index(node, idx, query);
+      for (size_t i = 0; i < child; ++i) {
+        rank += node->value.internal.counts[i];
+      }
+      node = pageManager_->load_page(node->value.internal.children[child]);
+    }
+    return rank + row_lower_bound(node->value.leaf.rows, node->length, query);
+  }
+
+  // Which child of an internal node holds the k-th row under it. Takes the
+  // rows under the children before that one off of k (if k is past the end,
+  // that's the last child, and k stays past its end).
+  static size_t _nth_child(Node const *node, RowCount *k) {
+    static_assert(kCountRows, "only counted trees know their counts");
+    size_t child = 0;
+    while (child + 1 < node->length && *k >= node->value.internal.counts[child]) {
+      *k -= node->value.internal.counts[child];
+      ++child;
+    }
+    return child;
+  }
+
+  // Moves the pin from `node` to its right neighbor and returns the neighbor.
+  // Scans call this so that they only ever hold one page, which lets the page
+  // manager evict the pages they've already passed over.
+  //
+  // The neighbor's own neighbor is prefetched, so that reading it overlaps
+  // with scanning the neighbor.
+  Node const *_next_node(Node const *node) {
+    const PageLoc loc = node->self;
+    Node const *next = pageManager_->load_page(node->next);
+    pageManager_->pin(next->self);
+    pageManager_->unpin(loc);
+    this->_prefetch_next(next);
+    pageManager_->reclaim();
+    return next;
+  }
+  void _prefetch_next(Node const *node) {
+    if (node->next != kNullPage) {
+      pageManager_->prefetch(node->next);
+    }
+  }
+
+  // Like _next_node, but to the left.
+  Node const *_prev_node(Node const *node) {
+    const PageLoc loc = node->self;
+    Node const *prev = pageManager_->load_page(node->prev);
+    pageManager_->pin(prev->self);
+    pageManager_->unpin(loc);
+    if (prev->prev != kNullPage) {
+      pageManager_->prefetch(prev->prev);
+    }
+    pageManager_->reclaim();
+    return prev;
+  }
+
+  bool insert(Row row) {
+    WriteGuard guard(this);
+    pageManager_->reclaim();
+    if (this->_append(row)) {
+      return true;
+    }
     Node const * const kRoot = pageManager_->load_page(rootLoc_);
     assert(kRoot->depth < 20);
     bool result = this->_insert(kRoot, row);
@@ -344,9 +891,10 @@ struct SkipTree {
     }
     assert(kRoot->depth < 20);
     if (kRoot->is_full()) {
-      Node *root = pageManager_->load_and_modify_page(kRoot->self);
+      Node *root = this->_modify(kRoot->self);
       assert(root == kRoot);
       Node *child = this->_create_node(root->self, root->depth);
+      rightSpine_.clear();
 
       // Copy root into a child.
       if (root->is_leaf()) {
@@ -354,19 +902,26 @@ struct SkipTree {
       } else {
         std::memcpy(child->value.internal.rows, root->value.internal.rows, sizeof(Row) * root->length);
         std::memcpy(child->value.internal.children, root->value.internal.children, sizeof(PageLoc) * root->length);
+        if constexpr (kCountRows) {
+          std::memcpy(child->value.internal.counts, root->value.internal.counts, sizeof(RowCount) * root->length);
+        }
         // We don't actually have to update our children's parent property
         // since _split should handle that.
       }
       child->length = root->length;
 
-      // Clear root and add new child.
-      std::fill_n(root->value.internal.children, root->length, kNullPage);
-      std::fill_n(root->value.internal.rows, root->length, Row::largest());
+      // Clear root and add new child. The root may have been a leaf, whose
+      // rows run past where an internal node keeps its children.
+      std::fill_n(root->value.internal.children, kNodeSize, kNullPage);
+      std::fill_n(root->value.internal.rows, kNodeSize, Row::largest());
+      if constexpr (kCountRows) {
+        std::fill_n(root->value.internal.counts, kNodeSize, 0);
+      }
       root->depth += 1;
       root->length = 1;
       root->value.internal.children[0] = child->self;
 
-      this->_split(root, child, 0);
+      this->_split(root, child, 0, !(row < child->max()));
 
       assert(kRoot->length == 2);
     }
@@ -380,6 +935,40 @@ struct SkipTree {
 
   }
 
+  // Rows that arrive in increasing order always land at the end of the
+  // rightmost leaf, so we remember the path down to it (rightSpine_) and,
+  // while that leaf has room, append to it without searching anything.
+  // Returns false if the row has to be inserted the usual way.
+  bool _append(const Row& row) {
+    if (rightSpine_.empty()) {
+      Node const *node = pageManager_->load_page(rootLoc_);
+      rightSpine_.push_back(rootLoc_);
+      while (!node->is_leaf()) {
+        rightSpine_.push_back(node->value.internal.children[node->length - 1]);
+        node = pageManager_->load_page(rightSpine_.back());
+      }
+    }
+    Node const *kLeaf = pageManager_->load_page(rightSpine_.back());
+    if (!kLeaf->is_leaf() || kLeaf->next != kNullPage) {
+      // Someone else rebuilt the tree (e.g. BulkLoader::finish(rootLoc_)).
+      rightSpine_.clear();
+      return false;
+    }
+    if (kLeaf->length == 0 || kLeaf->length + 1 >= kLeafSize || !(kLeaf->max() < row)) {
+      return false;
+    }
+    Node *leaf = this->_modify(kLeaf->self);
+    leaf->value.leaf.rows[leaf->length] = row;
+    leaf->length += 1;
+    if constexpr (kCountRows) {
+      for (size_t i = 0; i + 1 < rightSpine_.size(); ++i) {
+        Node *node = this->_modify(rightSpine_[i]);
+        _add_count(node, node->length - 1, 1);
+      }
+    }
+    return true;
+  }
+
   bool _insert(Node const *knode, Row row) {
     if (knode->is_leaf()) {
       assert(knode->depth < 20);
@@ -390,7 +979,7 @@ struct SkipTree {
 
     Row const *vals = knode->value.internal.rows;
     Row const *end = vals + knode->length;
-    Row const *it = std::lower_bound(vals, end, row);
+    Row const *it = vals + row_lower_bound(vals, end - vals, row);
     size_t idx = it - vals;
     if (it > vals && (it >= end || !(*it == row))) {
       idx--;
@@ -403,8 +992,12 @@ struct SkipTree {
     bool result = this->_insert(kChild, row);
     assert(knode->depth < 20);
 
+    if (kCountRows && result) {
+      _add_count(this->_modify(knode->self), idx, 1);
+    }
+
     if (!(kChild->get_row(0) == knode->get_row(idx))) {
-      Node *parent = pageManager_->load_and_modify_page(knode->self);
+      Node *parent = this->_modify(knode->self);
       assert(knode->depth < 20);
       assert(parent->depth < 20);
       parent->set_row(idx, kChild->get_row(0));
@@ -413,11 +1006,14 @@ struct SkipTree {
     }
 
     if (kChild->is_full()) {
-      Node *parent = pageManager_->load_and_modify_page(knode->self);
-      Node *child = pageManager_->load_and_modify_page(kChild->self);
+      Node *parent = this->_modify(knode->self);
+      Node *child = this->_modify(kChild->self);
       assert(knode->depth < 20);
       assert(parent->depth < 20);
-      this->_split(parent, child, idx);
+      // If the row went to the very end of the tree, we're probably being
+      // given rows in increasing order.
+      const bool append = (child->next == kNullPage && !(row < child->max()));
+      this->_split(parent, child, idx, append);
       assert(knode->depth < 20);
       assert(parent->depth < 20);
     }
@@ -425,17 +1021,20 @@ struct SkipTree {
     return result;
   }
 
-  void _split(Node *parent, Node *child, const size_t idx) {
+  /**
+   * Splits a full child in two, normally down the middle.
+   *
+   * If `append` is set, the child is the rightmost node at its depth and has
+   * just had a row added to its end. Rows that arrive in increasing order
+   * only ever go there, so splitting it evenly would leave every node behind
+   * it half empty for good. Instead it keeps kAppendSplitPercent of its rows
+   * and the new rightmost node gets the rest (which is allowed to be small).
+   */
+  void _split(Node *parent, Node *child, const size_t idx, bool append = false) {
     parent->assert_alive();
     child->assert_alive();
 
-    if (parent->self != rootLoc_) {
-      if (parent->is_leaf()) {
-        assert(parent->length >= kMinLeafSize);
-      } else {
-        assert(parent->length >= kMinNodeSize);
-      }
-    }
+    assert(!parent->is_too_small() || parent->self == rootLoc_);
     if (child->is_leaf()) {
       ASSERT(child->length >= kMinLeafSize, std::to_string(child->length));
     } else {
@@ -448,7 +1047,11 @@ struct SkipTree {
     newChild->assert_alive();
 
     // Split child.
-    const size_t leftN = child->length / 2;
+    assert(!append || child->next == kNullPage);
+    if (child->next == kNullPage) {
+      rightSpine_.clear();
+    }
+    const size_t leftN = append ? child->length * kAppendSplitPercent / 100 : child->length / 2;
     const size_t rightN = child->length - leftN;
     assert(leftN > 0);
     assert(rightN > 0);
@@ -457,22 +1060,30 @@ struct SkipTree {
       assert(leftN < kLeafSize);
       assert(rightN < kLeafSize);
       assert(leftN >= kMinLeafSize);
-      assert(rightN >= kMinLeafSize);
+      assert(append || rightN >= kMinLeafSize);
       std::memcpy(newChild->value.leaf.rows, child->value.leaf.rows + leftN, sizeof(Row) * rightN);
       std::fill_n(child->value.leaf.rows + leftN, rightN, Row::largest());
     } else {
       assert(leftN < kNodeSize);
       assert(rightN < kNodeSize);
       assert(leftN >= kMinNodeSize);
-      assert(rightN >= kMinNodeSize);
+      assert(append || rightN >= kMinNodeSize);
       std::memcpy(newChild->value.internal.rows, child->value.internal.rows + leftN, sizeof(Row) * rightN);
       std::memcpy(newChild->value.internal.children, child->value.internal.children + leftN, sizeof(PageLoc) * rightN);
       std::fill_n(child->value.internal.rows + leftN, rightN, Row::largest());
       std::fill_n(child->value.internal.children + leftN, rightN, kNullPage);
+      if constexpr (kCountRows) {
+        std::memcpy(newChild->value.internal.counts, child->value.internal.counts + leftN, sizeof(RowCount) * rightN);
+        std::fill_n(child->value.internal.counts + leftN, rightN, 0);
+      }
     }
     child->length = leftN;
     newChild->length = rightN;
     newChild->next = child->next;
+    newChild->prev = child->self;
+    if (child->next != kNullPage) {
+      this->_modify(child->next)->prev = newChild->self;
+    }
     child->next = newChild->self;
 
     assert(!child->is_too_small());
@@ -483,37 +1094,229 @@ struct SkipTree {
     for (size_t i = parent->length - 1; i > idx; --i) {
       parent->value.internal.children[i + 1] = parent->value.internal.children[i];
       parent->value.internal.rows[i + 1] = parent->value.internal.rows[i];
+      if constexpr (kCountRows) {
+        parent->value.internal.counts[i + 1] = parent->value.internal.counts[i];
+      }
     }
 
     // Should be unnecessary.
     parent->value.internal.children[idx] = child->self;
-    parent->value.internal.rows[idx] = child->value.leaf.rows[0];
+    parent->value.internal.rows[idx] = *child->get_row(0);
 
     parent->value.internal.children[idx + 1] = newChild->self;
-    parent->value.internal.rows[idx + 1] = newChild->value.leaf.rows[0];
+    parent->value.internal.rows[idx + 1] = *newChild->get_row(0);
     parent->length += 1;
+    _set_count(parent, idx, child);
+    _set_count(parent, idx + 1, newChild);
   }
 
   bool _insert_into_leaf(Node const *knode, Row row) {
     knode->assert_alive();
-    Node *node = pageManager_->load_and_modify_page(knode->self);
+    Node *node = this->_modify(knode->self);
     assert(node == knode);
     assert(node->length + 1 <= kLeafSize);
     Row *start = node->value.leaf.rows;
     Row *end = start + node->length;
-    Row *it = std::lower_bound(start, end, row);
+    Row *it = start + row_lower_bound(start, end - start, row);
     if (it < end && *it == row) {
       *it = row;
       return false;
     } else {
-      // TODO: avoid sorting here; just shift everything manually.
       assert(node->length < kLeafSize);
-      node->value.leaf.rows[node->length++] = row;
-      std::sort(node->value.leaf.rows, node->value.leaf.rows + node->length);
+      std::memmove(it + 1, it, (end - it) * sizeof(Row));
+      *it = row;
+      node->length += 1;
       return true;
     }
   }
 
+  /**
+   * Inserts n rows, which must be sorted and distinct. Rather than walking
+   * from the root once per row, each node on the way is visited once for the
+   * whole batch: the batch is split up between its children, each leaf
+   * merges its share in one pass, and a node that overflows is split into as
+   * many nodes as it needs at once.
+   *
+   * Returns how many rows weren't already in the tree.
+   */
+  size_t insert_batch(Row const *rows, size_t n) {
+    if (n == 0) {
+      return 0;
+    }
+    assert(std::is_sorted(rows, rows + n));
+    WriteGuard guard(this);
+    pageManager_->reclaim();
+    std::vector<std::pair<Row, PageLoc>> siblings;
+    size_t result = this->_insert_batch(rootLoc_, rows, n, &siblings);
+
+    // The root split. Move what's in it into a new child and make the root
+    // the parent of that child and its new siblings (which may overflow the
+    // root again, needing another level).
+    while (!siblings.empty()) {
+      rightSpine_.clear();
+      Node *root = this->_modify(rootLoc_);
+      Node *child = this->_create_node(root->self, root->depth);
+      const PageLoc childLoc = child->self;
+      std::memcpy(child, root, sizeof(Node));
+      child->self = childLoc;
+      if (child->next != kNullPage) {
+        this->_modify(child->next)->prev = childLoc;
+      }
+
+      std::vector<Row> entries = {*child->get_row(0)};
+      std::vector<PageLoc> children = {childLoc};
+      std::vector<RowCount> counts;
+      if constexpr (kCountRows) {
+        counts.push_back(_count(child));
+      }
+      for (const auto& sibling : siblings) {
+        entries.push_back(sibling.first);
+        children.push_back(sibling.second);
+        if constexpr (kCountRows) {
+          counts.push_back(_count(pageManager_->load_page(sibling.second)));
+        }
+      }
+      root->depth += 1;
+      root->next = kNullPage;
+      siblings = this->_distribute(root, entries, &children, &counts);
+    }
+    return result;
+  }
+
+  // Inserts rows into the subtree at `loc`. If it overflows, the subtree's
+  // root is split, and the new nodes to its right (with their smallest rows)
+  // are appended to `siblings` for the parent to adopt.
+  size_t _insert_batch(PageLoc loc, Row const *rows, size_t n, std::vector<std::pair<Row, PageLoc>> *siblings) {
+    Node const *knode = pageManager_->load_page(loc);
+    if (knode->is_leaf()) {
+      Node *node = this->_modify(loc);
+      std::vector<Row> merged;
+      merged.reserve(node->length + n);
+      Row const *a = node->value.leaf.rows;
+      Row const *aEnd = a + node->length;
+      Row const *b = rows;
+      Row const *bEnd = rows + n;
+      size_t inserted = 0;
+      while (a < aEnd || b < bEnd) {
+        if (b == bEnd || (a < aEnd && *a < *b)) {
+          merged.push_back(*a++);
+        } else {
+          if (a < aEnd && *a == *b) {
+            // Overwrite, like insert().
+            ++a;
+          } else {
+            ++inserted;
+          }
+          merged.push_back(*b++);
+        }
+      }
+      *siblings = this->_distribute(node, merged, nullptr, nullptr);
+      return inserted;
+    }
+
+    // Hand each child the rows that insert() would send it.
+    Row const *vals = knode->value.internal.rows;
+    const size_t length = knode->length;
+    std::vector<Row> entries;
+    std::vector<PageLoc> children;
+    std::vector<RowCount> counts;  // only for counted trees
+    entries.reserve(length);
+    children.reserve(length);
+    size_t inserted = 0;
+    bool changed = false;
+    size_t i = 0;
+    for (size_t idx = 0; idx < length; ++idx) {
+      size_t j = n;
+      if (idx + 1 < length) {
+        j = i + row_lower_bound(rows + i, n - i, vals[idx + 1]);
+      }
+      const PageLoc child = knode->value.internal.children[idx];
+      entries.push_back(vals[idx]);
+      children.push_back(child);
+      if constexpr (kCountRows) {
+        counts.push_back(knode->value.internal.counts[idx]);
+      }
+      if (j == i) {
+        continue;
+      }
+      std::vector<std::pair<Row, PageLoc>> childSiblings;
+      inserted += this->_insert_batch(child, rows + i, j - i, &childSiblings);
+      // The child's smallest row changes if the batch starts before it.
+      Node const *kChild = pageManager_->load_page(child);
+      entries.back() = *kChild->get_row(0);
+      if constexpr (kCountRows) {
+        counts.back() = _count(kChild);
+      }
+      for (const auto& sibling : childSiblings) {
+        entries.push_back(sibling.first);
+        children.push_back(sibling.second);
+        if constexpr (kCountRows) {
+          counts.push_back(_count(pageManager_->load_page(sibling.second)));
+        }
+      }
+      changed = true;
+      i = j;
+    }
+    assert(i == n);
+    if (changed) {
+      Node *node = this->_modify(loc);
+      *siblings = this->_distribute(node, entries, &children, &counts);
+    }
+    return inserted;
+  }
+
+  // Writes `rows` (and, for internal nodes, `children` and, if the tree counts
+  // rows, their `counts`) into `node`, or, if they don't fit, spreads them
+  // evenly over `node` and as many new nodes after it as needed. Returns each
+  // new node's smallest row and location.
+  std::vector<std::pair<Row, PageLoc>> _distribute(Node *node, const std::vector<Row>& rows, std::vector<PageLoc> const *children, std::vector<RowCount> const *counts) {
+    const bool isLeaf = node->is_leaf();
+    assert(isLeaf == (children == nullptr));
+    // Leave room for one more row: a full node would be split by the next
+    // insert.
+    const size_t capacity = (isLeaf ? kLeafSize : kNodeSize) - 1;
+    const size_t total = rows.size();
+    const size_t pieces = std::max<size_t>(1, (total + capacity - 1) / capacity);
+    const PageLoc next = node->next;
+
+    std::vector<std::pair<Row, PageLoc>> siblings;
+    Node *cur = node;
+    size_t begin = 0;
+    for (size_t piece = 0; piece < pieces; ++piece) {
+      const size_t end = total * (piece + 1) / pieces;
+      if (piece > 0) {
+        if (next == kNullPage) {
+          rightSpine_.clear();
+        }
+        Node *fresh = this->_create_node(node->self, node->depth);
+        cur->next = fresh->self;
+        fresh->prev = cur->self;
+        siblings.push_back(std::make_pair(rows[begin], fresh->self));
+        cur = fresh;
+      }
+      if (isLeaf) {
+        std::copy(rows.begin() + begin, rows.begin() + end, cur->value.leaf.rows);
+        std::fill(cur->value.leaf.rows + (end - begin), cur->value.leaf.rows + kLeafSize, Row::largest());
+      } else {
+        std::copy(rows.begin() + begin, rows.begin() + end, cur->value.internal.rows);
+        std::copy(children->begin() + begin, children->begin() + end, cur->value.internal.children);
+        std::fill(cur->value.internal.rows + (end - begin), cur->value.internal.rows + kNodeSize, Row::largest());
+        std::fill(cur->value.internal.children + (end - begin), cur->value.internal.children + kNodeSize, kNullPage);
+        if constexpr (kCountRows) {
+          std::copy(counts->begin() + begin, counts->begin() + end, cur->value.internal.counts);
+          std::fill(cur->value.internal.counts + (end - begin), cur->value.internal.counts + kNodeSize, 0);
+        }
+      }
+      cur->length = end - begin;
+      begin = end;
+    }
+    cur->next = next;
+    if (cur != node && next != kNullPage) {
+      this->_modify(next)->prev = cur->self;
+    }
+    return siblings;
+  }
+
   bool remove(Row row) {
     return this->remove(row, false);
   }
@@ -523,13 +1326,16 @@ struct SkipTree {
    * Returns true iff the row was found and deleted.
    */
   bool remove(Row row, bool debug) {
+    WriteGuard guard(this);
+    pageManager_->reclaim();
     Node const *kRoot = pageManager_->load_page(rootLoc_);
     kRoot->assert_alive();
     bool result = this->_remove(kRoot, row, debug);
 
     if (kRoot->length == 1 && !kRoot->is_leaf()) {
-      Node *root = pageManager_->load_and_modify_page(kRoot->self);
-      Node *child = pageManager_->load_and_modify_page(kRoot->value.internal.children[0]);
+      rightSpine_.clear();
+      Node *root = this->_modify(kRoot->self);
+      Node *child = this->_modify(kRoot->value.internal.children[0]);
 
       root->length = child->length;
       root->depth = child->depth;
@@ -540,8 +1346,11 @@ struct SkipTree {
       } else {
         std::memcpy(root->value.internal.rows, child->value.internal.rows, sizeof(Row) * child->length);
         std::memcpy(root->value.internal.children, child->value.internal.children, sizeof(PageLoc) * child->length);
+        if constexpr (kCountRows) {
+          std::memcpy(root->value.internal.counts, child->value.internal.counts, sizeof(RowCount) * child->length);
+        }
       }
-      pageManager_->delete_page(child->self);
+      this->_delete_node(child->self);
       child = nullptr;
     }
     return result;
@@ -549,21 +1358,21 @@ struct SkipTree {
 
   bool _remove(Node const *knode, Row row, bool debug) {
     assert(!knode->is_too_small() || knode->self == rootLoc_);
-    Row const *vals = knode->value.internal.rows;
+    Row const *vals = (knode->is_leaf() ? knode->value.leaf.rows : knode->value.internal.rows);
     Row const *end = vals + knode->length;
-    Row const *it = std::lower_bound(vals, end, row);
+    Row const *it = vals + row_lower_bound(vals, end - vals, row);
     size_t idx = it - vals;
 
     if (knode->is_leaf()) {
       if (it >= end || !(*it == row)) {
         return false;
       }
-      Node *node = pageManager_->load_and_modify_page(knode->self);
-      // TODO: avoid sorting here; just shift everything manually.
+      Node *node = this->_modify(knode->self);
       assert(node->length - 1 >= 0);
       assert(node->length - 1 < kLeafSize);
-      node->value.leaf.rows[idx] = node->value.leaf.rows[--node->length];
-      std::sort(node->value.leaf.rows, node->value.leaf.rows + node->length);
+      Row *rows = node->value.leaf.rows;
+      std::memmove(rows + idx, rows + idx + 1, (node->length - idx - 1) * sizeof(Row));
+      node->length -= 1;
       return true;
     }
 
@@ -575,20 +1384,48 @@ struct SkipTree {
     assert(*(kChild->get_row(0)) == knode->value.internal.rows[idx]);
     bool result = this->_remove(kChild, row, debug);
 
+    if (kCountRows && result) {
+      _add_count(this->_modify(knode->self), idx, -1);
+    }
+
     if (kChild->is_too_small()) {
-      assert(knode->length >= 2);
-      Node *parent = pageManager_->load_and_modify_page(knode->self);
-      Node *child = pageManager_->load_and_modify_page(kChild->self);
-      this->_handle_too_small_child(parent, child, idx, debug);
+      Node *parent = this->_modify(knode->self);
+      Node *child = this->_modify(kChild->self);
+      if (child->next == kNullPage) {
+        this->_remove_empty_rightmost(parent, child, idx);
+      } else {
+        assert(knode->length >= 2);
+        this->_handle_too_small_child(parent, child, idx, debug);
+      }
     } else if (!(kChild->get_row(0) == knode->get_row(idx))) {
-      Node *parent = pageManager_->load_and_modify_page(knode->self);
+      Node *parent = this->_modify(knode->self);
       parent->set_row(idx, kChild->get_row(0));
     }
 
     return result;
   }
 
-  void _handle_too_small_child(Node *parent, Node *child, size_t idx, bool debug) {
+  // The rightmost node at a depth is only too small once it's empty, at which
+  // point we delete it. That can leave its parent (the rightmost node above)
+  // empty too, which our caller deals with in the same way.
+  void _remove_empty_rightmost(Node *parent, Node *child, size_t idx) {
+    assert(child->length == 0);
+    assert(idx + 1 == parent->length);
+    assert(parent->value.internal.children[idx] == child->self);
+    rightSpine_.clear();
+    if (child->prev != kNullPage) {
+      this->_modify(child->prev)->next = kNullPage;
+    }
+    this->_delete_node(child->self);
+    parent->value.internal.rows[idx] = Row::largest();
+    parent->value.internal.children[idx] = kNullPage;
+    if constexpr (kCountRows) {
+      parent->value.internal.counts[idx] = 0;
+    }
+    parent->length -= 1;
+  }
+
+  void _handle_too_small_child(Node *parent, Node *child, size_t idx, [[maybe_unused]] bool debug) {
     assert(!parent->is_leaf());
     assert(child->is_too_small());
     assert(parent->value.internal.children[idx] == child->self);
@@ -597,11 +1434,11 @@ struct SkipTree {
     Node *right = nullptr;
     if (idx != 0) {
       idx -= 1;
-      left = pageManager_->load_and_modify_page(parent->value.internal.children[idx]);
+      left = this->_modify(parent->value.internal.children[idx]);
       right = child;
     } else {
       left = child;
-      right = pageManager_->load_and_modify_page(parent->value.internal.children[idx + 1]);
+      right = this->_modify(parent->value.internal.children[idx + 1]);
     }
 
     bool shouldMerge;
@@ -620,6 +1457,9 @@ struct SkipTree {
 
   void _merge(Node *parent, Node *left, Node *right, size_t leftIdx) {
     assert(left->is_leaf() == right->is_leaf());
+    if (right->next == kNullPage) {
+      rightSpine_.clear();
+    }
     assert(parent->value.internal.children[leftIdx] == left->self);
     if (left->is_leaf()) {
       assert(left->length < kLeafSize);
@@ -630,12 +1470,18 @@ struct SkipTree {
         left->value.leaf.rows[left->length++] = right->value.leaf.rows[i];
       }
       left->next = right->next;
+      if (right->next != kNullPage) {
+        this->_modify(right->next)->prev = left->self;
+      }
       for (size_t i = leftIdx + 1; i < parent->length; ++i) {
         parent->value.internal.rows[i] = parent->value.internal.rows[i + 1];
         parent->value.internal.children[i] = parent->value.internal.children[i + 1];
+        if constexpr (kCountRows) {
+          parent->value.internal.counts[i] = parent->value.internal.counts[i + 1];
+        }
       }
       parent->length -= 1;
-      pageManager_->delete_page(right->self);
+      this->_delete_node(right->self);
       right = nullptr;
     } else {
       assert(left->length + right->length < kNodeSize);
@@ -645,24 +1491,35 @@ struct SkipTree {
       for (size_t i = 0; i < right->length; ++i) {
         left->value.internal.rows[left->length] = right->value.internal.rows[i];
         left->value.internal.children[left->length] = right->value.internal.children[i];
+        if constexpr (kCountRows) {
+          left->value.internal.counts[left->length] = right->value.internal.counts[i];
+        }
         left->length += 1;
       }
       left->next = right->next;
+      if (right->next != kNullPage) {
+        this->_modify(right->next)->prev = left->self;
+      }
       for (size_t i = leftIdx + 1; i < parent->length; ++i) {
         parent->value.internal.rows[i] = parent->value.internal.rows[i + 1];
         parent->value.internal.children[i] = parent->value.internal.children[i + 1];
+        if constexpr (kCountRows) {
+          parent->value.internal.counts[i] = parent->value.internal.counts[i + 1];
+        }
       }
       parent->length -= 1;
-      pageManager_->delete_page(right->self);
+      this->_delete_node(right->self);
       right = nullptr;
     }
 
     parent->value.internal.rows[leftIdx] = *(left->get_row(0));
+    _set_count(parent, leftIdx, left);
   }
 
   void _rebalance(Node *parent, Node *left, Node *right, size_t leftIdx) {
     assert(left->is_leaf() == right->is_leaf());
     assert(left->next == right->self);
+    assert(right->prev == left->self);
     const bool isLeaf = left->is_leaf();
     assert(parent->value.internal.children[leftIdx] == left->self);
     if (isLeaf) {
@@ -698,12 +1555,19 @@ struct SkipTree {
           left->value.internal.children[left->length] = right->value.internal.children[i];
           right->value.internal.rows[i] = right->value.internal.rows[i + delta];
           right->value.internal.children[i] = right->value.internal.children[i + delta];
+          if constexpr (kCountRows) {
+            left->value.internal.counts[left->length] = right->value.internal.counts[i];
+            right->value.internal.counts[i] = right->value.internal.counts[i + delta];
+          }
           left->length += 1;
         }
 
         for (size_t i = delta; i < right->length - delta; ++i) {
           right->value.internal.rows[i] = right->value.internal.rows[i + delta];
           right->value.internal.children[i] = right->value.internal.children[i + delta];
+          if constexpr (kCountRows) {
+            right->value.internal.counts[i] = right->value.internal.counts[i + delta];
+          }
         }
         right->length -= delta;
       }
@@ -730,6 +1594,9 @@ struct SkipTree {
         for (size_t i = right->length - 1; i < right->length; --i) {
           right->value.internal.rows[i + delta] = right->value.internal.rows[i];
           right->value.internal.children[i + delta] = right->value.internal.children[i];
+          if constexpr (kCountRows) {
+            right->value.internal.counts[i + delta] = right->value.internal.counts[i];
+          }
         }
         right->length += delta;
         // Move values from end of left node to beginning of right node.
@@ -737,30 +1604,60 @@ struct SkipTree {
           --left->length;
           right->value.internal.rows[i] = left->value.internal.rows[left->length];
           right->value.internal.children[i] = left->value.internal.children[left->length];
+          if constexpr (kCountRows) {
+            right->value.internal.counts[i] = left->value.internal.counts[left->length];
+          }
         }
       }
     }
     parent->value.internal.rows[leftIdx] = *(left->get_row(0));
     parent->value.internal.rows[leftIdx + 1] = *(right->get_row(0));
+    _set_count(parent, leftIdx, left);
+    _set_count(parent, leftIdx + 1, right);
   }
 
+  // Iterators keep their current leaf pinned, so other iterators over the
+  // same page manager can't evict it out from under them.
+  //
+  // They can also walk backwards with skip_to_at_most() and prev(), in which
+  // case currentValue is Row::smallest() once they run out of rows (see
+  // ReverseIterator).
+  //
+  // They also remember the path from the root to that leaf, so skip_to can
+  // search forward from where it is (a finger search): first the current
+  // leaf, then up only as many levels as it takes to find an ancestor whose
+  // subtree holds the target, and back down from there. Short skips touch a
+  // page or two instead of one per level.
   struct Iterator : public IteratorInterface<Row> {
     Iterator(std::shared_ptr<SkipTree> tree, Row low, Row high)
-    : low_(low), high_(high), tree_(tree) {
+    : low_(low), high_(high), tree_(tree), loc_(nullptr, 0) {
       this->skip_to(low_);
     }
+    ~Iterator() {
+      if (loc_.first != nullptr) {
+        tree_->pageManager_->unpin(loc_.first->self);
+      }
+    }
     // Returns the smallest value that is greater than or equal to val
     Row skip_to(Row val) override {
       if (val < low_) {
         val = low_;
       }
-      loc_ = tree_->_lower_bound(val);
-      if (loc_.first != nullptr && loc_.first->value.leaf.rows[loc_.second] < high_) {
-        this->currentValue = loc_.first->value.leaf.rows[loc_.second];
+      if (loc_.first == nullptr) {
+        this->_seek(0, tree_->rootLoc_, val);
       } else {
-        this->currentValue = Row::largest();
+        Node const *leaf = loc_.first;
+        Row const *rows = leaf->value.leaf.rows;
+        if (val < rows[loc_.second]) {
+          // Backwards; start over.
+          this->_seek(0, tree_->rootLoc_, val);
+        } else if (!(rows[leaf->length - 1] < val)) {
+          loc_.second += row_lower_bound(rows + loc_.second, leaf->length - loc_.second, val);
+        } else {
+          this->_climb(val);
+        }
       }
-      return this->currentValue;
+      return this->_update_current_value();
     }
     Row next() override {
       if (loc_.first == nullptr) {
@@ -770,48 +1667,604 @@ struct SkipTree {
       loc_.second++;
       if (loc_.second >= loc_.first->length) {
         if (loc_.first->next == kNullPage) {
+          tree_->pageManager_->unpin(loc_.first->self);
           loc_.first = nullptr;
           this->currentValue = Row::largest();
           return this->currentValue;
         }
-        loc_.first = tree_->pageManager_->load_page(loc_.first->next);
-        loc_.second = 0;
+        this->_next_leaf();
+      }
+      return this->_update_current_value();
+    }
+
+    // With kCountRows we work out our rank from the path and seek the row n
+    // further on from the root; otherwise we hop over whole leaves, reading
+    // just their lengths.
+    Row skip_n(uint64_t n) override {
+      if (loc_.first == nullptr) {
+        return this->currentValue = Row::largest();
       }
-      if (loc_.first->value.leaf.rows[loc_.second] < high_) {
+      if (loc_.second + n < loc_.first->length) {
+        loc_.second += n;
+        return this->_update_current_value();
+      }
+      if constexpr (kCountRows) {
+        RowCount rank = loc_.second + n;
+        for (const PathEntry& entry : path_) {
+          Node const *node = tree_->pageManager_->load_page(entry.loc);
+          for (size_t i = 0; i < entry.idx; ++i) {
+            rank += node->value.internal.counts[i];
+          }
+        }
+        this->_seek_nth(rank);
+      } else {
+        n -= loc_.first->length - loc_.second;
+        while (true) {
+          if (loc_.first->next == kNullPage) {
+            tree_->pageManager_->unpin(loc_.first->self);
+            loc_ = std::make_pair(nullptr, 0);
+            break;
+          }
+          this->_next_leaf();
+          if (n < loc_.first->length) {
+            loc_.second = n;
+            break;
+          }
+          n -= loc_.first->length;
+        }
+      }
+      return this->_update_current_value();
+    }
+
+    // Returns the largest value that is less than or equal to val
+    Row skip_to_at_most(Row val) override {
+      // high_ is exclusive.
+      const bool isHigh = !(val < high_);
+      if (isHigh) {
+        val = high_;
+      }
+      Node const *leaf = loc_.first;
+      if (leaf != nullptr && !(val < leaf->value.leaf.rows[0]) && !(leaf->value.leaf.rows[leaf->length - 1] < val)) {
+        // It's in this leaf.
+        loc_.second = _last_at_most(leaf, val);
+      } else {
+        this->_seek_at_most(val);
+      }
+      if (isHigh && loc_.first != nullptr && loc_.first->value.leaf.rows[loc_.second] == high_) {
+        return this->prev();
+      }
+      return this->_update_current_value_backwards();
+    }
+    Row prev() override {
+      if (loc_.first == nullptr) {
+        this->currentValue = Row::smallest();
+        return this->currentValue;
+      }
+      if (loc_.second == 0) {
+        if (loc_.first->prev == kNullPage) {
+          tree_->pageManager_->unpin(loc_.first->self);
+          loc_.first = nullptr;
+          this->currentValue = Row::smallest();
+          return this->currentValue;
+        }
+        this->_prev_leaf();
+      } else {
+        loc_.second--;
+      }
+      return this->_update_current_value_backwards();
+    }
+
+    Row _update_current_value() {
+      if (loc_.first != nullptr && loc_.first->value.leaf.rows[loc_.second] < high_) {
         this->currentValue = loc_.first->value.leaf.rows[loc_.second];
       } else {
         this->currentValue = Row::largest();
       }
       return this->currentValue;
     }
+    Row _update_current_value_backwards() {
+      if (loc_.first != nullptr && !(loc_.first->value.leaf.rows[loc_.second] < low_)) {
+        this->currentValue = loc_.first->value.leaf.rows[loc_.second];
+      } else {
+        this->currentValue = Row::smallest();
+      }
+      return this->currentValue;
+    }
+
+    // The index of the last row in the leaf that is <= val, given that there
+    // is one.
+    static uint16_t _last_at_most(Node const *leaf, const Row& val) {
+      const size_t idx = row_lower_bound(leaf->value.leaf.rows, leaf->length, val);
+      if (idx < leaf->length && leaf->value.leaf.rows[idx] == val) {
+        return idx;
+      }
+      assert(idx > 0);
+      return idx - 1;
+    }
+
+    // val is past the current leaf. Walk up the path until we reach a node
+    // that val falls strictly inside of (or the root, or a node with nothing
+    // to its right) and search down from there.
+    void _climb(const Row& val) {
+      for (size_t depth = path_.size(); depth-- > 0;) {
+        Node const *node = tree_->pageManager_->load_page(path_[depth].loc);
+        Row const *vals = node->value.internal.rows;
+        const size_t from = path_[depth].idx;
+        const size_t idx = from + row_lower_bound(vals + from, node->length - from, val);
+        const size_t child = _child_index(node, idx, val);
+        if (child + 1 < node->length || node->next == kNullPage || depth == 0) {
+          path_[depth].idx = child;
+          path_.resize(depth + 1);
+          this->_seek(depth + 1, node->value.internal.children[child], val);
+          return;
+        }
+      }
+      // The root is the current leaf, and val is past all of it.
+      tree_->pageManager_->unpin(loc_.first->self);
+      loc_ = std::make_pair(nullptr, 0);
+    }
+
+    // Descends from the node at `loc`, which is `depth` levels below the
+    // root, to the first row >= val, recording the path as it goes.
+    void _seek(size_t depth, PageLoc loc, const Row& val) {
+      Node const *node = this->_descend(depth, loc, val);
+      this->_land(node, row_lower_bound(node->value.leaf.rows, node->length, val));
+      if (loc_.second < node->length) {
+        tree_->_prefetch_next(node);
+      } else if (node->next != kNullPage) {
+        // Every row here is < val, so the answer is the next leaf's first.
+        this->_next_leaf();
+      } else {
+        tree_->pageManager_->unpin(node->self);
+        loc_ = std::make_pair(nullptr, 0);
+      }
+    }
+
+    // Descends from the root to the k-th row of the tree.
+    void _seek_nth(RowCount k) {
+      path_.clear();
+      Node const *node = tree_->pageManager_->load_page(tree_->rootLoc_);
+      while (!node->is_leaf()) {
+        const size_t child = _nth_child(node, &k);
+        path_.push_back(PathEntry{node->self, uint16_t(child)});
+        node = tree_->pageManager_->load_page(node->value.internal.children[child]);
+      }
+      this->_land(node, 0);
+      if (k < node->length) {
+        loc_.second = k;
+        tree_->_prefetch_next(node);
+      } else {
+        tree_->pageManager_->unpin(node->self);
+        loc_ = std::make_pair(nullptr, 0);
+      }
+    }
+
+    // Descends from the root to the last row <= val.
+    void _seek_at_most(const Row& val) {
+      Node const *node = this->_descend(0, tree_->rootLoc_, val);
+      if (node->length > 0 && !(val < node->value.leaf.rows[0])) {
+        this->_land(node, _last_at_most(node, val));
+      } else if (node->prev != kNullPage) {
+        // Every row here is > val, so the answer is the previous leaf's last.
+        this->_land(node, 0);
+        this->_prev_leaf();
+      } else {
+        this->_land(node, 0);
+        tree_->pageManager_->unpin(node->self);
+        loc_ = std::make_pair(nullptr, 0);
+      }
+    }
+
+    // Walks down to the leaf whose range holds val, recording the path.
+    Node const *_descend(size_t depth, PageLoc loc, const Row& val) {
+      path_.resize(depth);
+      Node const *node = tree_->pageManager_->load_page(loc);
+      while (!node->is_leaf()) {
+        const size_t idx = row_lower_bound(node->value.internal.rows, node->length, val);
+        const size_t child = _child_index(node, idx, val);
+        path_.push_back(PathEntry{node->self, uint16_t(child)});
+        node = tree_->pageManager_->load_page(node->value.internal.children[child]);
+      }
+      return node;
+    }
+
+    // Moves the iterator (and its pin) to a row of `leaf`.
+    void _land(Node const *leaf, uint16_t idx) {
+      tree_->pageManager_->pin(leaf->self);
+      if (loc_.first != nullptr) {
+        tree_->pageManager_->unpin(loc_.first->self);
+      }
+      loc_ = std::make_pair(leaf, idx);
+    }
+
+    // Moves to the first row of the next leaf, keeping the path in step.
+    void _next_leaf() {
+      loc_.first = tree_->_next_node(loc_.first);
+      loc_.second = 0;
+      for (size_t depth = path_.size(); depth-- > 0;) {
+        Node const *node = tree_->pageManager_->load_page(path_[depth].loc);
+        if (path_[depth].idx + 1 < node->length) {
+          path_[depth].idx += 1;
+          return;
+        }
+        // We've passed this node's last child, so move to its right
+        // neighbor, and the parent on to its next child too.
+        assert(node->next != kNullPage);
+        path_[depth] = PathEntry{node->next, 0};
+      }
+    }
+
+    // Moves to the last row of the previous leaf, keeping the path in step.
+    void _prev_leaf() {
+      loc_.first = tree_->_prev_node(loc_.first);
+      loc_.second = loc_.first->length - 1;
+      for (size_t depth = path_.size(); depth-- > 0;) {
+        if (path_[depth].idx > 0) {
+          path_[depth].idx -= 1;
+          return;
+        }
+        Node const *node = tree_->pageManager_->load_page(path_[depth].loc);
+        assert(node->prev != kNullPage);
+        Node const *prev = tree_->pageManager_->load_page(node->prev);
+        path_[depth] = PathEntry{prev->self, uint16_t(prev->length - 1)};
+      }
+    }
+
+    // The internal nodes above the current leaf, root first, and which of
+    // each one's children we're under.
+    struct PathEntry {
+      PageLoc loc;
+      uint16_t idx;
+    };
+
     Row low_, high_;
     std::shared_ptr<SkipTree> tree_;
     std::pair<Node const *, uint16_t> loc_;
+    std::vector<PathEntry> path_;
+  };
+
+  /**
+   * The iterator of a concurrent tree. It never holds a pointer into a page:
+   * it keeps a copy of the current leaf and, before each step, checks that
+   * the leaf's version hasn't moved since the copy was made. If it has, it
+   * finds its place again from the root. Every row it returns was in the
+   * tree at some point during the step that returned it.
+   *
+   * It only goes forwards.
+   */
+  struct OptimisticIterator : public IteratorInterface<Row> {
+    OptimisticIterator(std::shared_ptr<SkipTree> tree, Row low, Row high)
+    : low_(low), high_(high), tree_(tree), idx_(0), done_(true) {
+      this->skip_to(low_);
+    }
+    Row skip_to(Row val) override {
+      if (val < low_) {
+        val = low_;
+      }
+      ReadGuard guard(tree_.get());
+      const bool haveLeaf = !done_ && this->_fresh() && !(val < leaf_.value.leaf.rows[0]);
+      idx_ = tree_->_optimistic_lower_bound(val, false, &leaf_, &version_, haveLeaf);
+      return this->_update_current_value();
+    }
+    Row next() override {
+      if (done_) {
+        return this->currentValue = Row::largest();
+      }
+      ReadGuard guard(tree_.get());
+      const bool fresh = this->_fresh();
+      if (fresh && idx_ + 1 < leaf_.length) {
+        ++idx_;
+      } else {
+        const Row cur = leaf_.value.leaf.rows[idx_];
+        idx_ = tree_->_optimistic_lower_bound(cur, true, &leaf_, &version_, fresh);
+      }
+      return this->_update_current_value();
+    }
+
+    // Whether our copy of the leaf is still what's in the tree.
+    bool _fresh() const {
+      return tree_->_latch(leaf_.self).validate(version_);
+    }
+    Row _update_current_value() {
+      done_ = idx_ >= leaf_.length || !(leaf_.value.leaf.rows[idx_] < high_);
+      this->currentValue = done_ ? Row::largest() : leaf_.value.leaf.rows[idx_];
+      return this->currentValue;
+    }
+
+    Row low_, high_;
+    std::shared_ptr<SkipTree> tree_;
+    Node leaf_;
+    uint64_t version_;
+    size_t idx_;
+    bool done_;
   };
 
   static std::shared_ptr<IteratorInterface<Row>> iterator(std::shared_ptr<SkipTree> tree) {
-    return std::make_shared<Iterator>(tree, Row::smallest(), Row::largest());
+    return iterator(tree, Row::smallest(), Row::largest());
   }
 
   static std::shared_ptr<IteratorInterface<Row>> iterator(std::shared_ptr<SkipTree> tree, Row low, Row high) {
-    return std::make_shared<Iterator>(tree, low, high);
+    if constexpr (kConcurrent) {
+      return std::make_shared<OptimisticIterator>(tree, low, high);
+    } else {
+      return std::make_shared<Iterator>(tree, low, high);
+    }
   }
 
+  /**
+   * Builds a tree bottom-up from rows given in strictly increasing order,
+   * which is much cheaper than inserting them one at a time: nothing is
+   * searched or split, each page is written once, and the leaves are
+   * allocated in order.
+   *
+   * Nodes are filled to `fillFactor` of their capacity, but always keep room
+   * for one more row (a full node would have to be split by the next insert).
+   *
+   *   SkipTree<Row>::BulkLoader loader(pageManager);
+   *   for (const Row& row : sortedRows) {
+   *     loader.add(row);
+   *   }
+   *   SkipTree<Row> tree(pageManager, loader.finish());
+   */
+  struct BulkLoader {
+    BulkLoader(std::shared_ptr<PageManager<Node>> pageManager, double fillFactor = 1.0)
+    : pageManager_(pageManager), numRows_(0) {
+      if (!(fillFactor > 0.0 && fillFactor <= 1.0)) {
+        throw std::invalid_argument("fillFactor must be in (0, 1]");
+      }
+      leafTarget_ = std::clamp<int>(kLeafSize * fillFactor, kMinLeafSize, kLeafSize - 1);
+      nodeTarget_ = std::clamp<int>(kNodeSize * fillFactor, kMinNodeSize, kNodeSize - 1);
+    }
+
+    void add(const Row& row) {
+      assert(numRows_ == 0 || last_ < row);
+      last_ = row;
+      numRows_ += 1;
+      pageManager_->reclaim();
+      this->_append(0, row, kNullPage, 1);
+    }
+
+    /**
+     * Finishes the last node of each level and returns the root.
+     *
+     * If `rootLoc` is given, it must be the (empty) root of an existing tree,
+     * and the new root is moved there. This is for trees whose root has to
+     * stay put.
+     */
+    PageLoc finish(PageLoc rootLoc = kNullPage) {
+      if (numRows_ == 0) {
+        return rootLoc != kNullPage ? rootLoc : _create_node(pageManager_.get(), 0)->self;
+      }
+
+      PageLoc root = kNullPage;
+      for (size_t depth = 0; depth < levels_.size(); ++depth) {
+        // _append may add a level, so don't hold on to levels_[depth].
+        const PageLoc prev = levels_[depth].prev;
+        const PageLoc cur = levels_[depth].cur;
+        if (prev == kNullPage) {
+          assert(depth + 1 == levels_.size());
+          root = cur;
+          break;
+        }
+        const bool keep = this->_fix_last_node(prev, cur);
+        if constexpr (kCountRows) {
+          // prev is the last child of the node being filled above, and may
+          // have gained or lost rows.
+          Node *parent = pageManager_->load_and_modify_page(levels_[depth + 1].cur);
+          _set_count(parent, parent->length - 1, pageManager_->load_page(prev));
+        }
+        if (keep) {
+          Node const *node = pageManager_->load_page(cur);
+          this->_append(depth + 1, *node->get_row(0), cur, _count_if_counted(node));
+        }
+      }
+
+      // The last level may hold a single child, which can't be a root.
+      Node const *kRoot = pageManager_->load_page(root);
+      while (!kRoot->is_leaf() && kRoot->length == 1) {
+        const PageLoc child = kRoot->value.internal.children[0];
+        pageManager_->delete_page(root);
+        root = child;
+        kRoot = pageManager_->load_page(root);
+      }
+
+      if (rootLoc != kNullPage) {
+        Node *dest = pageManager_->load_and_modify_page(rootLoc);
+        assert(dest->is_leaf() && dest->length == 0);
+        Node const *source = pageManager_->load_page(root);
+        std::memcpy(dest, source, sizeof(Node));
+        dest->self = rootLoc;
+        pageManager_->delete_page(root);
+        root = rootLoc;
+      }
+      levels_.clear();
+      numRows_ = 0;
+      return root;
+    }
+
+    // The node being filled at each depth, and the one before it (which is
+    // already in its parent).
+    struct Level {
+      PageLoc prev;
+      PageLoc cur;
+    };
+
+    // Appends a row (and, above the leaves, the child it's the minimum of and
+    // how many rows are under that child) to the node being filled at
+    // `depth`, starting a new node if that one has reached its target.
+    void _append(size_t depth, const Row& row, PageLoc child, RowCount count) {
+      if (depth == levels_.size()) {
+        levels_.push_back(Level{kNullPage, _create_node(pageManager_.get(), depth)->self});
+      }
+      const int target = (depth == 0 ? leafTarget_ : nodeTarget_);
+      Node *node = pageManager_->load_and_modify_page(levels_[depth].cur);
+      if (node->length >= target) {
+        Node *next = _create_node(pageManager_.get(), depth);
+        node = pageManager_->load_and_modify_page(levels_[depth].cur);
+        node->next = next->self;
+        next->prev = node->self;
+        const Row min = *node->get_row(0);
+        levels_[depth].prev = node->self;
+        levels_[depth].cur = next->self;
+        this->_append(depth + 1, min, node->self, _count_if_counted(node));
+        node = pageManager_->load_and_modify_page(levels_[depth].cur);
+      }
+      if (node->is_leaf()) {
+        node->value.leaf.rows[node->length] = row;
+      } else {
+        node->value.internal.rows[node->length] = row;
+        node->value.internal.children[node->length] = child;
+        if constexpr (kCountRows) {
+          node->value.internal.counts[node->length] = count;
+        }
+      }
+      node->length += 1;
+    }
+
+    static RowCount _count_if_counted(Node const *node) {
+      if constexpr (kCountRows) {
+        return _count(node);
+      }
+      return 0;
+    }
+
+    // The last node of a level may be too small, in which case we merge it
+    // into the node before it or even the two out. Returns false if it was
+    // merged away.
+    bool _fix_last_node(PageLoc prevLoc, PageLoc curLoc) {
+      Node *prev = pageManager_->load_and_modify_page(prevLoc);
+      Node *cur = pageManager_->load_and_modify_page(curLoc);
+      const bool isLeaf = cur->is_leaf();
+      // cur is the rightmost node, so it doesn't have to be this big, but it
+      // keeps the tree dense.
+      if (cur->length >= (isLeaf ? kMinLeafSize : kMinNodeSize)) {
+        return true;
+      }
+      const size_t capacity = isLeaf ? kLeafSize : kNodeSize;
+      const size_t total = prev->length + cur->length;
+      Row *prevRows = isLeaf ? prev->value.leaf.rows : prev->value.internal.rows;
+      Row *curRows = isLeaf ? cur->value.leaf.rows : cur->value.internal.rows;
+
+      if (total < capacity) {
+        std::memcpy(prevRows + prev->length, curRows, sizeof(Row) * cur->length);
+        if (!isLeaf) {
+          std::memcpy(prev->value.internal.children + prev->length, cur->value.internal.children, sizeof(PageLoc) * cur->length);
+          if constexpr (kCountRows) {
+            std::memcpy(prev->value.internal.counts + prev->length, cur->value.internal.counts, sizeof(RowCount) * cur->length);
+          }
+        }
+        prev->length = total;
+        prev->next = kNullPage;
+        pageManager_->delete_page(curLoc);
+        return false;
+      }
+
+      // Both halves get at least capacity / 2 rows, which is enough.
+      const size_t delta = total / 2 - cur->length;
+      const size_t from = prev->length - delta;
+      std::memmove(curRows + delta, curRows, sizeof(Row) * cur->length);
+      std::memcpy(curRows, prevRows + from, sizeof(Row) * delta);
+      std::fill_n(prevRows + from, delta, Row::largest());
+      if (!isLeaf) {
+        PageLoc *prevChildren = prev->value.internal.children;
+        PageLoc *curChildren = cur->value.internal.children;
+        std::memmove(curChildren + delta, curChildren, sizeof(PageLoc) * cur->length);
+        std::memcpy(curChildren, prevChildren + from, sizeof(PageLoc) * delta);
+        std::fill_n(prevChildren + from, delta, kNullPage);
+        if constexpr (kCountRows) {
+          RowCount *prevCounts = prev->value.internal.counts;
+          RowCount *curCounts = cur->value.internal.counts;
+          std::memmove(curCounts + delta, curCounts, sizeof(RowCount) * cur->length);
+          std::memcpy(curCounts, prevCounts + from, sizeof(RowCount) * delta);
+          std::fill_n(prevCounts + from, delta, 0);
+        }
+      }
+      prev->length -= delta;
+      cur->length += delta;
+      return true;
+    }
+
+    std::shared_ptr<PageManager<Node>> pageManager_;
+    int leafTarget_;
+    int nodeTarget_;
+    std::vector<Level> levels_;  // indexed by depth
+    uint64_t numRows_;
+    Row last_;
+  };
+
   void commit() {
     pageManager_->commit();
   }
 
+  bool empty() {
+    return pageManager_->load_page(rootLoc_)->length == 0;
+  }
+
+  // Rewrites every page reference in the tree (children, next and prev
+  // pointers, and the root) according to `moves`, which maps old locations to new ones.
+  // The pages themselves haven't moved yet: we walk the tree at the old
+  // locations, so call this before PageManager::move_page.
+  void _remap_pages(const std::unordered_map<PageLoc, PageLoc>& moves) {
+    auto remap = [&moves](PageLoc loc) {
+      auto it = moves.find(loc);
+      return it == moves.end() ? loc : it->second;
+    };
+    std::vector<PageLoc> level = {rootLoc_};
+    while (!level.empty()) {
+      std::vector<PageLoc> nextLevel;
+      for (PageLoc loc : level) {
+        pageManager_->reclaim();
+        Node const *knode = pageManager_->load_page(loc);
+        bool changed = (remap(knode->self) != knode->self)
+          || (knode->next != kNullPage && remap(knode->next) != knode->next)
+          || (knode->prev != kNullPage && remap(knode->prev) != knode->prev);
+        if (!knode->is_leaf()) {
+          for (size_t i = 0; i < knode->length; ++i) {
+            nextLevel.push_back(knode->value.internal.children[i]);
+            changed |= (remap(knode->value.internal.children[i]) != knode->value.internal.children[i]);
+          }
+        }
+        if (!changed) {
+          continue;
+        }
+        Node *node = pageManager_->load_and_modify_page(loc);
+        node->self = remap(node->self);
+        if (node->next != kNullPage) {
+          node->next = remap(node->next);
+        }
+        if (node->prev != kNullPage) {
+          node->prev = remap(node->prev);
+        }
+        if (!node->is_leaf()) {
+          for (size_t i = 0; i < node->length; ++i) {
+            node->value.internal.children[i] = remap(node->value.internal.children[i]);
+          }
+        }
+      }
+      level.swap(nextLevel);
+    }
+    rootLoc_ = remap(rootLoc_);
+    rightSpine_.clear();
+  }
+
   void flush() {
     pageManager_->flush();
   }
 
-  Node *_create_node(PageLoc parent, uint8_t depth) {
+  Node *_create_node([[maybe_unused]] PageLoc parent, uint8_t depth) {
+    return _create_node(pageManager_.get(), depth);
+  }
+
+  static Node *_create_node(PageManager<Node> *pageManager, uint8_t depth) {
     PageLoc loc;
-    Node *node = pageManager_->new_page(&loc);
+    Node *node = pageManager->new_page(&loc);
     node->depth = depth;
     node->self = loc;
     node->next = kNullPage;
+    node->prev = kNullPage;
     node->length = 0;
+    // Don't write whatever the page held before to disk.
+    std::memset(node->value.bytes, 0, kValueBytes);
     if (depth == 0) {
       std::fill_n(node->value.leaf.rows, kLeafSize, Row::smallest());
     } else {
@@ -823,6 +2276,11 @@ struct SkipTree {
 
   PageLoc rootLoc_;
   std::shared_ptr<PageManager<Node>> pageManager_;
+  // The rightmost node at each depth, root first, or empty if it needs to be
+  // worked out again (see _append).
+  std::vector<PageLoc> rightSpine_;
+  // Only for concurrent trees.
+  std::unique_ptr<Latches> latches_;
 };
 
 }  // namespace cpot
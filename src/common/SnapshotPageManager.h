@@ -0,0 +1,303 @@
+#ifndef SNAPSHOT_PAGE_MANAGER_H
+#define SNAPSHOT_PAGE_MANAGER_H
+
+#include "PageManager.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cpot {
+
+/**
+ * Wraps a PageManager so that readers can open snapshots of it: read-only
+ * PageManagers that keep showing every page as it was when they were opened,
+ * however the pages change afterwards. A tree built on a snapshot (with the
+ * root the tree had then) is a consistent copy of the tree that costs almost
+ * nothing to make, and that writers don't have to wait for.
+ *
+ * While any snapshot is open, the first load_and_modify_page() or
+ * delete_page() of a page since the newest snapshot was opened copies the
+ * page's old contents aside first. The copies belong to that snapshot.
+ * Snapshots read a page from the copies of their own and newer snapshots
+ * (the oldest copy that's at least as new as they are), or from the
+ * underlying manager if the page hasn't changed. When a snapshot closes, its
+ * copies pass to the next older snapshot, or are freed if there isn't one
+ * (or it has its own). Pages created since the newest snapshot opened can't
+ * be seen by any snapshot, so they're never copied.
+ *
+ * Pages are copied rather than moved so that every page keeps its PageLoc,
+ * and the trees don't have to rewrite their parents and neighbors (and
+ * theirs) to make room for a new version.
+ *
+ * Copies live on the heap, so a snapshot costs a page of memory for each page
+ * that changes while it's open. Unlike the managers it wraps, it expects one
+ * thread at a time (snapshots included).
+ */
+template<class Page>
+struct SnapshotPageManager : public PageManager<Page> {
+  SnapshotPageManager(std::shared_ptr<PageManager<Page>> base) : base_(base), nextVersion_(0) {}
+
+  /**
+   * A snapshot. Reads through it copy each page they load (unless it's
+   * already a copy), since the underlying page may change while the reader
+   * still holds it; the copies last until reclaim() unless they're pinned.
+   * Anything that would change a page throws.
+   */
+  struct Snapshot : public PageManager<Page> {
+    Snapshot(std::shared_ptr<SnapshotPageManager> manager)
+    : manager_(manager), version_(manager->_open()) {}
+    ~Snapshot() override {
+      manager_->_close(version_);
+    }
+
+    Page const *load_page(PageLoc loc) override {
+      Page const *old = manager_->_old_page(version_, loc);
+      if (old != nullptr) {
+        return old;
+      }
+      auto it = copies_.find(loc);
+      if (it == copies_.end()) {
+        it = copies_.insert(std::make_pair(loc, Copy{std::make_unique<Page>(), 0})).first;
+        std::memcpy(static_cast<void *>(it->second.page.get()), manager_->base_->load_page(loc), sizeof(Page));
+      }
+      return it->second.page.get();
+    }
+    Page *load_and_modify_page(PageLoc) override {
+      throw std::runtime_error("snapshots are read-only");
+    }
+    void delete_page(PageLoc) override {
+      throw std::runtime_error("snapshots are read-only");
+    }
+    Page *new_page(PageLoc * = nullptr) override {
+      throw std::runtime_error("snapshots are read-only");
+    }
+    void commit() override {}
+    void flush() override {
+      this->reclaim();
+    }
+    uint64_t currentMemoryUsed() const override {
+      return copies_.size() * sizeof(Page);
+    }
+    bool empty() const override {
+      return manager_->empty();
+    }
+    void pin(PageLoc loc) override {
+      this->load_page(loc);
+      auto it = copies_.find(loc);
+      if (it != copies_.end()) {
+        it->second.pins += 1;
+      }
+    }
+    void unpin(PageLoc loc) override {
+      auto it = copies_.find(loc);
+      if (it != copies_.end() && it->second.pins > 0) {
+        it->second.pins -= 1;
+      }
+    }
+    void reclaim() override {
+      for (auto it = copies_.begin(); it != copies_.end();) {
+        it = (it->second.pins == 0) ? copies_.erase(it) : std::next(it);
+      }
+      manager_->base_->reclaim();
+    }
+    void prefetch(PageLoc loc) override {
+      manager_->base_->prefetch(loc);
+    }
+    void load_pages(PageLoc const *locs, size_t n) override {
+      manager_->base_->load_pages(locs, n);
+    }
+
+    // A private copy of a page that hasn't changed since we opened (yet).
+    struct Copy {
+      std::unique_ptr<Page> page;
+      uint32_t pins;
+    };
+
+    std::shared_ptr<SnapshotPageManager> manager_;
+    uint64_t version_;
+    std::unordered_map<PageLoc, Copy> copies_;
+  };
+
+  Page const *load_page(PageLoc loc) override {
+    return base_->load_page(loc);
+  }
+  Page *load_and_modify_page(PageLoc loc) override {
+    this->_save(loc);
+    return base_->load_and_modify_page(loc);
+  }
+  void delete_page(PageLoc loc) override {
+    this->_save(loc);
+    base_->delete_page(loc);
+  }
+  Page *new_page(PageLoc *location = nullptr) override {
+    PageLoc loc;
+    Page *page = base_->new_page(&loc);
+    if (!versions_.empty()) {
+      created_.insert(loc);
+    }
+    if (location != nullptr) {
+      *location = loc;
+    }
+    return page;
+  }
+  void commit() override {
+    base_->commit();
+  }
+  void flush() override {
+    base_->flush();
+  }
+  uint64_t currentMemoryUsed() const override {
+    return base_->currentMemoryUsed();
+  }
+  bool empty() const override {
+    return base_->empty();
+  }
+  void pin(PageLoc loc) override {
+    base_->pin(loc);
+  }
+  void unpin(PageLoc loc) override {
+    base_->unpin(loc);
+  }
+  void reclaim() override {
+    base_->reclaim();
+  }
+  void prefetch(PageLoc loc) override {
+    base_->prefetch(loc);
+  }
+  void load_pages(PageLoc const *locs, size_t n) override {
+    base_->load_pages(locs, n);
+  }
+  void set_hold_dirty_pages(bool hold) override {
+    base_->set_hold_dirty_pages(hold);
+  }
+  void set_dirty_watermarks(uint64_t lowWatermark, uint64_t highWatermark) override {
+    base_->set_dirty_watermarks(lowWatermark, highWatermark);
+  }
+  void sync() override {
+    base_->sync();
+  }
+  void write_journal() override {
+    base_->write_journal();
+  }
+  bool apply_journal() override {
+    return base_->apply_journal();
+  }
+  void clear_journal() override {
+    base_->clear_journal();
+  }
+  // Moving pages would move them out from under the snapshots.
+  std::vector<std::pair<PageLoc, PageLoc>> plan_compaction() override {
+    if (!versions_.empty()) {
+      throw std::runtime_error("cannot compact while snapshots are open");
+    }
+    return base_->plan_compaction();
+  }
+  void move_page(PageLoc from, PageLoc to) override {
+    if (!versions_.empty()) {
+      throw std::runtime_error("cannot compact while snapshots are open");
+    }
+    base_->move_page(from, to);
+  }
+  void truncate() override {
+    base_->truncate();
+  }
+
+  // How many snapshots are open.
+  size_t num_snapshots() const {
+    size_t n = 0;
+    for (const auto& it : versions_) {
+      n += it.second.snapshots;
+    }
+    return n;
+  }
+  // How much memory the copies kept for snapshots take.
+  uint64_t snapshot_memory_used() const {
+    uint64_t n = 0;
+    for (const auto& it : versions_) {
+      n += it.second.oldPages.size() * sizeof(Page);
+    }
+    return n;
+  }
+
+  // Everything snapshots opened since the last change share.
+  struct Version {
+    size_t snapshots;
+    // What pages that changed after this version (and before the next one)
+    // looked like before they changed.
+    std::unordered_map<PageLoc, std::unique_ptr<Page>> oldPages;
+  };
+
+  uint64_t _open() {
+    // Nothing has changed since the newest version was opened, so share it.
+    if (!versions_.empty() && created_.empty() && versions_.rbegin()->second.oldPages.empty()) {
+      versions_.rbegin()->second.snapshots += 1;
+      return versions_.rbegin()->first;
+    }
+    const uint64_t version = nextVersion_++;
+    versions_[version].snapshots = 1;
+    created_.clear();
+    return version;
+  }
+
+  void _close(uint64_t version) {
+    auto it = versions_.find(version);
+    assert(it != versions_.end());
+    if (--it->second.snapshots > 0) {
+      return;
+    }
+    const bool newest = (std::next(it) == versions_.end());
+    if (it != versions_.begin()) {
+      // Older snapshots still need what these pages looked like, unless
+      // they have older copies of their own.
+      Version& older = std::prev(it)->second;
+      for (auto& oldPage : it->second.oldPages) {
+        older.oldPages.insert(std::make_pair(oldPage.first, std::move(oldPage.second)));
+      }
+    }
+    versions_.erase(it);
+    if (newest) {
+      // We don't know which of these the (new) newest version can see.
+      created_.clear();
+    }
+  }
+
+  // What loc looked like when `version` was opened, or null if it hasn't
+  // changed since.
+  Page const *_old_page(uint64_t version, PageLoc loc) const {
+    for (auto it = versions_.find(version); it != versions_.end(); ++it) {
+      auto oldPage = it->second.oldPages.find(loc);
+      if (oldPage != it->second.oldPages.end()) {
+        return oldPage->second.get();
+      }
+    }
+    return nullptr;
+  }
+
+  // Copies loc aside before it changes, if the newest snapshot can still
+  // see it as it is.
+  void _save(PageLoc loc) {
+    if (versions_.empty() || created_.count(loc) > 0) {
+      return;
+    }
+    Version& newest = versions_.rbegin()->second;
+    if (newest.oldPages.count(loc) > 0) {
+      return;
+    }
+    std::unique_ptr<Page> page = std::make_unique<Page>();
+    std::memcpy(static_cast<void *>(page.get()), base_->load_page(loc), sizeof(Page));
+    newest.oldPages.insert(std::make_pair(loc, std::move(page)));
+  }
+
+  std::shared_ptr<PageManager<Page>> base_;
+  std::map<uint64_t, Version> versions_;  // of the open snapshots, oldest first
+  std::unordered_set<PageLoc> created_;  // pages new since the newest version
+  uint64_t nextVersion_;
+};
+
+}  // namespace cpot
+
+#endif  // SNAPSHOT_PAGE_MANAGER_H
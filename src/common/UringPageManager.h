@@ -0,0 +1,154 @@
+#ifndef URING_PAGE_MANAGER_H
+#define URING_PAGE_MANAGER_H
+
+#include "DiskPageManager.h"
+#include "IoUring.h"
+
+namespace cpot {
+
+/**
+ * A DiskPageManager that serves load_pages() with io_uring: every missing
+ * page gets its own read, they're all submitted with one system call, and we
+ * wait for them together. A query that needs one page from each of k trees
+ * then waits for roughly one disk round trip instead of k.
+ *
+ * Everything else (single-page loads, writes, eviction) is DiskPageManager's.
+ * If io_uring isn't available (not Linux, an old kernel, or a sandbox that
+ * blocks it) load_pages falls back to DiskPageManager's.
+ */
+template<class Page>
+struct UringPageManager : public DiskPageManager<Page> {
+  UringPageManager(const std::string& filename, uint64_t maxMemory = 0, uint64_t format = 0, unsigned queueDepth = 64)
+  : DiskPageManager<Page>(filename, maxMemory, format), ring_(queueDepth) {}
+
+  void load_pages(PageLoc const *locs, size_t n) override {
+    // Under the lock: another thread's _wait() may be closing the ring.
+    bool usable;
+    {
+      std::lock_guard<std::mutex> lock(ringMutex_);
+      usable = ring_.ok();
+    }
+    if (!usable) {
+      DiskPageManager<Page>::load_pages(locs, n);
+      return;
+    }
+
+    // Claim every missing page. Pages that another thread is reading in (or
+    // that are listed twice) we'll wait for at the end.
+    std::vector<PageLoc> claimed;
+    std::vector<PageLoc> others;
+    for (size_t i = 0; i < n; ++i) {
+      const PageLoc loc = locs[i];
+      assert(loc < this->numPages_);
+      MemoryBlock<Page> *block = this->_slot(loc).load(std::memory_order_acquire);
+      if (block != nullptr) {
+        block->isReferenced = true;
+      } else if (this->_claim(loc)) {
+        claimed.push_back(loc);
+      } else {
+        others.push_back(loc);
+      }
+    }
+    std::vector<MemoryBlock<Page> *> blocks;
+    {
+      std::lock_guard<std::mutex> lock(this->poolMutex_);
+      for (PageLoc loc : claimed) {
+        blocks.push_back(this->_new_block(loc));
+      }
+    }
+
+    // Queue a read into each frame. The ring is ours alone until they're in.
+    IOStats stats;
+    std::vector<bool> done(blocks.size(), false);
+    {
+      std::lock_guard<std::mutex> lock(ringMutex_);
+      unsigned inFlight = 0;
+      bool ringWorks = ring_.ok();
+      for (size_t i = 0; i < blocks.size() && ringWorks; ++i) {
+        if (inFlight == ring_.capacity()) {
+          ringWorks = this->_wait(&inFlight, &done, &stats);
+        }
+        if (ringWorks && ring_.prep_read(this->fd_, &blocks[i]->data, sizeof(Page), off_t(blocks[i]->location) * sizeof(Page), i)) {
+          ++inFlight;
+        }
+      }
+      if (ringWorks && inFlight > 0) {
+        this->_wait(&inFlight, &done, &stats);
+      }
+    }
+
+    // Whatever io_uring didn't read (or read short) we read the slow way.
+    try {
+      for (size_t i = 0; i < blocks.size(); ++i) {
+        if (!done[i]) {
+          struct iovec iov = {&blocks[i]->data, sizeof(Page)};
+          stats.syscalls += this->_vector_io(preadv, "read", &iov, 1, off_t(blocks[i]->location) * sizeof(Page));
+        }
+      }
+    } catch (...) {
+      for (MemoryBlock<Page> *block : blocks) {
+        this->_abandon(block);
+      }
+      throw;
+    }
+    {
+      std::lock_guard<std::mutex> lock(this->poolMutex_);
+      this->totalReadStats_.pages += blocks.size();
+      this->totalReadStats_.bytes += blocks.size() * sizeof(Page);
+      this->totalReadStats_.syscalls += stats.syscalls;
+    }
+    for (MemoryBlock<Page> *block : blocks) {
+      this->_publish(block);
+    }
+    for (PageLoc loc : others) {
+      this->_load_block(loc);
+    }
+  }
+
+  // Submits the queued reads and waits for all of them to finish. Returns
+  // false (and closes the ring) if io_uring stops working.
+  bool _wait(unsigned *inFlight, std::vector<bool> *done, IOStats *stats) {
+    if (!ring_.submit_and_wait(*inFlight)) {
+      // Some of the reads may be with the kernel already, reading into
+      // frames that we're about to read into ourselves (or free), so we
+      // take back the ones it doesn't have and wait for the rest before
+      // closing the ring.
+      *inFlight -= ring_.unqueue();
+      this->_reap(inFlight, done);
+      while (*inFlight > 0) {
+        if (!ring_.wait(1) && errno != EAGAIN && errno != EBUSY) {
+          // We can't tell when the kernel is done with these frames, so
+          // they stay claimed (and the ring stays open) for good.
+          throw std::runtime_error("cannot wait for io_uring reads of " + this->filename_);
+        }
+        this->_reap(inFlight, done);
+      }
+      ring_._close();
+      return false;
+    }
+    stats->syscalls += 1;
+    this->_reap(inFlight, done);
+    return true;
+  }
+
+  // Pops every completion that's ready.
+  void _reap(unsigned *inFlight, std::vector<bool> *done) {
+    uint64_t idx;
+    int32_t result;
+    while (*inFlight > 0 && ring_.reap(&idx, &result)) {
+      (*done)[idx] = (result == int32_t(sizeof(Page)));
+      *inFlight -= 1;
+    }
+  }
+
+  bool uses_io_uring() const {
+    return ring_.ok();
+  }
+
+  IoUring ring_;
+  std::mutex ringMutex_;  // held while reads are queued on ring_
+};
+
+}  // namespace cpot
+
+#endif  // URING_PAGE_MANAGER_H
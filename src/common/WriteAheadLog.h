@@ -0,0 +1,150 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cpot {
+
+/**
+ * An append-only log of fixed-size records.
+ *
+ * append() only buffers the record; sync() writes everything buffered since
+ * the last sync with one write and one fdatasync (group commit), so many
+ * small operations cost a single sequential flush. Each record carries a
+ * checksum, and replay() stops at the first record that's torn or corrupt
+ * (e.g. a write that a crash cut short) and cuts the log there.
+ *
+ * Record must be trivially copyable, and its padding should be zeroed so
+ * checksums are deterministic.
+ */
+template<class Record>
+struct WriteAheadLog {
+  struct Entry {
+    Record record;
+    uint64_t checksum;
+  };
+
+  WriteAheadLog(const std::string& filename) : filename_(filename) {
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("cannot open " + filename);
+    }
+    struct stat st;
+    fstat(fd_, &st);
+    bytesOnDisk_ = st.st_size;
+  }
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+  ~WriteAheadLog() {
+    close(fd_);
+  }
+
+  void append(const Record& record) {
+    buffer_.push_back(Entry{record, checksum(record)});
+  }
+
+  // Makes every appended record durable.
+  void sync() {
+    if (buffer_.empty()) {
+      return;
+    }
+    char const *data = (char const *)buffer_.data();
+    size_t left = buffer_.size() * sizeof(Entry);
+    off_t offset = bytesOnDisk_;
+    while (left > 0) {
+      ssize_t n = pwrite(fd_, data, left, offset);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("cannot write " + filename_);
+      }
+      data += n;
+      offset += n;
+      left -= n;
+    }
+    if (fdatasync(fd_) != 0) {
+      throw std::runtime_error("cannot sync " + filename_);
+    }
+    bytesOnDisk_ = offset;
+    buffer_.clear();
+  }
+
+  // Calls f(record) for every valid record on disk, oldest first, and
+  // drops anything after the last valid one.
+  template<class F>
+  void replay(F f) {
+    std::vector<Entry> entries(kReplayBatch);
+    off_t offset = 0;
+    while (offset + off_t(sizeof(Entry)) <= bytesOnDisk_) {
+      ssize_t n = pread(fd_, entries.data(), entries.size() * sizeof(Entry), offset);
+      if (n < ssize_t(sizeof(Entry))) {
+        break;
+      }
+      size_t i = 0;
+      for (; i < n / sizeof(Entry); ++i) {
+        if (entries[i].checksum != checksum(entries[i].record)) {
+          break;
+        }
+        f(entries[i].record);
+        offset += sizeof(Entry);
+      }
+      if (i < n / sizeof(Entry)) {
+        break;
+      }
+    }
+    if (offset != bytesOnDisk_) {
+      ftruncate(fd_, offset);
+      bytesOnDisk_ = offset;
+    }
+  }
+
+  // Empties the log. Call this once everything in it is reflected in a
+  // durable checkpoint.
+  void reset() {
+    buffer_.clear();
+    if (ftruncate(fd_, 0) != 0 || fdatasync(fd_) != 0) {
+      throw std::runtime_error("cannot truncate " + filename_);
+    }
+    bytesOnDisk_ = 0;
+  }
+
+  // Bytes in the log, including records that haven't been synced yet.
+  uint64_t size() const {
+    return bytesOnDisk_ + buffer_.size() * sizeof(Entry);
+  }
+
+  bool empty() const {
+    return this->size() == 0;
+  }
+
+  // FNV-1a
+  static uint64_t checksum(const Record& record) {
+    unsigned char const *bytes = (unsigned char const *)&record;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(Record); ++i) {
+      h = (h ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return h;
+  }
+
+  static constexpr size_t kReplayBatch = 4096;
+
+  std::string filename_;
+  int fd_;
+  off_t bytesOnDisk_;
+  std::vector<Entry> buffer_;  // appended but not yet synced
+};
+
+}  // namespace cpot
+
+#endif  // WRITE_AHEAD_LOG_H
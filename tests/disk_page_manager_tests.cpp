@@ -0,0 +1,541 @@
+// clang++ tests/disk_page_manager_tests.cpp -I/opt/homebrew/Cellar/googletest/1.14.0/include -std=c++20 -L/opt/homebrew/Cellar/googletest/1.14.0/lib -lgtest
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <thread>
+
+#include "../src/common/DiskPageManager.h"
+#include "../src/common/SkipTree.h"
+#include "../src/UInt64Row.h"
+
+using namespace cpot;
+
+namespace {
+
+void remove_index(const std::string& filename) {
+  std::remove(filename.c_str());
+  std::remove((filename + ".dpm_header").c_str());
+}
+
+template<class Row>
+std::vector<Row> iter2vec(std::shared_ptr<IteratorInterface<Row>> it) {
+  std::vector<Row> r;
+  while (it->currentValue < Row::largest()) {
+    r.push_back(it->currentValue);
+    it->next();
+  }
+  return r;
+}
+
+TEST(DiskPageManagerTests, EvictsDownToBudget) {
+  remove_index("test-index-dpm");
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm", 10 * sizeof(uint64_t));
+  for (uint64_t i = 0; i < 100; ++i) {
+    *manager->new_page() = i;
+    manager->reclaim();
+    ASSERT_LE(manager->currentMemoryUsed(), 10 * sizeof(uint64_t));
+  }
+  // Evicted pages were written back.
+  for (uint64_t i = 0; i < 100; ++i) {
+    ASSERT_EQ(*manager->load_page(i), i);
+    manager->reclaim();
+  }
+}
+
+TEST(DiskPageManagerTests, PinnedPagesStay) {
+  remove_index("test-index-dpm");
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm", 4 * sizeof(uint64_t));
+  PageLoc loc;
+  uint64_t *page = manager->new_page(&loc);
+  *page = 42;
+  manager->pin(loc);
+  for (uint64_t i = 0; i < 100; ++i) {
+    *manager->new_page() = i;
+    manager->reclaim();
+  }
+  ASSERT_EQ(manager->load_page(loc), page);
+  manager->unpin(loc);
+  for (uint64_t i = 0; i < 100; ++i) {
+    manager->load_page(i + 1);
+    manager->reclaim();
+  }
+  ASSERT_EQ(*manager->load_page(loc), 42);
+}
+
+TEST(DiskPageManagerTests, DeletingPinnedPageWaitsForUnpin) {
+  remove_index("test-index-dpm");
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm", 4 * sizeof(uint64_t));
+  PageLoc loc;
+  uint64_t *page = manager->new_page(&loc);
+  *page = 42;
+  manager->pin(loc);
+  manager->delete_page(loc);
+  // Neither the frame nor the page is handed out while the pin is held.
+  for (uint64_t i = 0; i < 100; ++i) {
+    PageLoc other;
+    *manager->new_page(&other) = i;
+    ASSERT_NE(other, loc);
+    manager->reclaim();
+  }
+  ASSERT_EQ(*page, 42);
+  manager->unpin(loc);
+  PageLoc reused;
+  manager->new_page(&reused);
+  ASSERT_EQ(reused, loc);
+}
+
+TEST(DiskPageManagerTests, CommitCoalescesAdjacentPages) {
+  remove_index("test-index-dpm");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+    for (uint64_t i = 0; i < 100; ++i) {
+      *manager->new_page() = i;
+    }
+    manager->commit();
+    ASSERT_EQ(manager->last_commit_stats().pages, 100);
+    ASSERT_EQ(manager->last_commit_stats().bytes, 100 * sizeof(uint64_t));
+    ASSERT_EQ(manager->last_commit_stats().syscalls, 1);
+
+    *manager->load_and_modify_page(50) = 500;
+    *manager->load_and_modify_page(12) = 120;
+    *manager->load_and_modify_page(11) = 110;
+    *manager->load_and_modify_page(10) = 100;
+    manager->commit();
+    ASSERT_EQ(manager->last_commit_stats().pages, 4);
+    ASSERT_EQ(manager->last_commit_stats().syscalls, 2);
+
+    manager->commit();
+    ASSERT_EQ(manager->last_commit_stats().pages, 0);
+    ASSERT_EQ(manager->last_commit_stats().syscalls, 0);
+  }
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  for (uint64_t i = 0; i < 100; ++i) {
+    if (i == 10 || i == 11 || i == 12 || i == 50) {
+      ASSERT_EQ(*manager->load_page(i), i * 10);
+    } else {
+      ASSERT_EQ(*manager->load_page(i), i);
+    }
+  }
+}
+
+TEST(DiskPageManagerTests, ShortReadsThrow) {
+  remove_index("test-index-dpm");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+    for (uint64_t i = 0; i < 10; ++i) {
+      *manager->new_page() = i;
+    }
+  }
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  // Someone cuts the file short behind our back.
+  ASSERT_EQ(truncate("test-index-dpm", 5 * sizeof(uint64_t)), 0);
+  ASSERT_THROW(manager->load_page(8), std::runtime_error);
+  // The failed read doesn't leave the page half-loaded.
+  ASSERT_THROW(manager->load_page(8), std::runtime_error);
+  ASSERT_EQ(*manager->load_page(2), 2);
+}
+
+TEST(DiskPageManagerTests, SequentialReadsUseExtents) {
+  remove_index("test-index-dpm");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+    for (uint64_t i = 0; i < 1000; ++i) {
+      *manager->new_page() = i;
+    }
+  }
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  for (uint64_t i = 0; i < 1000; ++i) {
+    ASSERT_EQ(*manager->load_page(i), i);
+  }
+  ASSERT_EQ(manager->total_read_stats().pages, 1000);
+  ASSERT_LT(manager->total_read_stats().syscalls, 30);
+
+  // Random access only reads what it's asked for.
+  manager->flush();
+  for (uint64_t i = 0; i < 100; ++i) {
+    uint64_t loc = (i * 379) % 1000;
+    ASSERT_EQ(*manager->load_page(loc), loc);
+  }
+  ASSERT_EQ(manager->total_read_stats().pages, 1100);
+
+  // Read-ahead stops at pages that are already cached (and doesn't clobber
+  // their unsaved changes).
+  manager->flush();
+  *manager->load_and_modify_page(503) = 5030;
+  for (uint64_t i = 500; i < 510; ++i) {
+    ASSERT_EQ(*manager->load_page(i), i == 503 ? 5030 : i);
+  }
+}
+
+TEST(DiskPageManagerTests, PrefetchDoesNotCache) {
+  remove_index("test-index-dpm");
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  for (uint64_t i = 0; i < 10; ++i) {
+    *manager->new_page() = i;
+  }
+  manager->flush();
+  manager->prefetch(3);
+  manager->prefetch(100);  // past the end of the file
+  ASSERT_EQ(manager->currentMemoryUsed(), 0);
+  ASSERT_EQ(*manager->load_page(3), 3);
+}
+
+TEST(DiskPageManagerTests, FreeListIsWrittenIncrementally) {
+  remove_index("test-index-dpm");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+    for (uint64_t i = 0; i < 100'000; ++i) {
+      *manager->new_page() = i;
+    }
+    for (PageLoc i = 0; i < 100'000; i += 2) {
+      manager->delete_page(i);
+    }
+    manager->commit();
+    ASSERT_GT(manager->last_free_list_bytes(), 12'500);
+
+    // One more free page only rewrites the block of the bitmap it's in.
+    manager->delete_page(99'999);
+    manager->commit();
+    ASSERT_LE(manager->last_free_list_bytes(), FreePageList::kBlockBytes);
+    manager->commit();
+    ASSERT_EQ(manager->last_free_list_bytes(), 0);
+  }
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  ASSERT_EQ(manager->freePages_.size(), 50'001);
+  std::set<PageLoc> reused;
+  for (size_t i = 0; i < 50'001; ++i) {
+    PageLoc loc;
+    manager->new_page(&loc);
+    ASSERT_TRUE(loc % 2 == 0 || loc == 99'999);
+    reused.insert(loc);
+  }
+  ASSERT_EQ(reused.size(), 50'001);
+  PageLoc loc;
+  manager->new_page(&loc);
+  ASSERT_EQ(loc, 100'000);
+}
+
+TEST(DiskPageManagerTests, ReadsOldFreeListFormat) {
+  remove_index("test-index-dpm");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+    for (uint64_t i = 0; i < 10; ++i) {
+      *manager->new_page() = i;
+    }
+  }
+  // The free list used to be a raw array of PageLocs.
+  std::vector<PageLoc> oldList = {7, 2};
+  FILE *f = fopen("test-index-dpm.dpm_header", "wb");
+  fwrite(oldList.data(), sizeof(PageLoc), oldList.size(), f);
+  fclose(f);
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+    ASSERT_TRUE(manager->freePages_.contains(2));
+    ASSERT_TRUE(manager->freePages_.contains(7));
+    ASSERT_EQ(manager->freePages_.size(), 2);
+    PageLoc loc;
+    manager->new_page(&loc);
+    ASSERT_EQ(loc, 2);
+  }
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  ASSERT_EQ(manager->freePages_.size(), 1);
+  ASSERT_TRUE(manager->freePages_.contains(7));
+}
+
+TEST(DiskPageManagerTests, ChecksFormat) {
+  remove_index("test-index-dpm");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm", 0, 3);
+    *manager->new_page() = 1;
+    manager->commit();
+  }
+  ASSERT_THROW(DiskPageManager<uint64_t>("test-index-dpm", 0, 4), std::runtime_error);
+  ASSERT_THROW(DiskPageManager<uint64_t>("test-index-dpm"), std::runtime_error);
+  {
+    DiskPageManager<uint64_t> manager("test-index-dpm", 0, 3);
+    ASSERT_EQ(*manager.load_page(0), 1);
+  }
+
+  // A bitmap with no format after the old magic number is format 0.
+  const uint64_t oldHeader[2] = {FreePageList::kOldMagic, uint64_t(1) << 5};
+  FILE *f = fopen("test-index-dpm.dpm_header", "wb");
+  fwrite(oldHeader, sizeof(uint64_t), 2, f);
+  fclose(f);
+  ASSERT_THROW(DiskPageManager<uint64_t>("test-index-dpm", 0, 3), std::runtime_error);
+  DiskPageManager<uint64_t> manager("test-index-dpm");
+  ASSERT_EQ(manager.freePages_.format(), 0);
+  ASSERT_TRUE(manager.freePages_.contains(5));
+}
+
+TEST(DiskPageManagerTests, SkipTreeUnderBudget) {
+  typedef SkipTree<UInt64Row>::Node Node;
+  remove_index("test-index-dpm");
+  const uint64_t kBudget = 16 * sizeof(Node);
+  auto manager = std::make_shared<DiskPageManager<Node>>("test-index-dpm", kBudget);
+  auto tree = std::make_shared<SkipTree<UInt64Row>>(manager, kNullPage);
+  std::set<uint64_t> gt;
+  for (uint64_t i = 0; i < 20'000; ++i) {
+    uint64_t x = (i * 7919) % 20'011;
+    gt.insert(x);
+    tree->insert(UInt64Row{x});
+    // Each operation may temporarily pull in one root-to-leaf path.
+    ASSERT_LE(manager->currentMemoryUsed(), kBudget + 8 * sizeof(Node));
+  }
+  ASSERT_EQ(tree->all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+
+  // Interleaved iterators keep their leaves pinned while evicting each
+  // other's.
+  auto evens = SkipTree<UInt64Row>::iterator(tree, UInt64Row{0}, UInt64Row{10'000});
+  auto odds = SkipTree<UInt64Row>::iterator(tree, UInt64Row{10'000}, UInt64Row::largest());
+  std::vector<UInt64Row> a, b;
+  while (evens->currentValue < UInt64Row::largest() || odds->currentValue < UInt64Row::largest()) {
+    if (evens->currentValue < UInt64Row::largest()) {
+      a.push_back(evens->currentValue);
+      evens->next();
+    }
+    if (odds->currentValue < UInt64Row::largest()) {
+      b.push_back(odds->currentValue);
+      odds->next();
+    }
+  }
+  a.insert(a.end(), b.begin(), b.end());
+  ASSERT_EQ(a, std::vector<UInt64Row>(gt.begin(), gt.end()));
+}
+
+TEST(DiskPageManagerTests, WritesBehindPastLowWatermark) {
+  typedef SkipTree<UInt64Row>::Node Node;
+  remove_index("test-index-dpm");
+  const uint64_t kLow = 32 * sizeof(Node);
+  const uint64_t kHigh = 64 * sizeof(Node);
+  std::set<uint64_t> gt;
+  PageLoc rootLoc;
+  {
+    // No budget, so only the background writer writes anything before the
+    // commit.
+    auto manager = std::make_shared<DiskPageManager<Node>>("test-index-dpm");
+    manager->set_dirty_watermarks(kLow, kHigh);
+    auto tree = std::make_shared<SkipTree<UInt64Row>>(manager, kNullPage);
+    for (uint64_t i = 0; i < 50'000; ++i) {
+      uint64_t x = (i * 7919) % 50'021;
+      gt.insert(x);
+      tree->insert(UInt64Row{x});
+      // Past the high watermark, reclaim() waits for the writer. One
+      // operation can dirty a root-to-leaf path (and a split) before that.
+      ASSERT_LE(manager->dirty_bytes(), kHigh + 8 * sizeof(Node));
+    }
+    ASSERT_GT(manager->background_write_stats().pages, 0);
+    manager->commit();
+    ASSERT_LE(manager->last_commit_stats().pages, 72);
+    ASSERT_EQ(manager->dirty_bytes(), 0);
+    ASSERT_EQ(tree->all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+    rootLoc = tree->rootLoc_;
+  }
+  auto manager = std::make_shared<DiskPageManager<Node>>("test-index-dpm");
+  auto tree = std::make_shared<SkipTree<UInt64Row>>(manager, rootLoc);
+  ASSERT_EQ(tree->all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+}
+
+TEST(DiskPageManagerTests, IdlePoolDrainsToLowWatermark) {
+  remove_index("test-index-dpm");
+  const uint64_t kLow = 8 * sizeof(uint64_t);
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  manager->set_dirty_watermarks(kLow, 1000 * sizeof(uint64_t));
+  for (uint64_t i = 0; i < 8; ++i) {
+    *manager->new_page() = i;
+  }
+  // Still at the low watermark, so this hands the writer nothing, but the
+  // pages above are now done with.
+  manager->reclaim();
+  for (uint64_t i = 8; i < 16; ++i) {
+    *manager->new_page() = i;
+  }
+  // No more reclaim()s: crossing the watermark woke the writer, which takes
+  // what it can (only the first 8 pages are done with).
+  for (int i = 0; i < 5000 && manager->dirty_bytes() > kLow; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_LE(manager->dirty_bytes(), kLow);
+  ASSERT_GT(manager->background_write_stats().pages, 0);
+  manager->commit();
+  manager->flush();
+  for (PageLoc i = 0; i < 16; ++i) {
+    ASSERT_EQ(*manager->load_page(i), i);
+  }
+}
+
+TEST(DiskPageManagerTests, FailedBackgroundWritesThrowLater) {
+  const int full = open("/dev/full", O_WRONLY);
+  if (full < 0) {
+    GTEST_SKIP() << "no /dev/full";
+  }
+  remove_index("test-index-dpm");
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  manager->set_dirty_watermarks(4 * sizeof(uint64_t), 1000 * sizeof(uint64_t));
+  // Every write fails until we put the file back.
+  const int file = dup(manager->fd_);
+  dup2(full, manager->fd_);
+  for (uint64_t i = 0; i < 16; ++i) {
+    *manager->new_page() = i;
+  }
+  manager->reclaim();
+  ASSERT_THROW(manager->commit(), std::runtime_error);
+  // The batch's pages are dirty again, so nothing is lost.
+  ASSERT_EQ(manager->dirty_bytes(), 16 * sizeof(uint64_t));
+  dup2(file, manager->fd_);
+  close(file);
+  close(full);
+  manager->commit();
+  manager->flush();
+  for (PageLoc i = 0; i < 16; ++i) {
+    ASSERT_EQ(*manager->load_page(i), i);
+  }
+}
+
+TEST(DiskPageManagerTests, FailedCommitsCanBeRetried) {
+  const int full = open("/dev/full", O_WRONLY);
+  if (full < 0) {
+    GTEST_SKIP() << "no /dev/full";
+  }
+  remove_index("test-index-dpm");
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  // Every write fails until we put the file back.
+  const int file = dup(manager->fd_);
+  dup2(full, manager->fd_);
+  for (uint64_t i = 0; i < 16; ++i) {
+    *manager->new_page() = i;
+  }
+  ASSERT_THROW(manager->commit(), std::runtime_error);
+  ASSERT_EQ(manager->dirty_bytes(), 16 * sizeof(uint64_t));
+  dup2(file, manager->fd_);
+  close(file);
+  close(full);
+  manager->commit();
+  ASSERT_EQ(manager->last_commit_stats().pages, 16);
+  manager->flush();
+  for (PageLoc i = 0; i < 16; ++i) {
+    ASSERT_EQ(*manager->load_page(i), i);
+  }
+}
+
+TEST(DiskPageManagerTests, DestructorSwallowsFailedWrites) {
+  const int full = open("/dev/full", O_WRONLY);
+  if (full < 0) {
+    GTEST_SKIP() << "no /dev/full";
+  }
+  remove_index("test-index-dpm");
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  dup2(full, manager->fd_);
+  close(full);
+  *manager->new_page() = 1;
+  manager.reset();
+}
+
+TEST(DiskPageManagerTests, JournalWithNoFreePages) {
+  remove_index("test-index-dpm");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+    *manager->new_page() = 7;
+    manager->write_journal();
+    manager->flush();
+  }
+  auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-dpm");
+  ASSERT_TRUE(manager->apply_journal());
+  manager->clear_journal();
+  ASSERT_EQ(*manager->load_page(0), 7);
+}
+
+TEST(DiskPageManagerTests, ConcurrentLoadsAndEvictions) {
+  remove_index("test-index-dpm");
+  const uint64_t kPages = 2000;
+  {
+    DiskPageManager<uint64_t> manager("test-index-dpm");
+    for (uint64_t i = 0; i < kPages; ++i) {
+      *manager.new_page() = i;
+    }
+    manager.commit();
+  }
+  // A pool much smaller than the file, so threads keep evicting pages the
+  // others are reading in (and reading back pages the others evicted).
+  DiskPageManager<uint64_t> manager("test-index-dpm", 64 * sizeof(uint64_t));
+  std::atomic<uint64_t> failures(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      for (int i = 0; i < 20'000; ++i) {
+        // Runs of pages, so some reads are extents.
+        const PageLoc loc = (i % 8 == 0) ? rng() % kPages : (i * 7 + t) % kPages;
+        manager.pin(loc);
+        if (*manager.load_page(loc) != loc) {
+          failures++;
+        }
+        manager.reclaim();
+        if (*manager.load_page(loc) != loc) {
+          failures++;
+        }
+        manager.unpin(loc);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(failures, 0);
+  manager.reclaim();
+  ASSERT_LE(manager.currentMemoryUsed(), 64 * sizeof(uint64_t));
+  ASSERT_EQ(manager.total_write_stats().pages, 0);
+}
+
+TEST(DiskPageManagerTests, ConcurrentSkipTreeUnderBudget) {
+  remove_index("test-index-dpm");
+  typedef SkipTree<UInt64Row, 256, false, true> Tree;
+  auto manager = std::make_shared<DiskPageManager<Tree::Node>>("test-index-dpm", 32 * sizeof(Tree::Node));
+  auto tree = std::make_shared<Tree>(manager, kNullPage);
+  const uint64_t kN = 10'000;
+  for (uint64_t i = 0; i < kN; i += 4) {
+    tree->insert(UInt64Row{i});
+  }
+  // The writer evicts (and writes back) pages while readers copy them.
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> failures(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; ++t) {
+    readers.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      while (!stop) {
+        const uint64_t x = rng() % kN;
+        UInt64Row row;
+        const bool found = tree->find(UInt64Row{x}, &row);
+        if ((x % 4 == 0 && !(found && row == UInt64Row{x})) || (x % 2 == 1 && found)) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (int round = 0; round < 3; ++round) {
+    for (uint64_t i = 2; i < kN; i += 4) {
+      ASSERT_TRUE(tree->insert(UInt64Row{i}));
+    }
+    for (uint64_t i = 2; i < kN; i += 4) {
+      ASSERT_TRUE(tree->remove(UInt64Row{i}));
+    }
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(failures, 0);
+  ASSERT_EQ(tree->all().size(), kN / 4);
+}
+
+}  // namespace
+
+int main() {
+  testing::InitGoogleTest();
+  return RUN_ALL_TESTS();
+}
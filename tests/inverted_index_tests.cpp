@@ -0,0 +1,325 @@
+// clang++ tests/inverted_index_tests.cpp -I/opt/homebrew/Cellar/googletest/1.14.0/include -std=c++20 -L/opt/homebrew/Cellar/googletest/1.14.0/lib -lgtest
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <unistd.h>
+
+#include "../src/common/InvertedIndex.h"
+#include "../src/UInt64Row.h"
+
+using namespace cpot;
+
+namespace {
+
+void remove_index(const std::string& filename) {
+  for (std::string suffix : {"", ".header", ".rare"}) {
+    std::remove((filename + suffix).c_str());
+    std::remove((filename + suffix + ".dpm_header").c_str());
+  }
+  std::remove((filename + ".wal").c_str());
+  std::remove((filename + ".ckpt").c_str());
+}
+
+bool exists(const std::string& filename) {
+  return access(filename.c_str(), F_OK) == 0;
+}
+
+template<class Index>
+void fill(Index *index) {
+  for (uint64_t doc = 1; doc <= 10'000; ++doc) {
+    for (uint64_t token = 1; token < 6; ++token) {
+      if (doc % token == 0) {
+        index->insert(token, UInt64Row{doc});
+      }
+    }
+    if (doc % 1000 == 0) {
+      index->insert(100, UInt64Row{doc});
+    }
+  }
+}
+
+template<class Index>
+void check(Index *index) {
+  for (uint64_t token = 1; token < 6; ++token) {
+    ASSERT_EQ(index->count(token), 10'000 / token);
+    std::vector<UInt64Row> rows = index->all(token);
+    ASSERT_EQ(rows.size(), 10'000 / token);
+    ASSERT_EQ(rows[0], UInt64Row{token});
+  }
+  ASSERT_EQ(index->all(100).size(), 10);
+}
+
+TEST(InvertedIndexTests, OneFile) {
+  remove_index("test-index-ii");
+  {
+    InvertedIndex<UInt64Row> index("test-index-ii");
+    fill(&index);
+  }
+  ASSERT_TRUE(exists("test-index-ii"));
+  ASSERT_FALSE(exists("test-index-ii.header"));
+  ASSERT_FALSE(exists("test-index-ii.rare"));
+  InvertedIndex<UInt64Row> index("test-index-ii");
+  ASSERT_EQ(index.header->rootLoc_, 0);
+  ASSERT_EQ(index.rareTree->rootLoc_, 1);
+  check(&index);
+}
+
+TEST(InvertedIndexTests, SharedBudget) {
+  remove_index("test-index-ii");
+  const uint64_t kBudget = 64 * sizeof(InvertedIndex<UInt64Row>::Page);
+  InvertedIndex<UInt64Row> index("test-index-ii", Storage::kDisk, kBudget);
+  fill(&index);
+  // One pool for every tree, so the budget covers all of them (plus the
+  // pages one operation can touch before the next reclaim()).
+  ASSERT_LE(index.currentMemoryUsed(), kBudget + 8 * sizeof(InvertedIndex<UInt64Row>::Page));
+  check(&index);
+}
+
+TEST(InvertedIndexTests, RefusesSeparateFiles) {
+  remove_index("test-index-ii");
+  {
+    // How indexes were laid out before they were merged into one file.
+    InvertedIndex<UInt64Row> index(
+      std::make_shared<DiskPageManager<InvertedIndex<UInt64Row>::PostingNode>>("test-index-ii"),
+      std::make_shared<DiskPageManager<InvertedIndex<UInt64Row>::HeaderNode>>("test-index-ii.header"),
+      std::make_shared<DiskPageManager<InvertedIndex<UInt64Row>::RareNode>>("test-index-ii.rare")
+    );
+    fill(&index);
+    index.commit();
+  }
+  ASSERT_THROW(InvertedIndex<UInt64Row>("test-index-ii"), std::runtime_error);
+}
+TEST(InvertedIndexTests, SnapshotOfSeparateFiles) {
+  remove_index("test-index-ii");
+  InvertedIndex<UInt64Row> index(
+    std::make_shared<DiskPageManager<InvertedIndex<UInt64Row>::PostingNode>>("test-index-ii"),
+    std::make_shared<DiskPageManager<InvertedIndex<UInt64Row>::HeaderNode>>("test-index-ii.header"),
+    std::make_shared<DiskPageManager<InvertedIndex<UInt64Row>::RareNode>>("test-index-ii.rare")
+  );
+  for (uint64_t doc = 1; doc <= 10; ++doc) {
+    index.insert(1, UInt64Row{doc});
+  }
+  auto snapshot = index.snapshot();
+  for (uint64_t doc = 11; doc <= 20; ++doc) {
+    index.insert(1, UInt64Row{doc});
+  }
+  ASSERT_EQ(snapshot->count(1), 10);
+  ASSERT_EQ(snapshot->all(1).size(), 10);
+  ASSERT_EQ(index.count(1), 20);
+}
+TEST(InvertedIndexTests, RefusesOtherFormats) {
+  remove_index("test-index-ii");
+  {
+    InvertedIndex<UInt64Row> index("test-index-ii");
+    fill(&index);
+    index.commit();
+  }
+  // The index's pages, read as if they were in some other format.
+  ASSERT_THROW(DiskPageManager<InvertedIndex<UInt64Row>::Page>("test-index-ii", 0, InvertedIndex<UInt64Row>::kFormat + 1), std::runtime_error);
+  InvertedIndex<UInt64Row> index("test-index-ii");
+  check(&index);
+}
+TEST(InvertedIndexTests, RefusesOtherInlineRows) {
+  remove_index("test-index-ii");
+  {
+    InvertedIndex<UInt64Row, 0> index("test-index-ii");
+    fill(&index);
+    index.commit();
+  }
+  ASSERT_THROW(InvertedIndex<UInt64Row>("test-index-ii"), std::runtime_error);
+  InvertedIndex<UInt64Row, 0> index("test-index-ii");
+  check(&index);
+}
+TEST(InvertedIndexTests, InsertBatch) {
+  remove_index("test-index-ii");
+  InvertedIndex<UInt64Row> index("test-index-ii");
+  // The same rows as fill(), a hundred docs at a time.
+  for (uint64_t start = 1; start <= 10'000; start += 100) {
+    for (uint64_t token : {1, 2, 3, 4, 5, 100}) {
+      const uint64_t step = (token == 100 ? 1000 : token);
+      std::vector<UInt64Row> rows;
+      for (uint64_t doc = start; doc < start + 100; ++doc) {
+        if (doc % step == 0) {
+          rows.push_back(UInt64Row{doc});
+        }
+      }
+      index.insert_batch(token, rows.data(), rows.size());
+    }
+  }
+  check(&index);
+}
+
+TEST(InvertedIndexTests, BulkLoad) {
+  remove_index("test-index-ii");
+  {
+    // The same rows as fill(), sorted by token.
+    InvertedIndex<UInt64Row> index("test-index-ii");
+    InvertedIndex<UInt64Row>::BulkLoader loader(&index);
+    for (uint64_t token : {1, 2, 3, 4, 5, 100}) {
+      const uint64_t step = (token == 100 ? 1000 : token);
+      for (uint64_t doc = step; doc <= 10'000; doc += step) {
+        loader.add(token, UInt64Row{doc});
+      }
+    }
+    // Few enough rows to stay in the header.
+    loader.add(200, UInt64Row{7});
+    loader.add(200, UInt64Row{8});
+    loader.finish();
+    check(&index);
+    ASSERT_EQ(index.all(200), std::vector<UInt64Row>({UInt64Row{7}, UInt64Row{8}}));
+    index.insert(100, UInt64Row{10'001});
+    ASSERT_TRUE(index.remove(100, UInt64Row{1000}));
+  }
+  InvertedIndex<UInt64Row> index("test-index-ii");
+  ASSERT_EQ(index.all(100).size(), 10);
+  ASSERT_EQ(index.all(100).back(), UInt64Row{10'001});
+  ASSERT_EQ(index.all(4).size(), 2500);
+}
+
+TEST(InvertedIndexTests, DescendingIntersection) {
+  remove_index("test-index-ii");
+  InvertedIndex<UInt64Row> index("test-index-ii");
+  fill(&index);
+  // Token 100 is rare; the others are common. Token 7 doesn't exist.
+  auto iters = index.reverse_iterators({2, 5, 100}, UInt64Row{8500});
+  IntersectionIterator<Reversed<UInt64Row>> it(iters);
+  std::vector<uint64_t> r;
+  while (it.currentValue < Reversed<UInt64Row>::largest()) {
+    r.push_back(it.currentValue.row.val);
+    it.next();
+  }
+  ASSERT_EQ(r, std::vector<uint64_t>({8000, 7000, 6000, 5000, 4000, 3000, 2000, 1000}));
+
+  iters = index.reverse_iterators({1, 7}, UInt64Row::largest());
+  IntersectionIterator<Reversed<UInt64Row>> none(iters);
+  ASSERT_EQ(none.currentValue, Reversed<UInt64Row>::largest());
+}
+
+TEST(InvertedIndexTests, Iterators) {
+  remove_index("test-index-ii");
+  InvertedIndex<UInt64Row> index("test-index-ii");
+  fill(&index);
+  // Out of order, a token that doesn't exist (7) and one given twice.
+  auto iters = index.iterators({100, 7, 3, 100, 1}, UInt64Row{5000});
+  ASSERT_EQ(iters.size(), 5);
+  ASSERT_EQ(iters[0]->currentValue, UInt64Row{5000});
+  ASSERT_EQ(iters[1]->currentValue, UInt64Row::largest());
+  ASSERT_EQ(iters[2]->currentValue, UInt64Row{5001});
+  ASSERT_EQ(iters[3]->currentValue, UInt64Row{5000});
+  ASSERT_EQ(iters[4]->currentValue, UInt64Row{5000});
+  iters[0]->next();
+  ASSERT_EQ(iters[0]->currentValue, UInt64Row{6000});
+}
+
+TEST(InvertedIndexTests, Snapshot) {
+  remove_index("test-index-ii");
+  // A small budget, so pages come and go while the snapshot is read.
+  InvertedIndex<UInt64Row> index("test-index-ii", Storage::kDisk, 32 * sizeof(InvertedIndex<UInt64Row>::Page));
+  fill(&index);
+  auto snapshot = index.snapshot();
+  auto it = snapshot->iterator(2);
+  std::vector<UInt64Row> rows;
+  for (uint64_t doc = 10'001; it->currentValue < UInt64Row::largest(); ++doc) {
+    rows.push_back(it->currentValue);
+    it->next();
+    // Token 100 moves into a tree of its own, 7 is new and 2 shrinks.
+    index.insert(100, UInt64Row{doc});
+    index.insert(7, UInt64Row{doc});
+    index.remove(2, UInt64Row{doc - 10'000});
+    if (doc % 1000 == 0) {
+      index.flush();
+    }
+  }
+  ASSERT_EQ(rows.size(), 5000);
+  ASSERT_EQ(rows.back(), UInt64Row{10'000});
+  check(snapshot.get());
+  ASSERT_EQ(snapshot->count(7), 0);
+  ASSERT_EQ(index.count(7), 5000);
+  ASSERT_EQ(index.count(100), 5010);
+  ASSERT_THROW(snapshot->insert(1, UInt64Row{1}), std::runtime_error);
+  ASSERT_THROW(index.vacuum(), std::runtime_error);
+
+  it.reset();
+  snapshot.reset();
+  index.vacuum();
+  ASSERT_EQ(index.all(2).size(), 2500);
+}
+
+TEST(InvertedIndexTests, DirtyWatermarks) {
+  typedef InvertedIndex<UInt64Row>::Page Page;
+  remove_index("test-index-ii");
+  {
+    InvertedIndex<UInt64Row> index("test-index-ii");
+    index.set_dirty_watermarks(4 * sizeof(Page), 8 * sizeof(Page));
+    fill(&index);
+    check(&index);
+  }
+  {
+    InvertedIndex<UInt64Row> index("test-index-ii");
+    check(&index);
+  }
+  remove_index("test-index-ii");
+  InvertedIndex<UInt64Row> index("test-index-ii", Storage::kDisk, 0, Durability::kWal);
+  ASSERT_THROW(index.set_dirty_watermarks(4 * sizeof(Page), 8 * sizeof(Page)), std::runtime_error);
+}
+
+TEST(InvertedIndexTests, InlineRows) {
+  typedef InvertedIndex<UInt64Row> Index;
+  static_assert(sizeof(Index::TokenRow) == 24 + 3 * sizeof(UInt64Row));
+  // Without inline rows, header rows are laid out as they always were.
+  static_assert(sizeof(InvertedIndex<UInt64Row, 0>::TokenRow) == 24);
+  remove_index("test-index-ii");
+  {
+    Index index("test-index-ii");
+    // Token t has t rows: 1-3 fit in the header, 4 and up don't.
+    for (uint64_t token = 1; token <= 5; ++token) {
+      for (uint64_t doc = 1; doc <= token; ++doc) {
+        index.insert(token, UInt64Row{doc * 10});
+      }
+    }
+    ASSERT_EQ(index.rareTree->range(Index::RareRow::smallest(), Index::RareRow::largest()).size(), 9);
+    ASSERT_TRUE(index.remove(3, UInt64Row{20}));
+    ASSERT_FALSE(index.remove(3, UInt64Row{20}));
+    ASSERT_FALSE(index.remove(2, UInt64Row{30}));
+  }
+  Index index("test-index-ii");
+  ASSERT_EQ(index.all(1), std::vector<UInt64Row>({UInt64Row{10}}));
+  ASSERT_EQ(index.all(3), std::vector<UInt64Row>({UInt64Row{10}, UInt64Row{30}}));
+  ASSERT_EQ(index.all(5).size(), 5);
+  ASSERT_EQ(index.range(2, UInt64Row{15}, UInt64Row{100}), std::vector<UInt64Row>({UInt64Row{20}}));
+  auto iters = index.iterators({2, 5, 3}, UInt64Row{15});
+  ASSERT_EQ(iters[0]->currentValue, UInt64Row{20});
+  ASSERT_EQ(iters[1]->currentValue, UInt64Row{20});
+  ASSERT_EQ(iters[2]->currentValue, UInt64Row{30});
+  iters[2]->next();
+  ASSERT_EQ(iters[2]->currentValue, UInt64Row::largest());
+  auto reversed = index.reverse_iterators({3}, UInt64Row{25});
+  ASSERT_EQ(reversed[0]->currentValue.row, UInt64Row{10});
+
+  // Outgrowing the header moves the token's rows into the rare tree (even
+  // the ones removed since don't come back).
+  index.insert(3, UInt64Row{40});
+  index.insert(3, UInt64Row{50});
+  ASSERT_EQ(index.all(3), std::vector<UInt64Row>({UInt64Row{10}, UInt64Row{30}, UInt64Row{40}, UInt64Row{50}}));
+  std::vector<UInt64Row> rows = {UInt64Row{5}, UInt64Row{15}};
+  index.insert_batch(1, rows.data(), rows.size());
+  ASSERT_EQ(index.all(1), std::vector<UInt64Row>({UInt64Row{5}, UInt64Row{10}, UInt64Row{15}}));
+  index.insert_batch(2, rows.data(), rows.size());
+  ASSERT_EQ(index.all(2), std::vector<UInt64Row>({UInt64Row{5}, UInt64Row{10}, UInt64Row{15}, UInt64Row{20}}));
+  ASSERT_EQ(index.count(2), 4);
+}
+
+TEST(InvertedIndexTests, BulkLoadNeedsEmptyIndex) {
+  remove_index("test-index-ii");
+  InvertedIndex<UInt64Row> index("test-index-ii");
+  index.insert(1, UInt64Row{1});
+  ASSERT_THROW(InvertedIndex<UInt64Row>::BulkLoader loader(&index), std::runtime_error);
+}
+
+}  // namespace
+
+int main() {
+  testing::InitGoogleTest();
+  return RUN_ALL_TESTS();
+}
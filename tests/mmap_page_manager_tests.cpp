@@ -0,0 +1,105 @@
+// clang++ tests/mmap_page_manager_tests.cpp -I/opt/homebrew/Cellar/googletest/1.14.0/include -std=c++20 -L/opt/homebrew/Cellar/googletest/1.14.0/lib -lgtest
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <set>
+
+#include "../src/common/MmapPageManager.h"
+#include "../src/common/DiskPageManager.h"
+#include "../src/common/SkipTree.h"
+#include "../src/UInt64Row.h"
+
+using namespace cpot;
+
+namespace {
+
+void remove_index(const std::string& filename) {
+  std::remove(filename.c_str());
+  std::remove((filename + ".dpm_header").c_str());
+}
+
+TEST(MmapPageManagerTests, Allocation) {
+  remove_index("test-index-mmap");
+  auto manager = std::make_shared<MmapPageManager<uint64_t>>("test-index-mmap");
+  ASSERT_TRUE(manager->empty());
+  PageLoc loc1, loc2;
+  *manager->new_page(&loc1) = 10;
+  *manager->new_page(&loc2) = 20;
+  ASSERT_EQ(loc1, 0);
+  ASSERT_EQ(loc2, 1);
+  ASSERT_EQ(*manager->load_page(loc1), 10);
+  ASSERT_EQ(*manager->load_page(loc2), 20);
+  ASSERT_FALSE(manager->empty());
+}
+
+TEST(MmapPageManagerTests, PointersSurviveGrowth) {
+  remove_index("test-index-mmap");
+  auto manager = std::make_shared<MmapPageManager<uint64_t>>("test-index-mmap");
+  PageLoc loc;
+  uint64_t *first = manager->new_page(&loc);
+  *first = 7;
+  for (uint64_t i = 1; i < 10'000; ++i) {
+    *manager->new_page() = i;
+  }
+  ASSERT_EQ(first, manager->load_page(loc));
+  ASSERT_EQ(*first, 7);
+}
+
+TEST(MmapPageManagerTests, ReadsDiskPageManagerFiles) {
+  remove_index("test-index-mmap");
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-mmap");
+    for (uint64_t i = 0; i < 100; ++i) {
+      *manager->new_page() = i * i;
+    }
+    manager->delete_page(5);
+  }
+  {
+    auto manager = std::make_shared<MmapPageManager<uint64_t>>("test-index-mmap");
+    for (uint64_t i = 0; i < 100; ++i) {
+      if (i != 5) {
+        ASSERT_EQ(*manager->load_page(i), i * i);
+      }
+    }
+    // The free list is shared too.
+    PageLoc loc;
+    *manager->new_page(&loc) = 1;
+    ASSERT_EQ(loc, 5);
+    *manager->load_and_modify_page(6) = 6;
+  }
+  {
+    auto manager = std::make_shared<DiskPageManager<uint64_t>>("test-index-mmap");
+    ASSERT_EQ(*manager->load_page(5), 1);
+    ASSERT_EQ(*manager->load_page(6), 6);
+    ASSERT_EQ(*manager->load_page(99), 99 * 99);
+  }
+}
+
+TEST(MmapPageManagerTests, SkipTree) {
+  remove_index("test-index-mmap");
+  std::set<uint64_t> gt;
+  PageLoc root;
+  {
+    auto manager = std::make_shared<MmapPageManager<SkipTree<UInt64Row>::Node>>("test-index-mmap");
+    SkipTree<UInt64Row> tree(manager, kNullPage);
+    root = tree.rootLoc_;
+    for (uint64_t i = 0; i < 5'000; ++i) {
+      uint64_t x = (i * 7919) % 10'007;
+      gt.insert(x);
+      tree.insert(UInt64Row{x});
+    }
+  }
+  {
+    auto manager = std::make_shared<MmapPageManager<SkipTree<UInt64Row>::Node>>("test-index-mmap");
+    SkipTree<UInt64Row> tree(manager, root);
+    ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+  }
+}
+
+}  // namespace
+
+int main() {
+  testing::InitGoogleTest();
+  return RUN_ALL_TESTS();
+}
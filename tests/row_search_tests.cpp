@@ -0,0 +1,81 @@
+// clang++ tests/row_search_tests.cpp -I/opt/homebrew/Cellar/googletest/1.14.0/include -std=c++20 -L/opt/homebrew/Cellar/googletest/1.14.0/lib -lgtest
+
+#include "gtest/gtest.h"
+
+#include <random>
+
+#include "../src/common/RowSearch.h"
+#include "../src/common/InvertedIndex.h"
+#include "../src/UInt64Row.h"
+#include "../src/UInt32PairRow.h"
+#include "../src/UInt64KeyValueRow.h"
+
+using namespace cpot;
+
+namespace {
+
+// Checks row_lower_bound against std::lower_bound for every size up to 80
+// and for queries that are and aren't in the array. `make(rng)` returns a
+// random row; small ranges give plenty of ties.
+template<class Row, class F>
+void check(F make) {
+  std::mt19937 rng(0);
+  for (size_t n = 0; n <= 80; ++n) {
+    std::vector<Row> rows;
+    for (size_t i = 0; i < n; ++i) {
+      rows.push_back(make(rng));
+    }
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    std::vector<Row> queries = rows;
+    for (size_t i = 0; i < 20; ++i) {
+      queries.push_back(make(rng));
+    }
+    queries.push_back(Row::smallest());
+    queries.push_back(Row::largest());
+    for (const Row& query : queries) {
+      size_t expected = std::lower_bound(rows.begin(), rows.end(), query) - rows.begin();
+      ASSERT_EQ(row_lower_bound(rows.data(), rows.size(), query), expected) << "n=" << rows.size();
+    }
+  }
+}
+
+TEST(RowSearchTests, UInt64Row) {
+  check<UInt64Row>([](std::mt19937& rng) { return UInt64Row{rng() % 200}; });
+  // Keys with the top bit set, since the x86 kernels compare signed.
+  check<UInt64Row>([](std::mt19937& rng) { return UInt64Row{uint64_t(-1) - rng() % 200}; });
+}
+
+TEST(RowSearchTests, UInt32PairRow) {
+  check<UInt32PairRow>([](std::mt19937& rng) {
+    return UInt32PairRow::make(rng() % 20, rng() % 5);
+  });
+  check<UInt32PairRow>([](std::mt19937& rng) {
+    return UInt32PairRow::make(uint32_t(-1) - rng() % 20, rng() % 5);
+  });
+}
+
+TEST(RowSearchTests, UInt64KeyValueRow) {
+  check<UInt64KeyValueRow>([](std::mt19937& rng) {
+    return UInt64KeyValueRow::make(rng() % 200, rng());
+  });
+}
+
+TEST(RowSearchTests, InvertedIndexRows) {
+  typedef InvertedIndex<UInt64Row>::TokenRow TokenRow;
+  typedef InvertedIndex<UInt64Row>::RareRow RareRow;
+  check<TokenRow>([](std::mt19937& rng) {
+    return TokenRow{rng() % 200, rng(), PageLoc(rng()), {}};
+  });
+  check<RareRow>([](std::mt19937& rng) {
+    return RareRow{rng() % 10, UInt64Row{rng() % 10}};
+  });
+}
+
+}  // namespace
+
+int main() {
+  testing::InitGoogleTest();
+  return RUN_ALL_TESTS();
+}
@@ -2,11 +2,16 @@
 
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <functional>
+#include <random>
 #include <set>
+#include <thread>
 
 #include "../src/common/SkipTree.h"
 #include "../src/common/MemoryPageManager.h"
 #include "../src/common/DiskPageManager.h"
+#include "../src/common/SnapshotPageManager.h"
 #include "../src/UInt64Row.h"
 
 using namespace cpot;
@@ -174,6 +179,652 @@ TEST(SkipTreeTest, ReuseInsert) {
   }
 }
 
+TEST(SkipTreeTest, NodesFillPages) {
+  typedef SkipTree<UInt64Row> Tree;
+  ASSERT_EQ(sizeof(Tree::Node), 4096);
+  // Leaves don't spend any room on children.
+  ASSERT_EQ(Tree::kLeafSize, (4096 - Tree::kHeaderBytes) / sizeof(UInt64Row));
+  ASSERT_GT(Tree::kLeafSize, Tree::kNodeSize);
+  ASSERT_EQ(sizeof(SkipTree<UInt64Row, 8192>::Node), 8192);
+}
+
+TEST(SkipTreeTest, SmallPages) {
+  // Small pages give a deep tree, so this exercises splits, merges and
+  // rebalances at every level.
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  Tree tree(pageManager, kNullPage);
+
+  std::vector<uint64_t> vec;
+  for (uint64_t i = 1; i <= 5000; ++i) {
+    vec.push_back(i);
+  }
+  shuffle(vec.begin(), vec.end());
+  std::set<uint64_t> gt;
+  for (uint64_t x : vec) {
+    gt.insert(x);
+    ASSERT_TRUE(tree.insert(UInt64Row{x}));
+  }
+  ASSERT_GE(pageManager->load_page(tree.rootLoc_)->depth, 2);
+  ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+
+  shuffle(vec.begin(), vec.end());
+  for (size_t i = 0; i < 4000; ++i) {
+    gt.erase(vec[i]);
+    ASSERT_TRUE(tree.remove(UInt64Row{vec[i]}));
+  }
+  ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+}
+
+TEST(SkipTreeTest, BulkLoad) {
+  typedef SkipTree<UInt64Row, 256> Tree;
+  for (double fillFactor : {1.0, 0.7}) {
+    for (uint64_t n : {0, 1, 10, 13, 14, 100, 1000, 5000}) {
+      auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+      Tree::BulkLoader loader(pageManager, fillFactor);
+      std::set<uint64_t> gt;
+      for (uint64_t i = 0; i < n; ++i) {
+        gt.insert(i * 2);
+        loader.add(UInt64Row{i * 2});
+      }
+      Tree tree(pageManager, loader.finish());
+      ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+      if (n <= 10) {
+        ASSERT_EQ(pageManager->pages_.size(), 1);
+      }
+
+      // The tree should be valid, so inserts and removes still work.
+      for (uint64_t i = 0; i < n; ++i) {
+        gt.insert(i * 2 + 1);
+        ASSERT_TRUE(tree.insert(UInt64Row{i * 2 + 1}));
+      }
+      ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+      for (uint64_t i = 0; i < n * 2; i += 3) {
+        gt.erase(i);
+        ASSERT_TRUE(tree.remove(UInt64Row{i}));
+      }
+      ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+    }
+  }
+}
+
+TEST(SkipTreeTest, BulkLoadIsDense) {
+  typedef SkipTree<UInt64Row> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  Tree::BulkLoader loader(pageManager);
+  for (uint64_t i = 0; i < 100'000; ++i) {
+    loader.add(UInt64Row{i});
+  }
+  Tree tree(pageManager, loader.finish());
+  // Leaves are full but for one slot (100'000 / 509 rounds up to 197), plus
+  // one internal node.
+  ASSERT_EQ(pageManager->pages_.size(), 197 + 1);
+  ASSERT_EQ(tree.range(UInt64Row{5000}, UInt64Row{5003}), range(5000, 5003));
+}
+
+TEST(SkipTreeTest, InsertBatch) {
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  Tree tree(pageManager, kNullPage);
+  std::set<uint64_t> gt;
+
+  // One batch straight into an empty leaf root needs several new levels.
+  std::vector<UInt64Row> batch = range(0, 3000);
+  ASSERT_EQ(tree.insert_batch(batch.data(), batch.size()), 3000);
+  for (uint64_t i = 0; i < 3000; ++i) {
+    gt.insert(i);
+  }
+  ASSERT_GE(pageManager->load_page(tree.rootLoc_)->depth, 2);
+  ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+
+  // Random batches, some of them overlapping rows already in the tree.
+  for (size_t round = 0; round < 50; ++round) {
+    std::set<uint64_t> rows;
+    const size_t n = std::rand() % 300;
+    const uint64_t base = std::rand() % 10'000;
+    for (size_t i = 0; i < n; ++i) {
+      rows.insert(base + std::rand() % (n * 4 + 1));
+    }
+    size_t expected = 0;
+    batch.clear();
+    for (uint64_t x : rows) {
+      expected += gt.insert(x).second;
+      batch.push_back(UInt64Row{x});
+    }
+    ASSERT_EQ(tree.insert_batch(batch.data(), batch.size()), expected);
+  }
+  ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+
+  // The tree should still be valid.
+  std::vector<uint64_t> vec(gt.begin(), gt.end());
+  shuffle(vec.begin(), vec.end());
+  for (size_t i = 0; i < vec.size() / 2; ++i) {
+    gt.erase(vec[i]);
+    ASSERT_TRUE(tree.remove(UInt64Row{vec[i]}));
+  }
+  ASSERT_TRUE(tree.insert(UInt64Row{123'456}));
+  gt.insert(123'456);
+  ASSERT_EQ(tree.all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+}
+
+template<class Page>
+struct CountingPageManager : public MemoryPageManager<Page> {
+  Page const *load_page(PageLoc loc) override {
+    ++loads;
+    return MemoryPageManager<Page>::load_page(loc);
+  }
+  uint64_t loads = 0;
+};
+
+TEST(SkipTreeTest, IteratorSkipTo) {
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto pageManager = std::make_shared<CountingPageManager<Tree::Node>>();
+  auto tree = std::make_shared<Tree>(pageManager, kNullPage);
+  std::vector<UInt64Row> rows;
+  for (uint64_t i = 0; i < 20'000; ++i) {
+    rows.push_back(UInt64Row{i * 3});
+  }
+  tree->insert_batch(rows.data(), rows.size());
+  ASSERT_GE(pageManager->load_page(tree->rootLoc_)->depth, 3);
+
+  // Skips of every size, mixed with next(), and the odd step backwards.
+  for (uint64_t maxStep : {2, 20, 200, 20'000}) {
+    auto it = Tree::iterator(tree, UInt64Row{10}, UInt64Row{59'000});
+    uint64_t target = 0;
+    while (it->currentValue < UInt64Row::largest()) {
+      target += std::rand() % maxStep;
+      if (std::rand() % 10 == 0) {
+        target -= std::min<uint64_t>(target, std::rand() % maxStep);
+      }
+      const uint64_t low = std::max<uint64_t>(target, 10);
+      const uint64_t expected = (low + 2) / 3 * 3;
+      UInt64Row r = it->skip_to(UInt64Row{target});
+      if (expected >= 59'000) {
+        ASSERT_EQ(r, UInt64Row::largest());
+        break;
+      }
+      ASSERT_EQ(r, UInt64Row{expected});
+      if (std::rand() % 3 == 0) {
+        r = it->next();
+        ASSERT_EQ(r, expected + 3 >= 59'000 ? UInt64Row::largest() : UInt64Row{expected + 3});
+        target = r.val;
+      }
+    }
+  }
+
+  // Small skips stay in the current leaf, or climb a level or two, rather
+  // than starting from the root (at least five loads) every time.
+  auto it = Tree::iterator(tree);
+  pageManager->loads = 0;
+  for (uint64_t i = 0; i < 60'000; i += 4) {
+    it->skip_to(UInt64Row{i});
+  }
+  ASSERT_LT(pageManager->loads, 15'000 / 4);
+}
+
+// Every row, found by walking backwards from the end.
+template<class Tree>
+std::vector<UInt64Row> backwards(std::shared_ptr<Tree> tree) {
+  std::vector<UInt64Row> r;
+  auto it = Tree::iterator(tree);
+  for (UInt64Row row = it->skip_to_at_most(UInt64Row::largest()); row != UInt64Row::smallest(); row = it->prev()) {
+    r.push_back(row);
+  }
+  std::reverse(r.begin(), r.end());
+  return r;
+}
+
+TEST(SkipTreeTest, ReverseIteration) {
+  // prev links have to survive splits, merges, batches and bulk loads.
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  auto tree = std::make_shared<Tree>(pageManager, kNullPage);
+  ASSERT_EQ(backwards(tree), std::vector<UInt64Row>());
+
+  std::vector<uint64_t> vec;
+  for (uint64_t i = 1; i <= 5000; ++i) {
+    vec.push_back(i);
+  }
+  shuffle(vec.begin(), vec.end());
+  for (uint64_t x : vec) {
+    tree->insert(UInt64Row{x});
+  }
+  ASSERT_EQ(backwards(tree), tree->all());
+  for (size_t i = 0; i < 4000; ++i) {
+    tree->remove(UInt64Row{vec[i]});
+  }
+  ASSERT_EQ(backwards(tree), tree->all());
+  std::vector<UInt64Row> batch = range(2000, 9000);
+  tree->insert_batch(batch.data(), batch.size());
+  ASSERT_EQ(backwards(tree), tree->all());
+
+  auto pageManager2 = std::make_shared<MemoryPageManager<Tree::Node>>();
+  Tree::BulkLoader loader(pageManager2);
+  for (uint64_t i = 1; i < 5000; ++i) {
+    loader.add(UInt64Row{i});
+  }
+  auto tree2 = std::make_shared<Tree>(pageManager2, loader.finish());
+  ASSERT_EQ(backwards(tree2), tree2->all());
+}
+
+TEST(SkipTreeTest, IteratorSkipToAtMost) {
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  auto tree = std::make_shared<Tree>(pageManager, kNullPage);
+  std::vector<UInt64Row> rows;
+  for (uint64_t i = 1; i < 20'000; ++i) {
+    rows.push_back(UInt64Row{i * 3});
+  }
+  tree->insert_batch(rows.data(), rows.size());
+
+  // Skips backwards of every size (and the odd step forwards), mixed with
+  // prev(), within [30, 59'000).
+  for (uint64_t maxStep : {2, 20, 200, 20'000}) {
+    auto it = Tree::iterator(tree, UInt64Row{30}, UInt64Row{59'000});
+    uint64_t target = 70'000;
+    while (it->currentValue != UInt64Row::smallest()) {
+      target -= std::min<uint64_t>(target, std::rand() % maxStep);
+      if (std::rand() % 10 == 0) {
+        target += std::rand() % maxStep;
+      }
+      const uint64_t high = std::min<uint64_t>(target, 58'999);
+      const uint64_t expected = high / 3 * 3;
+      UInt64Row r = it->skip_to_at_most(UInt64Row{target});
+      if (expected < 30) {
+        ASSERT_EQ(r, UInt64Row::smallest());
+        break;
+      }
+      ASSERT_EQ(r, UInt64Row{expected});
+      if (std::rand() % 3 == 0) {
+        r = it->prev();
+        ASSERT_EQ(r, expected - 3 < 30 ? UInt64Row::smallest() : UInt64Row{expected - 3});
+        target = r.val;
+      }
+    }
+  }
+}
+
+TEST(SkipTreeTest, DescendingIntersection) {
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  auto twos = std::make_shared<Tree>(pageManager, kNullPage);
+  auto threes = std::make_shared<Tree>(pageManager, kNullPage);
+  for (uint64_t i = 1; i < 10'000; ++i) {
+    if (i % 2 == 0) {
+      twos->insert(UInt64Row{i});
+    }
+    if (i % 3 == 0) {
+      threes->insert(UInt64Row{i});
+    }
+  }
+  std::vector<std::shared_ptr<IteratorInterface<Reversed<UInt64Row>>>> iters = {
+    std::make_shared<ReverseIterator<UInt64Row>>(Tree::iterator(twos), UInt64Row{100}),
+    std::make_shared<ReverseIterator<UInt64Row>>(Tree::iterator(threes), UInt64Row{100}),
+  };
+  IntersectionIterator<Reversed<UInt64Row>> it(iters);
+  std::vector<uint64_t> r;
+  while (it.currentValue < Reversed<UInt64Row>::largest()) {
+    r.push_back(it.currentValue.row.val);
+    it.next();
+  }
+  ASSERT_EQ(r, std::vector<uint64_t>({96, 90, 84, 78, 72, 66, 60, 54, 48, 42, 36, 30, 24, 18, 12, 6}));
+}
+
+// Checks size(), nth() and count_range() against the rows the tree should
+// hold.
+template<class Tree>
+void check_counts(Tree *tree, const std::set<uint64_t>& gt) {
+  const std::vector<uint64_t> rows(gt.begin(), gt.end());
+  ASSERT_EQ(tree->size(), rows.size());
+  for (size_t k = 0; k < rows.size(); ++k) {
+    ASSERT_EQ(*tree->nth(k), UInt64Row{rows[k]}) << "k=" << k;
+  }
+  ASSERT_EQ(tree->nth(rows.size()), nullptr);
+  for (size_t i = 0; i < 100; ++i) {
+    const uint64_t low = std::rand() % 12'000;
+    const uint64_t high = low + std::rand() % 3'000;
+    const size_t expected = std::distance(gt.lower_bound(low), gt.lower_bound(high));
+    ASSERT_EQ(tree->count_range(UInt64Row{low}, UInt64Row{high}), expected);
+  }
+}
+
+TEST(SkipTreeTest, CountRows) {
+  typedef SkipTree<UInt64Row, 256, true> Tree;
+  static_assert(SkipTree<UInt64Row, 4096, true>::kNodeSize == 203);
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  Tree tree(pageManager, kNullPage);
+  std::set<uint64_t> gt;
+  check_counts(&tree, gt);
+
+  std::vector<uint64_t> vec;
+  for (uint64_t i = 1; i <= 5000; ++i) {
+    vec.push_back(i * 2);
+  }
+  shuffle(vec.begin(), vec.end());
+  for (uint64_t x : vec) {
+    gt.insert(x);
+    tree.insert(UInt64Row{x});
+  }
+  ASSERT_FALSE(tree.insert(UInt64Row{vec[0]}));
+  ASSERT_GE(pageManager->load_page(tree.rootLoc_)->depth, 2);
+  check_counts(&tree, gt);
+
+  // Removes cause merges and rebalances.
+  for (size_t i = 0; i < 3000; ++i) {
+    gt.erase(vec[i]);
+    tree.remove(UInt64Row{vec[i]});
+  }
+  ASSERT_FALSE(tree.remove(UInt64Row{vec[0]}));
+  check_counts(&tree, gt);
+
+  std::vector<UInt64Row> batch;
+  for (uint64_t i = 1; i < 12'000; i += 3) {
+    batch.push_back(UInt64Row{i});
+    gt.insert(i);
+  }
+  tree.insert_batch(batch.data(), batch.size());
+  check_counts(&tree, gt);
+}
+
+TEST(SkipTreeTest, CountRowsBulkLoad) {
+  typedef SkipTree<UInt64Row, 256, true> Tree;
+  for (double fillFactor : {1.0, 0.7}) {
+    for (uint64_t n : {0, 1, 13, 14, 100, 1000, 5000}) {
+      auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+      Tree::BulkLoader loader(pageManager, fillFactor);
+      std::set<uint64_t> gt;
+      for (uint64_t i = 0; i < n; ++i) {
+        gt.insert(i * 2);
+        loader.add(UInt64Row{i * 2});
+      }
+      Tree tree(pageManager, loader.finish());
+      check_counts(&tree, gt);
+    }
+  }
+}
+
+template<class Tree>
+void check_skip_n() {
+  auto pageManager = std::make_shared<MemoryPageManager<typename Tree::Node>>();
+  auto tree = std::make_shared<Tree>(pageManager, kNullPage);
+  std::vector<UInt64Row> rows = range(0, 20'000);
+  tree->insert_batch(rows.data(), rows.size());
+
+  for (uint64_t maxStep : {2, 50, 2'000, 30'000}) {
+    auto it = Tree::iterator(tree, UInt64Row{10}, UInt64Row{19'000});
+    uint64_t expected = 10;
+    while (expected < 19'000) {
+      ASSERT_EQ(it->currentValue, UInt64Row{expected});
+      const uint64_t n = std::rand() % maxStep;
+      expected += n;
+      it->skip_n(n);
+    }
+    ASSERT_EQ(it->currentValue, UInt64Row::largest());
+  }
+}
+
+TEST(SkipTreeTest, IteratorSkipN) {
+  check_skip_n<SkipTree<UInt64Row, 256>>();
+  check_skip_n<SkipTree<UInt64Row, 256, true>>();
+}
+
+TEST(SkipTreeTest, AppendsFillLeaves) {
+  typedef SkipTree<UInt64Row> Tree;
+  auto pageManager = std::make_shared<CountingPageManager<Tree::Node>>();
+  Tree tree(pageManager, kNullPage);
+  for (uint64_t i = 0; i < 100'000; ++i) {
+    ASSERT_TRUE(tree.insert(UInt64Row{i}));
+  }
+  ASSERT_EQ(tree.all(), range(0, 100'000));
+  // Leaves are split 90/10 rather than in half: 100'000 / 459 rounds up to
+  // 218, plus one internal node.
+  ASSERT_EQ(pageManager->pages_.size(), 218 + 1);
+  // Nearly every append goes straight to the last leaf.
+  ASSERT_LT(pageManager->loads, 110'000);
+}
+
+template<class Tree>
+void check_appends_and_removes(std::function<void(Tree *, const std::set<uint64_t>&)> check) {
+  auto pageManager = std::make_shared<MemoryPageManager<typename Tree::Node>>();
+  auto tree = std::make_shared<Tree>(pageManager, kNullPage);
+  std::set<uint64_t> gt;  // no 0s, which backwards() can't return
+  auto check_all = [&]() {
+    ASSERT_EQ(tree->all(), std::vector<UInt64Row>(gt.begin(), gt.end()));
+    ASSERT_EQ(backwards(tree), tree->all());
+    check(tree.get(), gt);
+  };
+
+  for (uint64_t i = 0; i < 3000; ++i) {
+    gt.insert(i * 2 + 1);
+    ASSERT_TRUE(tree->insert(UInt64Row{i * 2 + 1}));
+  }
+  check_all();
+
+  // Removing from the end empties the (small) rightmost nodes, one level
+  // after another.
+  for (uint64_t i = 3000; i-- > 100;) {
+    gt.erase(i * 2 + 1);
+    ASSERT_TRUE(tree->remove(UInt64Row{i * 2 + 1}));
+  }
+  check_all();
+
+  // Appends interleaved with inserts and removes elsewhere.
+  for (uint64_t i = 100; i < 6000; ++i) {
+    gt.insert(i * 2 + 1);
+    ASSERT_TRUE(tree->insert(UInt64Row{i * 2 + 1}));
+    const uint64_t x = 1 + std::rand() % (i * 2);
+    if (std::rand() % 2) {
+      ASSERT_EQ(tree->insert(UInt64Row{x}), gt.insert(x).second);
+    } else {
+      ASSERT_EQ(tree->remove(UInt64Row{x}), gt.erase(x) == 1);
+    }
+  }
+  check_all();
+  std::vector<uint64_t> vec(gt.begin(), gt.end());
+  shuffle(vec.begin(), vec.end());
+  for (uint64_t x : vec) {
+    gt.erase(x);
+    ASSERT_TRUE(tree->remove(UInt64Row{x}));
+  }
+  check_all();
+}
+
+TEST(SkipTreeTest, AppendsAndRemoves) {
+  check_appends_and_removes<SkipTree<UInt64Row, 256>>([](auto *, const std::set<uint64_t>&) {});
+  check_appends_and_removes<SkipTree<UInt64Row, 256, true>>([](auto *tree, const std::set<uint64_t>& gt) {
+    check_counts(tree, gt);
+  });
+}
+
+TEST(SkipTreeTest, FindMany) {
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto pageManager = std::make_shared<CountingPageManager<Tree::Node>>();
+  Tree tree(pageManager, kNullPage);
+  ASSERT_EQ(tree.find_many(nullptr, 0).size(), 0);
+  std::vector<UInt64Row> none = {UInt64Row{1}};
+  ASSERT_EQ(tree.find_many(none.data(), none.size()), std::vector<UInt64Row const *>({nullptr}));
+
+  std::vector<UInt64Row> rows;
+  for (uint64_t i = 0; i < 20'000; ++i) {
+    rows.push_back(UInt64Row{i * 3});
+  }
+  tree.insert_batch(rows.data(), rows.size());
+  for (uint64_t i = 0; i < 20'000; i += 7) {
+    ASSERT_TRUE(tree.remove(UInt64Row{i * 3}));
+  }
+  ASSERT_GE(pageManager->load_page(tree.rootLoc_)->depth, 3);
+
+  // Present and missing rows, with duplicates, at every density.
+  for (uint64_t n : {1, 10, 1'000, 50'000}) {
+    std::vector<UInt64Row> queries;
+    for (uint64_t i = 0; i < n; ++i) {
+      queries.push_back(UInt64Row{uint64_t(std::rand() % 61'000)});
+    }
+    std::sort(queries.begin(), queries.end());
+    pageManager->loads = 0;
+    std::vector<UInt64Row const *> found = tree.find_many(queries.data(), queries.size());
+    const uint64_t loads = pageManager->loads;
+    ASSERT_EQ(found.size(), n);
+    for (uint64_t i = 0; i < n; ++i) {
+      UInt64Row const *expected = tree.find(queries[i]);
+      if (expected == nullptr) {
+        ASSERT_EQ(found[i], nullptr) << queries[i];
+      } else {
+        ASSERT_NE(found[i], nullptr) << queries[i];
+        ASSERT_EQ(*found[i], queries[i]);
+      }
+    }
+    // Each node is visited once, however many queries land in it. (Pages
+    // are counted twice, since the default load_pages() loads them too, and
+    // a leaf may also be read by the leaf before it.)
+    ASSERT_LE(loads, 3 * pageManager->pages_.size());
+  }
+}
+
+TEST(SkipTreeTest, Snapshots) {
+  typedef SkipTree<UInt64Row, 256> Tree;
+  auto manager = std::make_shared<SnapshotPageManager<Tree::Node>>(std::make_shared<MemoryPageManager<Tree::Node>>());
+  auto tree = std::make_shared<Tree>(manager, kNullPage);
+  std::vector<UInt64Row> before;
+  for (uint64_t i = 0; i < 10'000; i += 2) {
+    tree->insert(UInt64Row{i});
+    before.push_back(UInt64Row{i});
+  }
+  auto snapshot = [&]() {
+    auto pages = std::make_shared<SnapshotPageManager<Tree::Node>::Snapshot>(manager);
+    return std::make_shared<Tree>(pages, tree->rootLoc_);
+  };
+
+  // Scan a snapshot while the tree splits and merges under it.
+  auto first = snapshot();
+  auto it = Tree::iterator(first);
+  std::vector<UInt64Row> seen;
+  std::shared_ptr<Tree> second;
+  std::vector<UInt64Row> middle;
+  for (uint64_t i = 0; it->currentValue < UInt64Row::largest(); ++i) {
+    seen.push_back(it->currentValue);
+    it->next();
+    tree->insert(UInt64Row{2 * i + 1});
+    if (i % 2 == 0) {
+      tree->remove(UInt64Row{2 * i});
+    }
+    if (i == 2'000) {
+      second = snapshot();
+      middle = tree->all();
+    }
+  }
+  ASSERT_EQ(seen, before);
+  ASSERT_EQ(first->all(), before);
+  ASSERT_EQ(first->find(UInt64Row{1}), nullptr);
+  ASSERT_THROW(first->insert(UInt64Row{1}), std::runtime_error);
+
+  // The second snapshot still sees the middle once the first is gone.
+  it.reset();
+  first.reset();
+  ASSERT_EQ(manager->num_snapshots(), 1);
+  ASSERT_EQ(second->all(), middle);
+  tree->insert(UInt64Row{1'000'000});
+  ASSERT_EQ(second->all(), middle);
+  second.reset();
+  ASSERT_EQ(manager->num_snapshots(), 0);
+  ASSERT_EQ(manager->snapshot_memory_used(), 0);
+
+  // Pages are only copied while someone can see them.
+  tree->insert(UInt64Row{1'000'001});
+  ASSERT_EQ(manager->snapshot_memory_used(), 0);
+}
+
+TEST(SkipTreeTest, ConcurrentReadersAndWriter) {
+  typedef SkipTree<UInt64Row, 256, false, true> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  auto tree = std::make_shared<Tree>(pageManager, kNullPage);
+  // Multiples of 4 are there the whole time. The writer keeps adding and
+  // removing the other even numbers, splitting and merging nodes under the
+  // readers, and odd numbers never show up.
+  const uint64_t kN = 20'000;
+  for (uint64_t i = 0; i < kN; i += 4) {
+    tree->insert(UInt64Row{i});
+  }
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> failures(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      while (!stop) {
+        const uint64_t x = rng() % kN;
+        UInt64Row row;
+        const bool found = tree->find(UInt64Row{x}, &row);
+        if ((x % 4 == 0 && !(found && row == UInt64Row{x})) || (x % 2 == 1 && found)) {
+          failures++;
+        }
+        // Scans see every multiple of 4, in order.
+        auto it = Tree::iterator(tree, UInt64Row{x}, UInt64Row{x + 400});
+        uint64_t expected = (x + 3) / 4 * 4;
+        uint64_t last = 0;
+        while (it->currentValue < UInt64Row::largest()) {
+          const uint64_t val = it->currentValue.val;
+          if (val % 2 == 1 || val > expected || (last != 0 && val <= last)) {
+            failures++;
+          }
+          if (val == expected) {
+            expected += 4;
+          }
+          last = val;
+          it->next();
+        }
+        if (expected < std::min(x + 400, kN)) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (int round = 0; round < 5; ++round) {
+    for (uint64_t i = 2; i < kN; i += 4) {
+      ASSERT_TRUE(tree->insert(UInt64Row{i}));
+    }
+    for (uint64_t i = 2; i < kN; i += 4) {
+      ASSERT_TRUE(tree->remove(UInt64Row{i}));
+    }
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(failures, 0);
+  std::vector<UInt64Row> expected;
+  for (uint64_t i = 0; i < kN; i += 4) {
+    expected.push_back(UInt64Row{i});
+  }
+  ASSERT_EQ(tree->all(), expected);
+}
+
+TEST(SkipTreeTest, ConcurrentWritersTakeTurns) {
+  typedef SkipTree<UInt64Row, 256, true, true> Tree;
+  auto pageManager = std::make_shared<MemoryPageManager<Tree::Node>>();
+  Tree tree(pageManager, kNullPage);
+  std::vector<std::thread> writers;
+  for (uint64_t t = 0; t < 4; ++t) {
+    writers.emplace_back([&tree, t]() {
+      for (uint64_t i = t; i < 20'000; i += 4) {
+        tree.insert(UInt64Row{i});
+      }
+      for (uint64_t i = t; i < 20'000; i += 8) {
+        tree.remove(UInt64Row{i});
+      }
+    });
+  }
+  for (std::thread& writer : writers) {
+    writer.join();
+  }
+  std::set<uint64_t> gt;
+  for (uint64_t i = 0; i < 20'000; ++i) {
+    if (i % 8 >= 4) {
+      gt.insert(i);
+    }
+  }
+  check_counts(&tree, gt);
+}
 
 }  // namespace
 
@@ -0,0 +1,88 @@
+// clang++ tests/uring_page_manager_tests.cpp -I/opt/homebrew/Cellar/googletest/1.14.0/include -std=c++20 -L/opt/homebrew/Cellar/googletest/1.14.0/lib -lgtest
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+
+#include "../src/common/InvertedIndex.h"
+#include "../src/common/UringPageManager.h"
+#include "../src/UInt64Row.h"
+
+using namespace cpot;
+
+namespace {
+
+void remove_index(const std::string& filename) {
+  for (std::string suffix : {"", ".header", ".rare"}) {
+    std::remove((filename + suffix).c_str());
+    std::remove((filename + suffix + ".dpm_header").c_str());
+  }
+}
+
+TEST(UringPageManagerTests, LoadPages) {
+  remove_index("test-index-uring");
+  {
+    auto manager = std::make_shared<UringPageManager<uint64_t>>("test-index-uring");
+    for (uint64_t i = 0; i < 1000; ++i) {
+      *manager->new_page() = i;
+    }
+  }
+  auto manager = std::make_shared<UringPageManager<uint64_t>>("test-index-uring", 0, 0, 16);
+  std::vector<PageLoc> locs;
+  for (uint64_t i = 0; i < 100; ++i) {
+    locs.push_back((i * 379) % 1000);
+  }
+  *manager->load_and_modify_page(locs[5]) = 12345;
+  locs.push_back(locs[7]);  // duplicates are fine
+  manager->load_pages(locs.data(), locs.size());
+
+  // Everything asked for is cached (and the modified page wasn't reread).
+  ASSERT_EQ(manager->currentMemoryUsed(), 100 * sizeof(uint64_t));
+  ASSERT_EQ(manager->total_read_stats().pages, 100);
+  if (manager->uses_io_uring()) {
+    // 99 reads through a 16-entry ring.
+    ASSERT_EQ(manager->total_read_stats().syscalls, 1 + 7);
+  }
+  for (size_t i = 0; i < 100; ++i) {
+    ASSERT_EQ(*manager->load_page(locs[i]), i == 5 ? 12345 : locs[i]);
+  }
+  ASSERT_EQ(manager->total_read_stats().pages, 100);
+}
+
+TEST(UringPageManagerTests, IteratorsMatch) {
+  remove_index("test-index-uring");
+  {
+    InvertedIndex<UInt64Row> index("test-index-uring", Storage::kUring);
+    for (uint64_t doc = 1; doc <= 20'000; ++doc) {
+      for (uint64_t token = 1; token < 10; ++token) {
+        if (doc % token == 0) {
+          index.insert(token, UInt64Row{doc});
+        }
+      }
+      // A rare token.
+      if (doc % 1000 == 0) {
+        index.insert(100, UInt64Row{doc});
+      }
+    }
+  }
+  InvertedIndex<UInt64Row> index("test-index-uring", Storage::kUring);
+  std::vector<Token> tokens = {2, 3, 7, 100, 55};  // 55 doesn't exist
+  auto iters = index.iterators(tokens, UInt64Row{5000});
+  ASSERT_EQ(iters.size(), tokens.size());
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    auto expected = index.iterator(tokens[i], UInt64Row{5000});
+    while (expected->currentValue < UInt64Row::largest()) {
+      ASSERT_EQ(iters[i]->currentValue, expected->currentValue);
+      iters[i]->next();
+      expected->next();
+    }
+    ASSERT_EQ(iters[i]->currentValue, UInt64Row::largest());
+  }
+}
+
+}  // namespace
+
+int main() {
+  testing::InitGoogleTest();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,104 @@
+// clang++ tests/vacuum_tests.cpp -I/opt/homebrew/Cellar/googletest/1.14.0/include -std=c++20 -L/opt/homebrew/Cellar/googletest/1.14.0/lib -lgtest
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <sys/stat.h>
+
+#include "../src/common/InvertedIndex.h"
+#include "../src/UInt64Row.h"
+
+using namespace cpot;
+
+namespace {
+
+void remove_index(const std::string& filename) {
+  for (std::string suffix : {"", ".header", ".rare"}) {
+    std::remove((filename + suffix).c_str());
+    std::remove((filename + suffix + ".dpm_header").c_str());
+  }
+  std::remove((filename + ".wal").c_str());
+}
+
+uint64_t file_size(const std::string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {
+    return 0;
+  }
+  return st.st_size;
+}
+
+std::vector<UInt64Row> expected_rows(uint64_t token, uint64_t n) {
+  std::vector<UInt64Row> r;
+  for (uint64_t doc = 1; doc <= n; ++doc) {
+    if (doc % token == 0 && doc % 10 == 0) {
+      r.push_back(UInt64Row{doc});
+    }
+  }
+  return r;
+}
+
+void build(Storage storage) {
+  const uint64_t N = 50'000;
+  {
+    InvertedIndex<UInt64Row> index("test-index-vacuum", storage);
+    for (uint64_t doc = 1; doc <= N; ++doc) {
+      for (uint64_t token = 1; token < 6; ++token) {
+        if (doc % token == 0) {
+          index.insert(token, UInt64Row{doc});
+        }
+      }
+    }
+    index.commit();
+    const uint64_t before = file_size("test-index-vacuum");
+
+    // Keep every tenth row.
+    for (uint64_t doc = 1; doc <= N; ++doc) {
+      if (doc % 10 == 0) {
+        continue;
+      }
+      for (uint64_t token = 1; token < 6; ++token) {
+        if (doc % token == 0) {
+          index.remove(token, UInt64Row{doc});
+        }
+      }
+    }
+    index.commit();
+    ASSERT_EQ(file_size("test-index-vacuum"), before);
+
+    index.vacuum();
+    // Docs were inserted in order, so the leaves started out 90% full, but
+    // after the removes they may be only half full.
+    ASSERT_LT(file_size("test-index-vacuum"), before / 3);
+    ASSERT_EQ(index.pageManager->plan_compaction().size(), 0);
+    for (uint64_t token = 1; token < 6; ++token) {
+      ASSERT_EQ(index.all(token), expected_rows(token, N));
+    }
+
+    // The index still works after moving things around.
+    index.insert(3, UInt64Row{N + 3});
+    index.remove(3, UInt64Row{N + 3});
+  }
+
+  InvertedIndex<UInt64Row> index("test-index-vacuum", storage);
+  for (uint64_t token = 1; token < 6; ++token) {
+    ASSERT_EQ(index.all(token), expected_rows(token, N));
+  }
+}
+
+TEST(VacuumTests, Disk) {
+  remove_index("test-index-vacuum");
+  build(Storage::kDisk);
+}
+
+TEST(VacuumTests, Mmap) {
+  remove_index("test-index-vacuum");
+  build(Storage::kMmap);
+}
+
+}  // namespace
+
+int main() {
+  testing::InitGoogleTest();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,194 @@
+// clang++ tests/write_ahead_log_tests.cpp -I/opt/homebrew/Cellar/googletest/1.14.0/include -std=c++20 -L/opt/homebrew/Cellar/googletest/1.14.0/lib -lgtest
+
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/common/InvertedIndex.h"
+#include "../src/common/WriteAheadLog.h"
+#include "../src/UInt64Row.h"
+
+using namespace cpot;
+
+namespace {
+
+void remove_index(const std::string& filename) {
+  for (std::string suffix : {"", ".header", ".rare"}) {
+    std::remove((filename + suffix).c_str());
+    std::remove((filename + suffix + ".dpm_header").c_str());
+  }
+  std::remove((filename + ".wal").c_str());
+  std::remove((filename + ".ckpt").c_str());
+}
+
+uint64_t file_size(const std::string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {
+    return 0;
+  }
+  return st.st_size;
+}
+
+TEST(WriteAheadLogTests, ReplayStopsAtTornRecord) {
+  std::remove("test-index-wal");
+  {
+    WriteAheadLog<uint64_t> wal("test-index-wal");
+    wal.append(1);
+    wal.append(2);
+    wal.sync();
+    wal.append(3);
+    wal.sync();
+    ASSERT_EQ(wal.size(), 3 * sizeof(WriteAheadLog<uint64_t>::Entry));
+  }
+  // Half a record, as if we crashed in the middle of a write.
+  FILE *f = fopen("test-index-wal", "ab");
+  fwrite("garbage", 1, 7, f);
+  fclose(f);
+
+  WriteAheadLog<uint64_t> wal("test-index-wal");
+  std::vector<uint64_t> records;
+  wal.replay([&](uint64_t x) { records.push_back(x); });
+  ASSERT_EQ(records, std::vector<uint64_t>({1, 2, 3}));
+  ASSERT_EQ(file_size("test-index-wal"), 3 * sizeof(WriteAheadLog<uint64_t>::Entry));
+
+  wal.reset();
+  ASSERT_TRUE(wal.empty());
+  ASSERT_EQ(file_size("test-index-wal"), 0);
+}
+
+TEST(WriteAheadLogTests, RecoversCommittedChanges) {
+  remove_index("test-index-wal");
+  {
+    // We never delete this index, as if the process died: nothing but the
+    // log reaches the disk.
+    auto *index = new InvertedIndex<UInt64Row>("test-index-wal", Storage::kDisk, 0, Durability::kWal);
+    for (uint64_t doc = 1; doc <= 2000; ++doc) {
+      index->insert(doc % 7, UInt64Row{doc});
+    }
+    index->insert(100, UInt64Row{5});
+    index->remove(3, UInt64Row{3});
+    index->commit();
+    ASSERT_EQ(file_size("test-index-wal"), 0);
+    ASSERT_GT(file_size("test-index-wal.wal"), 0);
+
+    // Not committed, so lost.
+    index->insert(100, UInt64Row{6});
+  }
+
+  {
+    InvertedIndex<UInt64Row> index("test-index-wal", Storage::kDisk, 0, Durability::kWal);
+    // Replaying checkpoints.
+    ASSERT_EQ(file_size("test-index-wal.wal"), 0);
+    ASSERT_EQ(index.all(1).size(), 286);
+    ASSERT_EQ(index.all(3).size(), 285);
+    ASSERT_EQ(index.all(3)[0], UInt64Row{10});
+    ASSERT_EQ(index.all(100), std::vector<UInt64Row>({UInt64Row{5}}));
+    index.insert(100, UInt64Row{7});
+  }
+
+  // Closing checkpoints too, so the files can be opened without the log.
+  InvertedIndex<UInt64Row> index("test-index-wal");
+  ASSERT_EQ(index.all(100), std::vector<UInt64Row>({UInt64Row{5}, UInt64Row{7}}));
+  ASSERT_EQ(index.all(2).size(), 286);
+}
+
+// Opens an index, makes some changes and commits them, and then starts a
+// checkpoint that `crash` cuts short. The index is never deleted, as if the
+// process died.
+template<class F>
+void crash_during_checkpoint(F crash) {
+  remove_index("test-index-wal");
+  auto *index = new InvertedIndex<UInt64Row>("test-index-wal", Storage::kDisk, 0, Durability::kWal);
+  for (uint64_t doc = 1; doc <= 2000; ++doc) {
+    index->insert(doc % 7, UInt64Row{doc});
+  }
+  index->commit();
+  index->wal_->sync();
+  index->store_->write_journal();
+  crash(index);
+}
+
+void check_after_crash() {
+  InvertedIndex<UInt64Row> index("test-index-wal", Storage::kDisk, 0, Durability::kWal);
+  ASSERT_EQ(file_size("test-index-wal.wal"), 0);
+  ASSERT_EQ(file_size("test-index-wal.ckpt"), 0);
+  std::vector<uint64_t> counts(7, 0);
+  for (uint64_t doc = 1; doc <= 2000; ++doc) {
+    counts[doc % 7] += 1;
+  }
+  for (uint64_t token = 0; token < 7; ++token) {
+    ASSERT_EQ(index.count(token), counts[token]);
+    ASSERT_EQ(index.all(token).size(), counts[token]);
+  }
+}
+
+TEST(WriteAheadLogTests, CrashBeforeLogIsEmptied) {
+  // The pages reached the disk, but the log still has the records that
+  // produced them; replaying them again would count every row twice.
+  crash_during_checkpoint([](InvertedIndex<UInt64Row> *index) {
+    index->store_->commit();
+    index->store_->sync();
+  });
+  check_after_crash();
+}
+
+TEST(WriteAheadLogTests, CrashWhileWritingPages) {
+  // The log is empty, and the header's root page was torn on its way to disk.
+  crash_during_checkpoint([](InvertedIndex<UInt64Row> *index) {
+    index->wal_->reset();
+    index->store_->commit();
+    FILE *f = fopen("test-index-wal", "rb+");
+    std::vector<char> garbage(sizeof(InvertedIndex<UInt64Row>::Page) / 2, 'x');
+    fwrite(garbage.data(), 1, garbage.size(), f);
+    fclose(f);
+  });
+  check_after_crash();
+}
+
+TEST(WriteAheadLogTests, CrashWhileWritingJournal) {
+  // A torn journal is ignored, and the log replayed.
+  crash_during_checkpoint([](InvertedIndex<UInt64Row> *) {
+    ASSERT_EQ(truncate("test-index-wal.ckpt", file_size("test-index-wal.ckpt") - 1), 0);
+  });
+  check_after_crash();
+}
+
+TEST(WriteAheadLogTests, CheckpointsToStayUnderBudget) {
+  remove_index("test-index-wal");
+  const uint64_t kBudget = 64 * sizeof(SkipTree<UInt64Row>::Node);
+  InvertedIndex<UInt64Row> index("test-index-wal", Storage::kDisk, kBudget, Durability::kWal);
+  for (uint64_t doc = 1; doc <= 50'000; ++doc) {
+    index.insert(doc % 3, UInt64Row{doc});
+    ASSERT_LE(index.currentMemoryUsed(), 3 * kBudget + 3 * 20 * sizeof(SkipTree<UInt64Row>::Node));
+  }
+  ASSERT_EQ(index.all(0).size(), 16'666);
+}
+
+TEST(WriteAheadLogTests, BulkLoadCheckpointsOnlyWhenFinished) {
+  remove_index("test-index-wal");
+  const uint64_t kBudget = 64 * sizeof(SkipTree<UInt64Row>::Node);
+  InvertedIndex<UInt64Row> index("test-index-wal", Storage::kDisk, kBudget, Durability::kWal);
+  InvertedIndex<UInt64Row>::BulkLoader loader(&index);
+  for (uint64_t token = 0; token < 3; ++token) {
+    for (uint64_t doc = 1; doc <= 50'000; ++doc) {
+      loader.add(token, UInt64Row{doc});
+    }
+  }
+  // Over budget, but a checkpoint now would save a half-built index.
+  ASSERT_GT(index.currentMemoryUsed(), kBudget);
+  ASSERT_NE(access("test-index-wal.ckpt", F_OK), 0);
+  loader.finish();
+  ASSERT_EQ(access("test-index-wal.ckpt", F_OK), 0);
+  for (uint64_t token = 0; token < 3; ++token) {
+    ASSERT_EQ(index.all(token).size(), 50'000);
+  }
+}
+
+}  // namespace
+
+int main() {
+  testing::InitGoogleTest();
+  return RUN_ALL_TESTS();
+}